@@ -0,0 +1,184 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "t3widget/bytematcher.h"
+#include "t3widget/internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace t3widget {
+
+static inline unsigned char fold(unsigned char c) { return c >= 'A' && c <= 'Z' ? c + 0x20 : c; }
+
+/* Compares size bytes at data with the needle, folding the bytes from data if icase is set. */
+static inline bool equal_folded(const char *data, const char *needle, size_t size, bool icase) {
+  if (!icase) {
+    return memcmp(data, needle, size) == 0;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if (fold(data[i]) != static_cast<unsigned char>(needle[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef HAS_X86_SIMD
+/* Sets bit 0x20 in the bytes of v which are upper case ASCII letters. Bytes with the high bit set
+   compare as negative numbers, and are therefore left alone. */
+__attribute__((target("sse2"))) static inline __m128i fold_sse2(__m128i v) {
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+  return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+/* Tests 16 positions at a time for a match of both the first and the last byte of the needle.
+   Only for the positions where both match, the rest of the needle is compared. */
+__attribute__((target("sse2"))) static text_pos_t find_sse2(const std::string &needle, bool icase,
+                                                            string_view haystack) {
+  const char *data = haystack.data();
+  const size_t size = haystack.size();
+  const size_t needle_size = needle.size();
+  if (needle_size > size) {
+    return -1;
+  }
+
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_size - 1]);
+  size_t i = 0;
+  for (; i + needle_size + 15 <= size; i += 16) {
+    __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i block_last =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + needle_size - 1));
+    if (icase) {
+      block_first = fold_sse2(block_first);
+      block_last = fold_sse2(block_last);
+    }
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last))));
+    while (mask != 0) {
+      size_t candidate = i + __builtin_ctz(mask);
+      if (equal_folded(data + candidate, needle.data(), needle_size, icase)) {
+        return candidate;
+      }
+      mask &= mask - 1;
+    }
+  }
+  for (; i + needle_size <= size; ++i) {
+    if (equal_folded(data + i, needle.data(), needle_size, icase)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool cpu_has_sse2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+#endif
+
+byte_matcher_t::byte_matcher_t(string_view needle, bool icase)
+    : needle_(needle.data(), needle.size()), icase_(icase) {
+  ASSERT(!needle_.empty());
+  const size_t size = needle_.size();
+  std::fill(shift_, shift_ + 256, size);
+  std::fill(reverse_shift_, reverse_shift_ + 256, size);
+  for (size_t i = 0; i + 1 < size; ++i) {
+    shift_[static_cast<unsigned char>(needle_[i])] = size - 1 - i;
+  }
+  for (size_t i = size - 1; i > 0; --i) {
+    reverse_shift_[static_cast<unsigned char>(needle_[i])] = i;
+  }
+}
+
+text_pos_t byte_matcher_t::find(string_view haystack) const {
+#ifdef HAS_X86_SIMD
+  static const bool use_sse2 = cpu_has_sse2();
+  if (use_sse2) {
+    return find_sse2(needle_, icase_, haystack);
+  }
+#endif
+  return find_scalar(haystack);
+}
+
+text_pos_t byte_matcher_t::find_scalar(string_view haystack) const {
+  const char *data = haystack.data();
+  const size_t needle_size = needle_.size();
+  const unsigned char last = needle_[needle_size - 1];
+  if (needle_size > haystack.size()) {
+    return -1;
+  }
+
+  for (size_t i = 0; i + needle_size <= haystack.size();) {
+    unsigned char c = data[i + needle_size - 1];
+    if (icase_) {
+      c = fold(c);
+    }
+    if (c == last && equal_folded(data + i, needle_.data(), needle_size - 1, icase_)) {
+      return i;
+    }
+    i += shift_[c];
+  }
+  return -1;
+}
+
+text_pos_t byte_matcher_t::rfind(string_view haystack) const {
+  const char *data = haystack.data();
+  const size_t needle_size = needle_.size();
+  const unsigned char first = needle_[0];
+  if (needle_size > haystack.size()) {
+    return -1;
+  }
+
+  for (text_pos_t i = haystack.size() - needle_size; i >= 0;) {
+    unsigned char c = data[i];
+    if (icase_) {
+      c = fold(c);
+    }
+    if (c == first &&
+        equal_folded(data + i + 1, needle_.data() + 1, needle_size - 1, icase_)) {
+      return i;
+    }
+    i -= reverse_shift_[c];
+  }
+  return -1;
+}
+
+bool byte_matcher_t::is_ascii(string_view data) {
+  const char *ptr = data.data();
+  const char *end = ptr + data.size();
+  while (end - ptr >= 8) {
+    uint64_t word;
+    memcpy(&word, ptr, 8);
+    if (word & UINT64_C(0x8080808080808080)) {
+      return false;
+    }
+    ptr += 8;
+  }
+  for (; ptr < end; ++ptr) {
+    if (*ptr & 0x80) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace t3widget
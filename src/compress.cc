@@ -0,0 +1,168 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "t3widget/compress.h"
+
+namespace t3widget {
+
+/* Each sequence in the LZ4 block format consists of a token byte, which holds the number of
+   literals in the upper four bits and the match length minus MIN_MATCH in the lower four bits. If
+   either is 15, it is followed by extra length bytes. After the literals follows the offset of the
+   match as a 16 bit little endian number. The last sequence only contains literals. */
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+/* The LZ4 format requires that the last LAST_LITERALS bytes are literals, and that the last match
+   starts at least MATCH_LIMIT bytes before the end. */
+#define LAST_LITERALS 5
+#define MATCH_LIMIT 12
+#define HASH_BITS 12
+
+static inline uint32_t read32(const unsigned char *ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+static inline uint32_t hash_sequence(uint32_t sequence) {
+  return (sequence * UINT32_C(2654435761)) >> (32 - HASH_BITS);
+}
+
+static void write_length(size_t length, std::string *result) {
+  while (length >= 255) {
+    result->push_back('\xff');
+    length -= 255;
+  }
+  result->push_back(static_cast<char>(length));
+}
+
+static void write_sequence(const unsigned char *literals, size_t literal_length, size_t offset,
+                           size_t match_length, std::string *result) {
+  size_t match_code = match_length == 0 ? 0 : match_length - MIN_MATCH;
+  result->push_back(static_cast<char>((std::min<size_t>(literal_length, 15) << 4) |
+                                      std::min<size_t>(match_code, 15)));
+  if (literal_length >= 15) {
+    write_length(literal_length - 15, result);
+  }
+  result->append(reinterpret_cast<const char *>(literals), literal_length);
+  if (match_length == 0) {
+    return;
+  }
+  result->push_back(static_cast<char>(offset & 0xff));
+  result->push_back(static_cast<char>(offset >> 8));
+  if (match_code >= 15) {
+    write_length(match_code - 15, result);
+  }
+}
+
+void compress_block(string_view data, std::string *result) {
+  const unsigned char *base = reinterpret_cast<const unsigned char *>(data.data());
+  size_t size = data.size();
+  size_t anchor = 0;
+
+  if (size > MATCH_LIMIT) {
+    // Position of the last occurrence of each hashed four byte sequence.
+    std::vector<uint32_t> table(1 << HASH_BITS, 0);
+    size_t match_start_limit = size - MATCH_LIMIT;
+    size_t match_end_limit = size - LAST_LITERALS;
+    size_t pos = 1;
+
+    while (pos < match_start_limit) {
+      uint32_t sequence = read32(base + pos);
+      uint32_t &slot = table[hash_sequence(sequence)];
+      size_t candidate = slot;
+      slot = pos;
+      if (pos - candidate > MAX_OFFSET || read32(base + candidate) != sequence) {
+        ++pos;
+        continue;
+      }
+
+      size_t match_end = pos + MIN_MATCH;
+      while (match_end < match_end_limit && base[match_end] == base[candidate + match_end - pos]) {
+        ++match_end;
+      }
+      write_sequence(base + anchor, pos - anchor, pos - candidate, match_end - pos, result);
+      pos = anchor = match_end;
+    }
+  }
+  write_sequence(base + anchor, size - anchor, 0, 0, result);
+}
+
+static bool read_length(const unsigned char **ptr, const unsigned char *end, size_t *length) {
+  unsigned char byte;
+  do {
+    if (*ptr == end) {
+      return false;
+    }
+    byte = *(*ptr)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+bool decompress_block(string_view data, size_t size, std::string *result) {
+  const unsigned char *ptr = reinterpret_cast<const unsigned char *>(data.data());
+  const unsigned char *end = ptr + data.size();
+  size_t out = 0;
+
+  result->resize(size);
+  char *dest = &(*result)[0];
+  while (ptr < end) {
+    unsigned char token = *ptr++;
+
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !read_length(&ptr, end, &literal_length)) {
+      return false;
+    }
+    if (static_cast<size_t>(end - ptr) < literal_length || size - out < literal_length) {
+      return false;
+    }
+    memcpy(dest + out, ptr, literal_length);
+    ptr += literal_length;
+    out += literal_length;
+    if (ptr == end) {
+      break;
+    }
+
+    if (end - ptr < 2) {
+      return false;
+    }
+    size_t offset = ptr[0] | (ptr[1] << 8);
+    ptr += 2;
+    size_t match_length = token & 15;
+    if (match_length == 15 && !read_length(&ptr, end, &match_length)) {
+      return false;
+    }
+    match_length += MIN_MATCH;
+    if (offset == 0 || offset > out || size - out < match_length) {
+      return false;
+    }
+    // A match that overlaps the output it produces must be copied a byte at a time.
+    const char *match = dest + out - offset;
+    if (offset >= match_length) {
+      memcpy(dest + out, match, match_length);
+    } else {
+      for (size_t i = 0; i < match_length; ++i) {
+        dest[out + i] = match[i];
+      }
+    }
+    out += match_length;
+  }
+  return out == size;
+}
+
+}  // namespace t3widget
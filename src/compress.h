@@ -0,0 +1,47 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_COMPRESS_H
+#define T3_WIDGET_COMPRESS_H
+
+#ifndef _T3_WIDGET_INTERNAL
+#error This header file is for internal use _only_!!
+#endif
+
+#include <cstddef>
+#include <string>
+#include <t3widget/string_view.h>
+#include <t3widget/widget_api.h>
+
+namespace t3widget {
+
+/** Compress @p data, appending the result to @p result.
+
+    The output uses the LZ4 block format, produced by a simple greedy compressor. It is optimized
+    for speed rather than compression ratio, which still works well for text with many repeated
+    parts such as log files. The size of the uncompressed data is not stored, and must be passed to
+    decompress_block.
+*/
+T3_WIDGET_LOCAL void compress_block(string_view data, std::string *result);
+
+/** Decompress data produced by compress_block.
+    @param data The compressed data.
+    @param size The size of the uncompressed data.
+    @param result The location to store the uncompressed data.
+    @return @c false if @p data is corrupt.
+*/
+T3_WIDGET_LOCAL bool decompress_block(string_view data, size_t size, std::string *result);
+
+}  // namespace t3widget
+
+#endif
@@ -44,7 +44,12 @@ struct find_dialog_t::implementation_t {
   button_t *in_selection_button, *replace_all_button;
   connection_t find_button_up_connection;
   int state;  // State of all the checkboxes converted to FIND_* flags
+  bool incremental = false;
+  // Connection to the update notification, while an incremental find is pending.
+  connection_t incremental_connection;
+  bool incremental_pending = false;
   signal_t<std::shared_ptr<finder_t>, find_action_t> activate;
+  signal_t<std::shared_ptr<finder_t>> incremental_find;
 };
 
 // FIXME: keep (limited) history
@@ -61,6 +66,7 @@ find_dialog_t::find_dialog_t(int _state)
   impl->find_line->set_position(0, 1);
   impl->find_line->set_label(find_label);
   impl->find_line->connect_activate([this] { find_activated(); });
+  impl->find_line->connect_changed([this] { schedule_incremental_find(); });
 
   impl->replace_label = emplace_back<smart_label_t>("Re_place with", true);
   impl->replace_label->set_position(2, 2);
@@ -201,7 +207,7 @@ find_dialog_t::find_dialog_t(int _state)
   find_dialog_t::set_state(_state);
 }
 
-find_dialog_t::~find_dialog_t() {}
+find_dialog_t::~find_dialog_t() { impl->incremental_connection.disconnect(); }
 
 bool find_dialog_t::set_size(optint height, optint width) {
   (void)height;
@@ -211,8 +217,11 @@ bool find_dialog_t::set_size(optint height, optint width) {
 
 void find_dialog_t::set_text(string_view str) { impl->find_line->set_text(str); }
 
-#define TOGGLED_CALLBACK(name, flag_name) \
-  void find_dialog_t::name##_toggled() { impl->state ^= find_flags_t::flag_name; }
+#define TOGGLED_CALLBACK(name, flag_name)   \
+  void find_dialog_t::name##_toggled() {    \
+    impl->state ^= find_flags_t::flag_name; \
+    schedule_incremental_find();            \
+  }
 TOGGLED_CALLBACK(backward, BACKWARD)
 TOGGLED_CALLBACK(icase, ICASE)
 TOGGLED_CALLBACK(wrap, WRAP)
@@ -223,6 +232,7 @@ TOGGLED_CALLBACK(whole_word, WHOLE_WORD)
 void find_dialog_t::regex_toggled() {
   impl->state ^= find_flags_t::REGEX;
   impl->transform_backslash_checkbox->set_enabled(!(impl->state & find_flags_t::REGEX));
+  schedule_incremental_find();
 }
 
 void find_dialog_t::find_activated() { find_activated(find_action_t::FIND); }
@@ -247,6 +257,35 @@ void find_dialog_t::find_activated(find_action_t action) {
   }
 }
 
+void find_dialog_t::schedule_incremental_find() {
+  if (!impl->incremental || impl->incremental_pending) {
+    return;
+  }
+  /* The update notification is processed after the keys that are already waiting, such that typing
+     quickly does not start a search for every key. */
+  impl->incremental_pending = true;
+  impl->incremental_connection = connect_update_notification([this] { incremental_find(); });
+  signal_update();
+}
+
+void find_dialog_t::incremental_find() {
+  impl->incremental_connection.disconnect();
+  impl->incremental_pending = false;
+  if (!impl->incremental || !window.is_shown()) {
+    return;
+  }
+
+  std::shared_ptr<finder_t> finder;
+  if (!impl->find_line->get_text().empty()) {
+    // Errors are expected while typing a regular expression, so they are not reported here.
+    std::string error_message;
+    finder = finder_t::create(impl->find_line->get_text(), impl->state, &error_message);
+  }
+  impl->incremental_find(finder);
+}
+
+void find_dialog_t::set_incremental(bool incremental) { impl->incremental = incremental; }
+
 void find_dialog_t::set_replace(bool replace) {
   if (replace == impl->replace_line->is_shown()) {
     return;
@@ -284,6 +323,7 @@ void find_dialog_t::set_state(int _state) {
 }
 
 _T3_WIDGET_IMPL_SIGNAL(find_dialog_t, activate, std::shared_ptr<finder_t>, find_action_t)
+_T3_WIDGET_IMPL_SIGNAL(find_dialog_t, incremental_find, std::shared_ptr<finder_t>)
 
 //============= replace_buttons_dialog_t ===============
 struct replace_buttons_dialog_t::implementation_t {
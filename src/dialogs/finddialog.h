@@ -39,6 +39,9 @@ class T3_WIDGET_API find_dialog_t : public dialog_t {
   void whole_word_toggled();
   void find_activated();
   void find_activated(find_action_t);
+  /** Arrange for incremental_find to be called once the pending input has been processed. */
+  void schedule_incremental_find();
+  void incremental_find();
 
  public:
   ~find_dialog_t() override;
@@ -47,8 +50,18 @@ class T3_WIDGET_API find_dialog_t : public dialog_t {
   virtual void set_text(string_view str);
   virtual void set_replace(bool _replace);
   virtual void set_state(int _state);
+  /** Set whether to search while the user types.
+
+      In incremental mode the @c incremental_find signal is emitted whenever the user changes the
+      text to search for or the search options. Changes made while processing a batch of keys
+      result in a single emission, after the batch has been processed. Its argument is the
+      ::finder_t for the new search, or @c nullptr if the text is empty or not a valid search
+      expression. The receiver should search in the background, to keep the dialog responsive.
+  */
+  virtual void set_incremental(bool incremental);
 
   T3_WIDGET_DECLARE_SIGNAL(activate, std::shared_ptr<finder_t>, find_action_t);
+  T3_WIDGET_DECLARE_SIGNAL(incremental_find, std::shared_ptr<finder_t>);
 };
 
 class T3_WIDGET_API replace_buttons_dialog_t : public dialog_t {
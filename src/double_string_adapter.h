@@ -19,12 +19,12 @@
 #endif
 
 #include <t3widget/string_view.h>
-#include <t3widget/tinystring.h>
+#include <t3widget/undo.h>
 #include <t3window/utf8.h>
 
 namespace t3widget {
 
-/* Class which allows storing two separate strings in a single tiny_string_t. This is used by the
+/* Class which allows storing two separate strings in a single undo_text_t. This is used by the
    undo system to store the information for OVERWRITE actions.
    The layout of the data is as follows:
    - A UTF-8 encoded length of the first string.
@@ -34,7 +34,7 @@ namespace t3widget {
    moving bytes around. */
 class double_string_adapter_t {
  public:
-  double_string_adapter_t(tiny_string_t *str) : str_(str) {
+  double_string_adapter_t(undo_text_t *str) : str_(str) {
     if (str_->empty()) {
       str_->assign(string_view("\0", 1));
       first_size_ = 0;
@@ -46,12 +46,21 @@ class double_string_adapter_t {
     }
   }
 
-  string_view first() const { return string_view(str_->data() + first_start_, first_size_); }
-  string_view second() const {
-    const size_t offset = second_start();
-    return string_view(str_->data() + offset, str_->size() - offset);
+  // Read-only access to strings stored by another double_string_adapter_t.
+  explicit double_string_adapter_t(string_view str) : str_(nullptr), view_(str) {
+    if (view_.empty()) {
+      first_size_ = 0;
+      first_start_ = 0;
+    } else {
+      size_t utf8_size = view_.size();
+      first_size_ = t3_utf8_get(view_.data(), &utf8_size);
+      first_start_ = utf8_size;
+    }
   }
 
+  string_view first() const { return data().substr(first_start_, first_size_); }
+  string_view second() const { return data().substr(second_start()); }
+
   double_string_adapter_t &append_first(string_view str) {
     str_->insert(second_start(), str);
     first_size_ += str.size();
@@ -70,8 +79,10 @@ class double_string_adapter_t {
 
  private:
   size_t second_start() const { return first_start_ + first_size_; }
+  string_view data() const { return str_ != nullptr ? string_view(*str_) : view_; }
 
-  tiny_string_t *str_;
+  undo_text_t *str_;
+  string_view view_;
   size_t first_size_;
   size_t first_start_;
 };
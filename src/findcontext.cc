@@ -25,22 +25,28 @@
 #include <string>
 #include <unicase.h>
 
+#include "t3widget/bytematcher.h"
 #include "t3widget/findcontext.h"
 #include "t3widget/internal.h"
 #include "t3widget/string_view.h"
 #include "t3widget/stringmatcher.h"
+#include "t3widget/utf8validate.h"
 #include "t3widget/util.h"
 #include "widget_api.h"
 
 namespace t3widget {
 
 class T3_WIDGET_LOCAL finder_base_t : public finder_t {
+  friend class finder_t;
+
  public:
   /** Set the needle.
       @returns Whether the operation was successful. If unsuccessful, error_message will contain a
      description of the error. */
   virtual bool set_needle(const std::string &needle, std::string *error_message) = 0;
 
+  std::unique_ptr<finder_t> clone() const override;
+
  protected:
   /** Create a new empty finder_t. */
   finder_base_t(int flags, const std::string *replacement) : flags_(flags) {
@@ -52,6 +58,9 @@ class T3_WIDGET_LOCAL finder_base_t : public finder_t {
   /** Flags indicating what type of search was requested. */
   int flags_;
 
+  /** The needle as passed to set_needle, for creating clones. */
+  std::string needle_;
+
   /** Replacement string. */
   std::unique_ptr<std::string> replacement_;
 
@@ -76,6 +85,10 @@ class T3_WIDGET_LOCAL plain_finder_t : public finder_base_t {
  private:
   /** Pointer to a string_matcher_t, if a non-regex search was requested. */
   std::unique_ptr<string_matcher_t> matcher;
+  /** Byte-level matcher used instead of matcher when it gives the same results, or @c nullptr if
+      the needle does not allow it. For case-insensitive searches, it is only used for haystacks
+      consisting of ASCII characters. */
+  std::unique_ptr<byte_matcher_t> byte_matcher_;
 
   /** Space to store the case-folded representation of a single character. Allocation is handled by
       the unistring library, hence we can not use string or vector. */
@@ -91,6 +104,10 @@ class T3_WIDGET_LOCAL plain_finder_t : public finder_base_t {
       @param match_end The position of the end of the match in @p str.
   */
   bool check_boundaries(const std::string &str, text_pos_t match_start, text_pos_t match_end);
+  /** Implementation of match using byte_matcher_, for the part of @p haystack from @p start up to
+      @p end. */
+  bool match_bytes(const std::string &haystack, text_pos_t start, text_pos_t end,
+                   find_result_t *result, bool reverse);
 };
 
 /** Implementation of the finder_t interface for regular expression based searches. */
@@ -134,6 +151,8 @@ class T3_WIDGET_LOCAL regex_finder_t : public finder_base_t {
 //================================= finder_t implementation ========================================
 finder_t::~finder_t() {}
 
+std::unique_ptr<finder_t> finder_t::clone() const { return nullptr; }
+
 std::unique_ptr<finder_t> finder_t::create(const std::string &needle, int flags,
                                            std::string *error_message,
                                            const std::string *replacement) {
@@ -146,10 +165,17 @@ std::unique_ptr<finder_t> finder_t::create(const std::string &needle, int flags,
   if (!result->set_needle(needle, error_message)) {
     return nullptr;
   }
+  result->needle_ = needle;
   // Using std::move here because some older C++11 compilers didn't correctly treat this as a move.
   return std::move(result);
 }
 
+std::unique_ptr<finder_t> finder_base_t::clone() const {
+  std::string error_message;
+  return create(needle_, flags_ & ~(find_flags_t::VALID | find_flags_t::REPLACEMENT_VALID),
+                &error_message, replacement_.get());
+}
+
 //================================= plain_finder_t implementation ==================================
 plain_finder_t::plain_finder_t(int flags, const std::string *replacement)
     : finder_base_t(flags, replacement), folded_size_(0) {}
@@ -172,8 +198,19 @@ bool plain_finder_t::set_needle(const std::string &needle, std::string *error_me
         u8_casefold(reinterpret_cast<const uint8_t *>(search_for.data()), search_for.size(),
                     nullptr, nullptr, nullptr, &folded_needle_size)));
     matcher.reset(new string_matcher_t(string_view(folded_needle.get(), folded_needle_size)));
+    if (folded_needle_size > 0 &&
+        byte_matcher_t::is_ascii(string_view(folded_needle.get(), folded_needle_size))) {
+      byte_matcher_.reset(
+          new byte_matcher_t(string_view(folded_needle.get(), folded_needle_size), true));
+    }
   } else {
     matcher.reset(new string_matcher_t(search_for));
+    /* Comparing bytes only finds matches starting at character boundaries if the needle is valid
+       UTF-8. */
+    if (!search_for.empty() &&
+        utf8_valid_prefix(search_for.data(), search_for.size()) == search_for.size()) {
+      byte_matcher_.reset(new byte_matcher_t(search_for, false));
+    }
   }
 
   if (replacement_ != nullptr) {
@@ -204,6 +241,16 @@ bool plain_finder_t::match(const std::string &haystack, find_result_t *result, b
   text_pos_t end = result->end.pos < 0 || static_cast<size_t>(result->end.pos) > haystack.size()
                        ? static_cast<text_pos_t>(haystack.size())
                        : result->end.pos;
+
+  /* Case-insensitive matching of non-ASCII text requires full Unicode case folding, as some
+     non-ASCII characters fold to ASCII characters. */
+  if (byte_matcher_ != nullptr &&
+      (!(flags_ & find_flags_t::ICASE) ||
+       byte_matcher_t::is_ascii(
+           string_view(haystack).substr(start, std::max(start, end) - start)))) {
+    return match_bytes(haystack, start, end, result, reverse);
+  }
+
   if (reverse) {
     std::swap(start, end);
   }
@@ -279,6 +326,32 @@ bool plain_finder_t::match(const std::string &haystack, find_result_t *result, b
   }
 }
 
+bool plain_finder_t::match_bytes(const std::string &haystack, text_pos_t start, text_pos_t end,
+                                 find_result_t *result, bool reverse) {
+  const text_pos_t needle_size = byte_matcher_->size();
+  while (start <= end) {
+    string_view range = string_view(haystack).substr(start, end - start);
+    text_pos_t match_start = reverse ? byte_matcher_->rfind(range) : byte_matcher_->find(range);
+    if (match_start < 0) {
+      return false;
+    }
+    match_start += start;
+    if (!(flags_ & find_flags_t::WHOLE_WORD) ||
+        check_boundaries(haystack, match_start, match_start + needle_size)) {
+      result->start.pos = match_start;
+      result->end.pos = match_start + needle_size;
+      return true;
+    }
+    // Continue with the matches overlapping this one, like the automaton does.
+    if (reverse) {
+      end = match_start + needle_size - 1;
+    } else {
+      start = match_start + 1;
+    }
+  }
+  return false;
+}
+
 static inline int is_start_char(int c) { return (c & 0xc0) != 0x80; }
 
 text_pos_t plain_finder_t::adjust_position(const std::string &str, text_pos_t pos, int adjust) {
@@ -426,27 +499,16 @@ bool regex_finder_t::match(const std::string &haystack, find_result_t *result, b
       pcre_flags |= PCRE2_NOTBOL;
     }
   } else {
-    while (!found_ && start <= end) {
+    /* Only an empty match is excluded at the start point. Other matches starting there, such as
+       one directly following the previous match, must still be found. */
+    if (may_not_match_start) {
+      pcre_flags |= PCRE2_NOTEMPTY_ATSTART;
+    }
+    if (start <= end) {
       match_result = pcre2_match_8(regex_.get(), reinterpret_cast<PCRE2_SPTR8>(haystack.data()),
                                    end, start, pcre_flags, match_data_.get(), nullptr);
       captures_ = match_result;
-      if (match_result < 0) {
-        break;
-      }
-      if (may_not_match_start) {
-        may_not_match_start = false;
-        found_ = pcre2_get_ovector_pointer_8(match_data_.get())[0] != start;
-        if (!found_) {
-          PCRE2_SIZE new_start = text_line_t::adjust_position(haystack, start, 1);
-          if (new_start == start) {
-            break;
-          }
-          start = new_start;
-        }
-      } else {
-        found_ = true;
-      }
-      pcre_flags |= PCRE2_NOTBOL;
+      found_ = match_result >= 0;
     }
   }
   if (!found_) {
@@ -50,6 +50,13 @@ class T3_WIDGET_API finder_t {
   virtual int get_flags() const = 0;
   /** Retrieve the replacement string. */
   virtual std::string get_replacement(const std::string &haystack) const = 0;
+  /** Create a new finder_t for the same search and replacement.
+
+      A finder_t keeps state between calls to match, so it must not be used by multiple threads at
+      the same time. A clone can be used to search in another thread. The default implementation
+      returns @c nullptr, which makes text_buffer_t::find_all and text_buffer_t::find_next search
+      in the calling thread with the finder_t itself. */
+  virtual std::unique_ptr<finder_t> clone() const;
 
   /** Creates a finder_t (or rather a subclass) with the given parameters.
       @param needle The string to search for.
@@ -0,0 +1,104 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+
+#include "t3widget/iovecwriter.h"
+
+namespace t3widget {
+
+/* Maximum number of entries in a single writev call. IOV_MAX is at least 16 according to POSIX,
+   but is 1024 on most systems. */
+#ifdef IOV_MAX
+#define MAX_BATCH_ENTRIES std::min(IOV_MAX, 1024)
+#else
+#define MAX_BATCH_ENTRIES 16
+#endif
+/* Number of bytes after which a batch is written, even if not all entries are used. This limits the
+   amount of memory that needs to be paged in from a mapped file per call. */
+#define MAX_BATCH_BYTES (4 * 1024 * 1024)
+
+iovec_writer_t::iovec_writer_t(int fd)
+    : fd_(fd), batch_size_(0), bytes_written_(0) {
+  iov_.reserve(MAX_BATCH_ENTRIES);
+}
+
+int iovec_writer_t::add(const char *data, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  if (!iov_.empty() &&
+      static_cast<const char *>(iov_.back().iov_base) + iov_.back().iov_len == data) {
+    iov_.back().iov_len += size;
+  } else {
+    if (iov_.size() == static_cast<size_t>(MAX_BATCH_ENTRIES)) {
+      int result = flush();
+      if (result != 0) {
+        return result;
+      }
+    }
+    struct iovec entry;
+    entry.iov_base = const_cast<char *>(data);
+    entry.iov_len = size;
+    iov_.push_back(entry);
+  }
+  batch_size_ += size;
+  return batch_size_ >= MAX_BATCH_BYTES ? flush() : 0;
+}
+
+int iovec_writer_t::add_copy(const char *data, size_t size) {
+  // Make sure add does not write the batch before adding the copy, as that would free it.
+  if (iov_.size() == static_cast<size_t>(MAX_BATCH_ENTRIES)) {
+    int result = flush();
+    if (result != 0) {
+      return result;
+    }
+  }
+  copies_.emplace_back(data, size);
+  return add(copies_.back().data(), size);
+}
+
+int iovec_writer_t::flush() {
+  struct iovec *next = iov_.data();
+  struct iovec *end = next + iov_.size();
+
+  while (next < end) {
+    ssize_t result = writev(fd_, next, std::min<ptrdiff_t>(end - next, MAX_BATCH_ENTRIES));
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    bytes_written_ += result;
+    // Skip the entries that have been written completely, and adjust a partially written entry.
+    size_t written = result;
+    while (next < end && written >= next->iov_len) {
+      written -= next->iov_len;
+      ++next;
+    }
+    if (written > 0) {
+      next->iov_base = static_cast<char *>(next->iov_base) + written;
+      next->iov_len -= written;
+    }
+  }
+  iov_.clear();
+  copies_.clear();
+  batch_size_ = 0;
+  return 0;
+}
+
+}  // namespace t3widget
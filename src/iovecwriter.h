@@ -0,0 +1,67 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_IOVECWRITER_H
+#define T3_WIDGET_IOVECWRITER_H
+
+#ifndef _T3_WIDGET_INTERNAL
+#error This header file is for internal use _only_!!
+#endif
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <sys/uio.h>
+#include <t3widget/widget_api.h>
+#include <vector>
+
+namespace t3widget {
+
+/** Writes a sequence of byte ranges to a file descriptor, without copying them.
+
+    The ranges are collected in a batch of @c iovec structures, which is written with a single
+    @c writev call once it is full. Ranges which directly follow the previous range in memory are
+    merged, such that consecutive lines from a mapped file take up a single entry. Because the data
+    is not copied, all ranges passed to add must remain valid until the next call to flush.
+*/
+class T3_WIDGET_LOCAL iovec_writer_t {
+ public:
+  explicit iovec_writer_t(int fd);
+
+  /** Add a range of bytes to the batch, writing the batch if it is full.
+      @return 0 on success, or an @c errno value if writing failed.
+  */
+  int add(const char *data, size_t size);
+  /** Add a copy of a range of bytes to the batch, for data that does not remain valid.
+      @return 0 on success, or an @c errno value if writing failed.
+  */
+  int add_copy(const char *data, size_t size);
+  /** Write all ranges collected so far.
+      @return 0 on success, or an @c errno value if writing failed.
+  */
+  int flush();
+  /** Returns the total number of bytes written to the file descriptor. */
+  size_t bytes_written() const { return bytes_written_; }
+
+ private:
+  int fd_;
+  std::vector<struct iovec> iov_;
+  // Copies made by add_copy for the current batch.
+  std::deque<std::string> copies_;
+  size_t batch_size_;
+  size_t bytes_written_;
+};
+
+}  // namespace t3widget
+
+#endif
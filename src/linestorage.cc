@@ -0,0 +1,539 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <utility>
+
+#include "t3widget/compress.h"
+#include "t3widget/internal.h"
+#include "t3widget/linestorage.h"
+#include "t3widget/utf8validate.h"
+
+namespace t3widget {
+
+/* Maximum number of lines in a single chunk for text_storage_t::ROPE. Once a chunk grows beyond
+   this size, it is split in half. */
+#define ROPE_CHUNK_LINES 1024
+
+const size_t line_storage_t::NO_SOURCE;
+
+line_storage_t::line_storage_t(text_storage_t type)
+    : root_(nullptr),
+      max_chunk_lines_(type == text_storage_t::ROPE ? ROPE_CHUNK_LINES
+                                                    : std::numeric_limits<size_t>::max()),
+      random_state_(0x9e3779b9),
+      factory_(nullptr),
+      cached_chunk_(nullptr),
+      cached_start_(0),
+      cached_owned_(false),
+      use_clock_(0) {}
+
+line_storage_t::line_storage_t(const line_storage_t &other)
+    : root_(other.root_),
+      max_chunk_lines_(other.max_chunk_lines_),
+      random_state_(other.random_state_),
+      source_(other.source_),
+      factory_(other.factory_),
+      cached_chunk_(nullptr),
+      cached_start_(0),
+      cached_owned_(false),
+      use_clock_(0) {
+  if (root_ != nullptr) {
+    ++root_->refs;
+  }
+  other.cached_owned_ = false;
+  // Make sure that reading the shared lines does not modify them.
+  other.gaps_.close_gaps();
+}
+
+line_storage_t::~line_storage_t() { release(root_); }
+
+void line_storage_t::release(chunk_t *chunk) {
+  while (chunk != nullptr && --chunk->refs == 0) {
+    release(chunk->left);
+    for (std::unique_ptr<text_line_t> &line : chunk->lines) {
+      release_line(&line);
+    }
+    chunk_t *next = chunk->right;
+    delete chunk;
+    chunk = next;
+  }
+}
+
+void line_storage_t::release_line(std::unique_ptr<text_line_t> *line) {
+  if (*line == nullptr) {
+    return;
+  }
+  if ((*line)->remove_share()) {
+    line->reset();
+  } else {
+    // Still referenced by another chunk, which is now responsible for deleting it.
+    line->release();
+  }
+}
+
+line_storage_t::chunk_t *line_storage_t::own(chunk_t *chunk) {
+  if (chunk->refs == 1) {
+    return chunk;
+  }
+
+  /* The copy refers to the same lines and child chunks as the original. These are copied in turn
+     when they are modified. */
+  chunk_t *copy = new chunk_t;
+  copy->lines.reserve(chunk->lines.size());
+  for (const std::unique_ptr<text_line_t> &line : chunk->lines) {
+    if (line != nullptr) {
+      line->add_share();
+    }
+    copy->lines.emplace_back(line.get());
+  }
+  copy->sources = chunk->sources;
+  copy->total = chunk->total;
+  copy->priority = chunk->priority;
+  copy->refs = 1;
+  copy->left = chunk->left;
+  copy->right = chunk->right;
+  copy->packed = chunk->packed;
+  copy->last_used = chunk->last_used;
+  if (copy->left != nullptr) {
+    ++copy->left->refs;
+  }
+  if (copy->right != nullptr) {
+    ++copy->right->refs;
+  }
+  --chunk->refs;
+  cached_chunk_ = nullptr;
+  return copy;
+}
+
+line_storage_t::chunk_t *line_storage_t::new_chunk() {
+  chunk_t *chunk = new chunk_t;
+  // xorshift32 is more than good enough to keep the treap balanced.
+  random_state_ ^= random_state_ << 13;
+  random_state_ ^= random_state_ >> 17;
+  random_state_ ^= random_state_ << 5;
+  chunk->priority = random_state_;
+  chunk->total = 0;
+  chunk->refs = 1;
+  chunk->last_used = use_clock_;
+  chunk->left = nullptr;
+  chunk->right = nullptr;
+  return chunk;
+}
+
+void line_storage_t::split(chunk_t *chunk, size_t count, chunk_t **left, chunk_t **right) {
+  // Note: count must be on a chunk boundary.
+  if (chunk == nullptr) {
+    *left = *right = nullptr;
+    return;
+  }
+  chunk = own(chunk);
+  size_t left_total = total(chunk->left);
+  if (count <= left_total) {
+    split(chunk->left, count, left, &chunk->left);
+    *right = chunk;
+  } else {
+    split(chunk->right, count - left_total - chunk->lines.size(), &chunk->right, right);
+    *left = chunk;
+  }
+  update_total(chunk);
+}
+
+line_storage_t::chunk_t *line_storage_t::merge(chunk_t *left, chunk_t *right) {
+  if (left == nullptr) {
+    return right;
+  }
+  if (right == nullptr) {
+    return left;
+  }
+  if (left->priority > right->priority) {
+    left = own(left);
+    left->right = merge(left->right, right);
+    update_total(left);
+    return left;
+  }
+  right = own(right);
+  right->left = merge(left, right->left);
+  update_total(right);
+  return right;
+}
+
+void line_storage_t::locate(size_t idx) const {
+  chunk_t *chunk = root_;
+  size_t start = 0;
+
+  ASSERT(idx < size());
+  while (true) {
+    size_t left_total = total(chunk->left);
+    if (idx < left_total) {
+      chunk = chunk->left;
+      continue;
+    }
+    idx -= left_total;
+    start += left_total;
+    if (idx < chunk->lines.size()) {
+      break;
+    }
+    idx -= chunk->lines.size();
+    start += chunk->lines.size();
+    chunk = chunk->right;
+  }
+  cached_chunk_ = chunk;
+  cached_start_ = start;
+  cached_owned_ = false;
+}
+
+line_storage_t::chunk_t **line_storage_t::find_slot(size_t idx, bool for_insert,
+                                                    std::ptrdiff_t delta, size_t *chunk_start) {
+  chunk_t **slot = &root_;
+  size_t start = 0;
+
+  while (true) {
+    chunk_t *chunk = *slot = own(*slot);
+    chunk->total += delta;
+    size_t left_total = total(chunk->left);
+    if (idx < left_total) {
+      slot = &chunk->left;
+      continue;
+    }
+    idx -= left_total;
+    start += left_total;
+    if (idx < chunk->lines.size() || (for_insert && idx == chunk->lines.size())) {
+      *chunk_start = start;
+      return slot;
+    }
+    idx -= chunk->lines.size();
+    start += chunk->lines.size();
+    slot = &chunk->right;
+  }
+}
+
+void line_storage_t::insert(size_t idx, std::unique_ptr<text_line_t> line) {
+  cached_chunk_ = nullptr;
+  if (root_ == nullptr) {
+    root_ = new_chunk();
+  }
+
+  size_t chunk_start;
+  chunk_t *chunk = *find_slot(idx, true, 1, &chunk_start);
+  unpack(chunk);
+  line->set_gap_list(&gaps_);
+  chunk->lines.insert(chunk->lines.begin() + (idx - chunk_start), std::move(line));
+  if (!chunk->sources.empty()) {
+    chunk->sources.insert(chunk->sources.begin() + (idx - chunk_start), NO_SOURCE);
+  }
+
+  if (chunk->lines.size() > max_chunk_lines_) {
+    split_chunk(chunk, chunk_start);
+  }
+}
+
+void line_storage_t::insert_lazy(size_t idx, const size_t *offsets, size_t count) {
+  cached_chunk_ = nullptr;
+  if (root_ == nullptr) {
+    root_ = new_chunk();
+  }
+
+  while (count > 0) {
+    size_t chunk_start;
+    chunk_t *chunk = *find_slot(idx, true, 0, &chunk_start);
+    unpack(chunk);
+    if (chunk->lines.size() >= max_chunk_lines_) {
+      split_chunk(chunk, chunk_start);
+      continue;
+    }
+
+    size_t to_insert = std::min(count, max_chunk_lines_ - chunk->lines.size());
+    find_slot(idx, true, to_insert, &chunk_start);
+    size_t offset = idx - chunk_start;
+    if (chunk->sources.empty()) {
+      chunk->sources.resize(chunk->lines.size(), NO_SOURCE);
+    }
+    std::vector<std::unique_ptr<text_line_t>> placeholders(to_insert);
+    chunk->lines.insert(chunk->lines.begin() + offset,
+                        std::make_move_iterator(placeholders.begin()),
+                        std::make_move_iterator(placeholders.end()));
+    chunk->sources.insert(chunk->sources.begin() + offset, offsets, offsets + to_insert);
+    idx += to_insert;
+    offsets += to_insert;
+    count -= to_insert;
+  }
+}
+
+void line_storage_t::split_chunk(chunk_t *chunk, size_t chunk_start) {
+  /* Split the chunk in two halves. The upper half is moved to a new chunk, which is then inserted
+     into the tree directly after the existing chunk. */
+  size_t half = chunk->lines.size() / 2;
+  chunk_t *upper = new_chunk();
+  upper->lines.reserve(max_chunk_lines_);
+  std::move(chunk->lines.begin() + half, chunk->lines.end(), std::back_inserter(upper->lines));
+  chunk->lines.resize(half);
+  if (!chunk->sources.empty()) {
+    upper->sources.assign(chunk->sources.begin() + half, chunk->sources.end());
+    chunk->sources.resize(half);
+  }
+  upper->total = upper->lines.size();
+  find_slot(chunk_start, false, -static_cast<std::ptrdiff_t>(upper->total), &chunk_start);
+
+  chunk_t *left, *right;
+  split(root_, chunk_start + half, &left, &right);
+  root_ = merge(merge(left, upper), right);
+}
+
+void line_storage_t::erase(size_t first, size_t last) {
+  ASSERT(first <= last && last <= size());
+  cached_chunk_ = nullptr;
+
+  size_t count = last - first;
+  while (count > 0) {
+    locate(first);
+    size_t offset = first - cached_start_;
+    size_t to_remove = std::min(count, cached_chunk_->lines.size() - offset);
+
+    size_t chunk_start;
+    chunk_t **slot = find_slot(first, false, -static_cast<std::ptrdiff_t>(to_remove), &chunk_start);
+    chunk_t *chunk = *slot;
+    unpack(chunk);
+    for (size_t i = offset; i < offset + to_remove; ++i) {
+      release_line(&chunk->lines[i]);
+    }
+    chunk->lines.erase(chunk->lines.begin() + offset, chunk->lines.begin() + offset + to_remove);
+    if (!chunk->sources.empty()) {
+      chunk->sources.erase(chunk->sources.begin() + offset,
+                           chunk->sources.begin() + offset + to_remove);
+    }
+    count -= to_remove;
+
+    if (chunk->lines.empty()) {
+      *slot = merge(chunk->left, chunk->right);
+      delete chunk;
+    }
+  }
+  cached_chunk_ = nullptr;
+}
+
+void line_storage_t::set_source(std::shared_ptr<const mapped_file_t> source,
+                                text_line_factory_t *factory) {
+  source_ = std::move(source);
+  factory_ = factory;
+}
+
+string_view line_storage_t::get_text(size_t idx, std::string *scratch) const {
+  chunk_t *chunk = lookup(idx);
+  size_t offset = idx - cached_start_;
+  if (chunk->lines[offset] != nullptr) {
+    return chunk->lines[offset]->get_text();
+  }
+  if (chunk->sources.empty() || chunk->sources[offset] == NO_SOURCE) {
+    return packed_text(chunk, offset);
+  }
+
+  string_view text = source_->line_at(chunk->sources[offset]);
+  if (utf8_valid_prefix(text.data(), text.size()) == text.size()) {
+    return text;
+  }
+  /* Convert the line the same way materializing it would, but without using factory_, as that need
+     not be safe to use from other threads. */
+  text_line_t line(text);
+  *scratch = line.get_data();
+  return *scratch;
+}
+
+std::unique_ptr<text_line_t> &line_storage_t::mutable_entry(size_t idx) {
+  if (cached_chunk_ == nullptr || !cached_owned_ ||
+      idx - cached_start_ >= cached_chunk_->lines.size()) {
+    ASSERT(idx < size());
+    size_t chunk_start;
+    chunk_t *chunk = *find_slot(idx, false, 0, &chunk_start);
+    cached_chunk_ = chunk;
+    cached_start_ = chunk_start;
+    cached_owned_ = true;
+  }
+
+  size_t offset = idx - cached_start_;
+  cached_chunk_->last_used = ++use_clock_;
+  unpack(cached_chunk_);
+  std::unique_ptr<text_line_t> &line = cached_chunk_->lines[offset];
+  if (line == nullptr) {
+    if (!cached_chunk_->sources.empty() && cached_chunk_->sources[offset] != NO_SOURCE) {
+      materialize(cached_chunk_, offset);
+    }
+  } else if (line->is_shared()) {
+    std::unique_ptr<text_line_t> copy = line->clone(0, -1);
+    release_line(&line);
+    line = std::move(copy);
+  }
+  if (line != nullptr) {
+    line->set_gap_list(&gaps_);
+  }
+  return line;
+}
+
+void line_storage_t::materialize_all() {
+  size_t idx = 0;
+  while (idx < size()) {
+    const chunk_t *chunk = lookup(idx);
+    size_t chunk_start = cached_start_;
+    size_t chunk_size = chunk->lines.size();
+    for (size_t i = 0; i < chunk->sources.size(); ++i) {
+      if (chunk->sources[i] != NO_SOURCE) {
+        // This copies the chunk if it is shared, after which the copy must be used.
+        mutable_entry(chunk_start + i);
+        chunk = cached_chunk_;
+      }
+    }
+    idx = chunk_start + chunk_size;
+  }
+  source_.reset();
+}
+
+void line_storage_t::materialize(chunk_t *chunk, size_t offset) {
+  chunk->lines[offset] = factory_->new_text_line_t(source_->line_at(chunk->sources[offset]));
+  chunk->sources[offset] = NO_SOURCE;
+}
+
+/* Compressed chunks store the lines as a sequence of line lengths in LEB128 format, each followed
+   by the contents of the line. */
+static void append_length(size_t length, std::string *result) {
+  while (length >= 0x80) {
+    result->push_back(static_cast<char>((length & 0x7f) | 0x80));
+    length >>= 7;
+  }
+  result->push_back(static_cast<char>(length));
+}
+
+static size_t read_length(const char **ptr) {
+  size_t length = 0;
+  int shift = 0;
+  unsigned char byte;
+  do {
+    byte = static_cast<unsigned char>(*(*ptr)++);
+    length |= static_cast<size_t>(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return length;
+}
+
+void line_storage_t::pack(chunk_t *chunk) {
+  std::string text;
+  for (const std::unique_ptr<text_line_t> &line : chunk->lines) {
+    if (line != nullptr) {
+      string_view data = line->get_text();
+      append_length(data.size(), &text);
+      text.append(data.data(), data.size());
+    }
+  }
+
+  std::shared_ptr<packed_lines_t> packed = std::make_shared<packed_lines_t>();
+  compress_block(text, &packed->data);
+  packed->data.shrink_to_fit();
+  packed->size = text.size();
+  chunk->packed = std::move(packed);
+  for (std::unique_ptr<text_line_t> &line : chunk->lines) {
+    release_line(&line);
+  }
+}
+
+void line_storage_t::unpack(chunk_t *chunk) {
+  if (chunk->packed == nullptr) {
+    return;
+  }
+
+  std::string text;
+  bool valid = decompress_block(chunk->packed->data, chunk->packed->size, &text);
+  ASSERT(valid);
+  (void)valid;
+  const char *ptr = text.data();
+  for (size_t i = 0; i < chunk->lines.size(); ++i) {
+    if (chunk->lines[i] == nullptr && (chunk->sources.empty() || chunk->sources[i] == NO_SOURCE)) {
+      size_t length = read_length(&ptr);
+      chunk->lines[i] = factory_->new_text_line_t(string_view(ptr, length));
+      ptr += length;
+    }
+  }
+  chunk->packed.reset();
+}
+
+string_view line_storage_t::packed_text(const chunk_t *chunk, size_t offset) const {
+  if (unpacked_block_ != chunk->packed) {
+    unpacked_block_ = nullptr;
+    bool valid = decompress_block(chunk->packed->data, chunk->packed->size, &unpacked_text_);
+    ASSERT(valid);
+    (void)valid;
+    const char *ptr = unpacked_text_.data();
+    unpacked_lines_.assign(chunk->lines.size(), string_view());
+    for (size_t i = 0; i < chunk->lines.size(); ++i) {
+      if (chunk->lines[i] == nullptr &&
+          (chunk->sources.empty() || chunk->sources[i] == NO_SOURCE)) {
+        size_t length = read_length(&ptr);
+        unpacked_lines_[i] = string_view(ptr, length);
+        ptr += length;
+      }
+    }
+    unpacked_block_ = chunk->packed;
+  }
+  return unpacked_lines_[offset];
+}
+
+void line_storage_t::compress_inactive(size_t max_active_lines, text_line_factory_t *factory) {
+  if (max_chunk_lines_ == std::numeric_limits<size_t>::max()) {
+    return;
+  }
+  factory_ = factory;
+
+  /* Collect the chunks that can be compressed. A chunk with multiple references is shared with a
+     copy, as are all the chunks below it. */
+  std::vector<chunk_t *> candidates;
+  std::vector<chunk_t *> todo;
+  if (root_ != nullptr) {
+    todo.push_back(root_);
+  }
+  while (!todo.empty()) {
+    chunk_t *chunk = todo.back();
+    todo.pop_back();
+    if (chunk->refs > 1) {
+      continue;
+    }
+    if (chunk->packed == nullptr) {
+      candidates.push_back(chunk);
+    }
+    if (chunk->left != nullptr) {
+      todo.push_back(chunk->left);
+    }
+    if (chunk->right != nullptr) {
+      todo.push_back(chunk->right);
+    }
+  }
+
+  std::sort(candidates.begin(), candidates.end(), [](const chunk_t *a, const chunk_t *b) {
+    return a->last_used > b->last_used;
+  });
+  size_t active_lines = 0;
+  for (chunk_t *chunk : candidates) {
+    size_t materialized = std::count_if(
+        chunk->lines.begin(), chunk->lines.end(),
+        [](const std::unique_ptr<text_line_t> &line) { return line != nullptr; });
+    if (materialized == 0) {
+      continue;
+    }
+    if (active_lines < max_active_lines) {
+      active_lines += materialized;
+      continue;
+    }
+    pack(chunk);
+  }
+}
+
+}  // namespace t3widget
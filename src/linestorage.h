@@ -0,0 +1,198 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_LINESTORAGE_H
+#define T3_WIDGET_LINESTORAGE_H
+
+#ifndef _T3_WIDGET_INTERNAL
+#error This header file is for internal use _only_!!
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <t3widget/mappedfile.h>
+#include <t3widget/string_view.h>
+#include <t3widget/textline.h>
+#include <t3widget/util.h>
+#include <t3widget/widget_api.h>
+#include <vector>
+
+namespace t3widget {
+
+/** Container for the lines of a text_buffer_t.
+
+    The lines are stored in chunks, which are kept in an implicit treap ordered by position and
+    augmented with the number of lines in each sub-tree. This makes inserting and deleting lines
+    O(log n) in the number of chunks plus O(chunk size) for moving the pointers within a single
+    chunk. For text_storage_t::VECTOR the chunk size is unbounded, which degenerates into a single
+    std::vector holding all the lines.
+
+    The interface mimics the subset of std::vector that text_buffer_t needs, except that positions
+    are passed as indices rather than as iterators. The last looked up chunk is cached, such that
+    sequential access does not need to walk the tree for every line.
+
+    Lines can also be inserted lazily, as an offset into a mapped_file_t. Such a line is only
+    turned into a text_line_t when it is first accessed. Similarly, compress_inactive replaces the
+    lines in chunks which have not been accessed recently by a compressed block of text, which is
+    converted back to text_line_t's when any line in the chunk is accessed.
+
+    A copy of a line_storage_t shares all chunks and lines with the original. Chunks and lines are
+    copied only when they are modified, which is when they are accessed through the non-const
+    operator[] or when lines are inserted or removed. For text_storage_t::VECTOR, this means that
+    the first modification copies the pointers to all lines, while for text_storage_t::ROPE only
+    the chunks on the path to the modified line are copied. A copy can be read from another
+    thread, as long as only size and get_text are used, and only by that thread. Copies must be
+    created and destroyed in the thread that modifies the original.
+*/
+class T3_WIDGET_LOCAL line_storage_t {
+ public:
+  explicit line_storage_t(text_storage_t type);
+  line_storage_t(const line_storage_t &other);
+  line_storage_t &operator=(const line_storage_t &other) = delete;
+  ~line_storage_t();
+
+  size_t size() const { return root_ == nullptr ? 0 : root_->total; }
+
+  std::unique_ptr<text_line_t> &operator[](size_t idx) { return mutable_entry(idx); }
+  const std::unique_ptr<text_line_t> &operator[](size_t idx) const { return entry(idx); }
+
+  void push_back(std::unique_ptr<text_line_t> line) { insert(size(), std::move(line)); }
+  /** Insert @p line such that it will be at index @p idx. */
+  void insert(size_t idx, std::unique_ptr<text_line_t> line);
+  /** Remove the lines in the range [@p first, @p last). */
+  void erase(size_t first, size_t last);
+
+  /** Set the file from which lazily inserted lines are materialized, using @p factory. */
+  void set_source(std::shared_ptr<const mapped_file_t> source, text_line_factory_t *factory);
+  /** Insert @p count lines which start at @p offsets in the source file, at index @p idx. */
+  void insert_lazy(size_t idx, const size_t *offsets, size_t count);
+  /** Get the text of line @p idx, without materializing it.
+      @param idx The index of the line.
+      @param scratch A string that may be used to store the text, if it can not be returned
+          directly. This is the case for lazy lines with invalid UTF-8, which is replaced.
+
+      For lazy lines the text is returned directly from the source file, in which case the text is
+      followed by a newline if it ends before the end of the source file.
+  */
+  string_view get_text(size_t idx, std::string *scratch) const;
+  /** Returns the source file set with set_source, or @c nullptr if no lines refer to it. */
+  const mapped_file_t *source() const { return source_.get(); }
+  /** Materialize all lazy lines, after which the source file is no longer used. */
+  void materialize_all();
+  /** Compress the lines of the least recently used chunks.
+      @param max_active_lines The number of converted lines to keep, in the most recently used
+          chunks. Lines in other chunks are compressed.
+      @param factory The factory to use for converting the compressed lines back.
+
+      This only has an effect for text_storage_t::ROPE. Chunks shared with a copy are not
+      compressed. Note that this invalidates the pointers to the compressed lines.
+  */
+  void compress_inactive(size_t max_active_lines, text_line_factory_t *factory);
+
+ private:
+  struct packed_lines_t {
+    // The lengths and contents of the lines, compressed by compress_block.
+    std::string data;
+    // The size of data when decompressed.
+    size_t size;
+  };
+  struct chunk_t {
+    std::vector<std::unique_ptr<text_line_t>> lines;
+    /* Offsets in the source file for lines which have not been materialized yet, or NO_SOURCE.
+       This is empty if the chunk does not contain any lazy lines. */
+    std::vector<size_t> sources;
+    /* Number of lines in the sub-tree rooted at this chunk. */
+    size_t total;
+    uint32_t priority;
+    /* Number of references to this chunk, from parent chunks or the root of a line_storage_t. A
+       chunk with more than one reference is shared, and must be copied before it is modified. */
+    uint32_t refs;
+    chunk_t *left;
+    chunk_t *right;
+    /* The text of the lines which are neither materialized nor lazy, if the chunk is compressed.
+       The block is immutable, and shared with copies of the chunk. */
+    std::shared_ptr<const packed_lines_t> packed;
+    // Value of use_clock_ when a line in this chunk was last accessed.
+    uint64_t last_used;
+  };
+
+  static size_t total(const chunk_t *chunk) { return chunk == nullptr ? 0 : chunk->total; }
+  static void update_total(chunk_t *chunk) {
+    chunk->total = total(chunk->left) + chunk->lines.size() + total(chunk->right);
+  }
+  static void release(chunk_t *chunk);
+  static void release_line(std::unique_ptr<text_line_t> *line);
+  // Returns a chunk that can be modified, which is a copy of chunk if it is shared.
+  chunk_t *own(chunk_t *chunk);
+  void split(chunk_t *chunk, size_t count, chunk_t **left, chunk_t **right);
+  chunk_t *merge(chunk_t *left, chunk_t *right);
+
+  static const size_t NO_SOURCE = static_cast<size_t>(-1);
+
+  const std::unique_ptr<text_line_t> &entry(size_t idx) const {
+    chunk_t *chunk = lookup(idx);
+    size_t offset = idx - cached_start_;
+    if (chunk->lines[offset] == nullptr) {
+      /* The line is lazy or compressed. Converting it changes the chunk, which may need to be
+         copied first. */
+      return const_cast<line_storage_t *>(this)->mutable_entry(idx);
+    }
+    chunk->last_used = ++use_clock_;
+    return chunk->lines[offset];
+  }
+  std::unique_ptr<text_line_t> &mutable_entry(size_t idx);
+  void materialize(chunk_t *chunk, size_t offset);
+  void pack(chunk_t *chunk);
+  void unpack(chunk_t *chunk);
+  string_view packed_text(const chunk_t *chunk, size_t offset) const;
+
+  chunk_t *lookup(size_t idx) const {
+    if (cached_chunk_ == nullptr || idx - cached_start_ >= cached_chunk_->lines.size()) {
+      locate(idx);
+    }
+    return cached_chunk_;
+  }
+  void locate(size_t idx) const;
+  /* Find the slot holding the chunk in which index @p idx is located, adding @p delta to the line
+     totals of all chunks on the path. If @p for_insert is true, an index just beyond the end of a
+     chunk selects that chunk. */
+  chunk_t **find_slot(size_t idx, bool for_insert, std::ptrdiff_t delta, size_t *chunk_start);
+  chunk_t *new_chunk();
+  void split_chunk(chunk_t *chunk, size_t chunk_start);
+
+  chunk_t *root_;
+  size_t max_chunk_lines_;
+  uint32_t random_state_;
+  std::shared_ptr<const mapped_file_t> source_;
+  text_line_factory_t *factory_;
+
+  mutable chunk_t *cached_chunk_;
+  mutable size_t cached_start_;
+  // Whether cached_chunk_ and all chunks above it are not shared.
+  mutable bool cached_owned_;
+  mutable uint64_t use_clock_;
+  /* The lines handed out for modification which have an open gap. These are closed when a copy is
+     made, which only requires visiting the lines that were edited since the previous copy. */
+  mutable text_line_t::gap_list_t gaps_;
+
+  // The most recently decompressed block, for get_text.
+  mutable std::shared_ptr<const packed_lines_t> unpacked_block_;
+  mutable std::string unpacked_text_;
+  mutable std::vector<string_view> unpacked_lines_;
+};
+
+}  // namespace t3widget
+
+#endif
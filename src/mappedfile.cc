@@ -0,0 +1,133 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utility>
+
+#include "t3widget/key.h"
+#include "t3widget/mappedfile.h"
+
+namespace t3widget {
+
+/* The first batch of offsets is kept small, to allow the first screen to be shown quickly. Each
+   following batch doubles in size, up to the maximum. */
+#define INITIAL_INDEX_BATCH (64 * 1024)
+#define MAX_INDEX_BATCH (16 * 1024 * 1024)
+
+std::shared_ptr<mapped_file_t> mapped_file_t::open(int fd, int *error) {
+  struct stat file_info;
+
+  if (fstat(fd, &file_info) < 0) {
+    *error = errno;
+    return nullptr;
+  }
+  if (!S_ISREG(file_info.st_mode)) {
+    *error = EINVAL;
+    return nullptr;
+  }
+
+  // mmap does not allow empty mappings, but an empty file is perfectly valid.
+  if (file_info.st_size == 0) {
+    return std::shared_ptr<mapped_file_t>(new mapped_file_t(nullptr, 0, file_info));
+  }
+
+  size_t size = file_info.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    *error = errno;
+    return nullptr;
+  }
+  return std::shared_ptr<mapped_file_t>(
+      new mapped_file_t(static_cast<const char *>(data), size, file_info));
+}
+
+mapped_file_t::~mapped_file_t() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+}
+
+string_view mapped_file_t::line_at(size_t offset) const {
+  if (offset >= size_) {
+    return string_view();
+  }
+  const char *start = data_ + offset;
+  const char *end = static_cast<const char *>(memchr(start, '\n', size_ - offset));
+  return string_view(start, end == nullptr ? size_ - offset : end - start);
+}
+
+bool mapped_file_t::is_file(const struct stat &info) const {
+  return data_ != nullptr && info.st_dev == device_ && info.st_ino == inode_;
+}
+
+line_indexer_t::line_indexer_t(std::shared_ptr<const mapped_file_t> file)
+    : file_(std::move(file)), bytes_done_(0), done_(false), stop_(false) {
+  thread_ = std::thread(&line_indexer_t::run, this);
+}
+
+line_indexer_t::~line_indexer_t() {
+  stop_ = true;
+  wait();
+}
+
+void line_indexer_t::wait() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool line_indexer_t::take_offsets(std::vector<size_t> *offsets, size_t *bytes_done) {
+  std::lock_guard<std::mutex> guard(lock_);
+  offsets->insert(offsets->end(), pending_.begin(), pending_.end());
+  pending_.clear();
+  *bytes_done = bytes_done_;
+  return done_;
+}
+
+void line_indexer_t::run() {
+  const char *data = file_->data();
+  const size_t size = file_->size();
+  size_t batch_size = INITIAL_INDEX_BATCH;
+  size_t pos = 0;
+  std::vector<size_t> found;
+
+  while (pos < size && !stop_) {
+    const char *end = data + std::min(size, pos + batch_size);
+    const char *ptr = data + pos;
+    const char *newline;
+    while ((newline = static_cast<const char *>(memchr(ptr, '\n', end - ptr))) != nullptr) {
+      ptr = newline + 1;
+      found.push_back(ptr - data);
+    }
+    pos = end - data;
+
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      pending_.insert(pending_.end(), found.begin(), found.end());
+      bytes_done_ = pos;
+    }
+    found.clear();
+    signal_update();
+    batch_size = std::min<size_t>(batch_size * 2, MAX_INDEX_BATCH);
+  }
+
+  std::lock_guard<std::mutex> guard(lock_);
+  done_ = true;
+  signal_update();
+}
+
+}  // namespace t3widget
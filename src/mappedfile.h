@@ -0,0 +1,98 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_MAPPEDFILE_H
+#define T3_WIDGET_MAPPEDFILE_H
+
+#ifndef _T3_WIDGET_INTERNAL
+#error This header file is for internal use _only_!!
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <t3widget/string_view.h>
+#include <t3widget/widget_api.h>
+#include <thread>
+#include <vector>
+
+namespace t3widget {
+
+/** Read-only memory mapping of a file.
+
+    Lines of a text_buffer_t that have not been materialized yet refer to the mapping by offset, so
+    it must be kept alive for as long as such lines exist. Changes made to the file by other
+    processes show up in the mapping. Note that the file must not be truncated while it is mapped,
+    as accessing the part that was removed raises SIGBUS.
+*/
+class T3_WIDGET_LOCAL mapped_file_t {
+ public:
+  /** Map the file open on @p fd. Returns @c nullptr and sets @p error on failure. */
+  static std::shared_ptr<mapped_file_t> open(int fd, int *error);
+  ~mapped_file_t();
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+  /** Get the line starting at @p offset, up to but not including the next newline. */
+  string_view line_at(size_t offset) const;
+  /** Returns whether the data is read from the file described by @p info. */
+  bool is_file(const struct stat &info) const;
+
+ private:
+  mapped_file_t(const char *data, size_t size, const struct stat &info)
+      : data_(data), size_(size), device_(info.st_dev), inode_(info.st_ino) {}
+
+  const char *data_;
+  size_t size_;
+  dev_t device_;
+  ino_t inode_;
+};
+
+/** Builds the index of line start offsets for a mapped_file_t in a background thread.
+
+    Offsets are collected in batches, which start small such that the first screen of a file is
+    available almost immediately. After each batch ::signal_update is called, and the thread
+    running the main loop can collect the offsets found so far with take_offsets.
+*/
+class T3_WIDGET_LOCAL line_indexer_t {
+ public:
+  explicit line_indexer_t(std::shared_ptr<const mapped_file_t> file);
+  ~line_indexer_t();
+
+  /** Move the offsets of the line starts found since the last call to @p offsets.
+      @param offsets The location to append the offsets to. The offset of the first line (0) is not
+          included.
+      @param bytes_done The location to store the number of bytes indexed so far.
+      @return @c true if the whole file has been indexed.
+  */
+  bool take_offsets(std::vector<size_t> *offsets, size_t *bytes_done);
+  /** Block until the whole file has been indexed. */
+  void wait();
+
+ private:
+  void run();
+
+  std::shared_ptr<const mapped_file_t> file_;
+  std::mutex lock_;
+  std::vector<size_t> pending_;
+  size_t bytes_done_;
+  bool done_;
+  std::atomic<bool> stop_;
+  std::thread thread_;
+};
+
+}  // namespace t3widget
+
+#endif
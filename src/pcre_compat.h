@@ -39,6 +39,7 @@
 #define PCRE2_CASELESS PCRE_CASELESS
 #define PCRE2_NOTEOL PCRE_NOTEOL
 #define PCRE2_NOTBOL PCRE_NOTBOL
+#define PCRE2_NOTEMPTY_ATSTART PCRE_NOTEMPTY_ATSTART
 
 #define PCRE2_ERROR_BADOPTION PCRE_ERROR_BADOPTION
 
@@ -12,12 +12,19 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstring>
+#include <fcntl.h>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <string>
+#include <sys/stat.h>
 #include <t3window/window.h>
+#include <thread>
 #include <type_traits>
+#include <unistd.h>
 #include <utility>
 #include <vector>
 
@@ -25,7 +32,10 @@
 #include "t3widget/double_string_adapter.h"
 #include "t3widget/findcontext.h"
 #include "t3widget/internal.h"
+#include "t3widget/iovecwriter.h"
 #include "t3widget/key.h"
+#include "t3widget/main.h"
+#include "t3widget/mappedfile.h"
 #include "t3widget/signals.h"
 #include "t3widget/string_view.h"
 #include "t3widget/textbuffer.h"
@@ -33,15 +43,361 @@
 #include "t3widget/textline.h"
 #include "t3widget/tinystring.h"
 #include "t3widget/undo.h"
+#include "t3widget/undojournal.h"
 #include "t3widget/util.h"
 
+/* The number of lines handed to a thread at a time by text_buffer_search_t. */
+#define SEARCH_BLOCK_LINES 4096
+
 namespace t3widget {
 
-text_buffer_t::text_buffer_t(text_line_factory_t *_line_factory)
-    : impl(new implementation_t(_line_factory)) {}
+text_buffer_t::text_buffer_t(text_line_factory_t *_line_factory, text_storage_t storage)
+    : impl(new implementation_t(_line_factory, storage)) {}
 
 text_buffer_t::~text_buffer_t() {}
 
+static complex_error_t write_lines(const line_storage_t &lines, int fd,
+                                   const std::function<void(text_pos_t, text_pos_t)> &progress);
+
+struct text_buffer_snapshot_t::implementation_t {
+  line_storage_t lines;
+
+  explicit implementation_t(const line_storage_t &_lines) : lines(_lines) {}
+};
+
+text_buffer_snapshot_t::text_buffer_snapshot_t(const line_storage_t &lines)
+    : impl(new implementation_t(lines)) {}
+
+text_buffer_snapshot_t::~text_buffer_snapshot_t() {}
+
+text_pos_t text_buffer_snapshot_t::size() const { return impl->lines.size(); }
+
+string_view text_buffer_snapshot_t::get_line_text(text_pos_t idx, std::string *scratch) const {
+  return impl->lines.get_text(idx, scratch);
+}
+
+complex_error_t text_buffer_snapshot_t::write_to(
+    int fd, const std::function<void(text_pos_t, text_pos_t)> &progress) const {
+  return write_lines(impl->lines, fd, progress);
+}
+
+/* Implementation of text_buffer_t::find, for a text of which line idx is returned by get_line(idx).
+   The search is abandoned as soon as cancelled returns true. */
+template <typename L, typename C>
+static bool find_in_lines(text_pos_t size, const L &get_line, const C &cancelled,
+                          text_coordinate_t cursor, finder_t *finder, find_result_t *result,
+                          bool reverse) {
+  text_pos_t start, idx;
+
+  auto match_line = [&](text_pos_t line, bool backward) {
+    if (!finder->match(get_line(line), result, backward)) {
+      return false;
+    }
+    result->start.line = result->end.line = line;
+    return true;
+  };
+
+  /* Note: the value of result->start.line and result->end.line are ignored after the
+     search has started. The finder->match function does not take those values into
+     account. */
+
+  // Perform search
+  if (((finder->get_flags() & find_flags_t::BACKWARD) != 0) ^ reverse) {
+    start = idx = result->start.line;
+    result->end = result->start;
+    result->start.pos = -1;
+    if (match_line(idx, true)) {
+      return true;
+    }
+
+    result->end.pos = -1;
+    for (; idx > 0;) {
+      idx--;
+      if (cancelled()) {
+        return false;
+      }
+      if (match_line(idx, true)) {
+        return true;
+      }
+    }
+
+    if (!(finder->get_flags() & find_flags_t::WRAP)) {
+      return false;
+    }
+
+    for (idx = size; idx > start;) {
+      idx--;
+      if (cancelled()) {
+        return false;
+      }
+      if (match_line(idx, true)) {
+        return true;
+      }
+    }
+  } else {
+    start = idx = cursor.line;
+    result->start = cursor;
+    result->end.pos = -1;
+    if (match_line(idx, false)) {
+      return true;
+    }
+
+    result->start.pos = -1;
+    for (idx++; idx < size; idx++) {
+      if (cancelled()) {
+        return false;
+      }
+      if (match_line(idx, false)) {
+        return true;
+      }
+    }
+
+    if (!(finder->get_flags() & find_flags_t::WRAP)) {
+      return false;
+    }
+
+    for (idx = 0; idx <= start; idx++) {
+      if (cancelled()) {
+        return false;
+      }
+      if (match_line(idx, false)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+struct text_buffer_search_t::implementation_t {
+  // The matches found in a block of lines.
+  struct block_result_t {
+    std::vector<find_result_t> matches;
+    text_pos_t count = 0;
+  };
+
+  bool count_only;
+  text_pos_t line_count;
+  // For find_next, the position to search from and the search direction.
+  text_coordinate_t from;
+  bool reverse;
+
+  std::vector<block_result_t> results;
+  std::atomic<size_t> next_block;
+  std::atomic<int> running;
+  std::atomic<bool> cancelled;
+  /* The copies of the line storage and the finder_t used by each thread. The copies of the line
+     storage must be created and destroyed in the thread running the main loop. */
+  std::vector<std::unique_ptr<line_storage_t>> copies;
+  std::vector<std::unique_ptr<finder_t>> finders;
+  std::vector<std::thread> workers;
+  connection_t update_connection;
+
+  bool finished;
+  text_pos_t count;
+  std::vector<find_result_t> matches;
+  signal_t<> done;
+
+  implementation_t(const line_storage_t &lines, bool _count_only, text_coordinate_t _from,
+                   bool _reverse, size_t blocks);
+  void start(const line_storage_t &lines, finder_t &finder, int threads,
+             void (implementation_t::*search)(const line_storage_t *, finder_t *));
+  void search_blocks(const line_storage_t *lines, finder_t *finder);
+  void search_next(const line_storage_t *lines, finder_t *finder);
+  void check_done();
+  void join();
+  void finish();
+};
+
+text_buffer_search_t::implementation_t::implementation_t(const line_storage_t &lines,
+                                                         bool _count_only,
+                                                         text_coordinate_t _from, bool _reverse,
+                                                         size_t blocks)
+    : count_only(_count_only),
+      line_count(lines.size()),
+      from(_from),
+      reverse(_reverse),
+      results(blocks),
+      next_block(0),
+      cancelled(false),
+      finished(false),
+      count(0) {}
+
+void text_buffer_search_t::implementation_t::start(
+    const line_storage_t &lines, finder_t &finder, int threads,
+    void (implementation_t::*search)(const line_storage_t *, finder_t *)) {
+  for (int i = 0; i < threads; ++i) {
+    std::unique_ptr<finder_t> clone = finder.clone();
+    if (clone == nullptr) {
+      break;
+    }
+    finders.push_back(std::move(clone));
+  }
+  update_connection =
+      connect_update_notification(bind_front(&implementation_t::check_done, this));
+
+  if (finders.empty()) {
+    /* The finder can not be used in another thread, so search in this one. The results are still
+       only finished from the main loop, such that the done signal can be connected after the
+       search has been created. */
+    running = 1;
+    (this->*search)(&lines, &finder);
+    return;
+  }
+
+  running = finders.size();
+  for (const std::unique_ptr<finder_t> &thread_finder : finders) {
+    copies.emplace_back(new line_storage_t(lines));
+    workers.emplace_back(search, this, copies.back().get(), thread_finder.get());
+  }
+}
+
+void text_buffer_search_t::implementation_t::search_blocks(const line_storage_t *lines,
+                                                           finder_t *finder) {
+  std::string scratch;
+  std::string text;
+  size_t block;
+  while (!cancelled && (block = next_block++) < results.size()) {
+    block_result_t &result = results[block];
+    text_pos_t end = std::min<text_pos_t>(line_count, (block + 1) * SEARCH_BLOCK_LINES);
+    for (text_pos_t i = block * SEARCH_BLOCK_LINES; i < end && !cancelled; ++i) {
+      string_view line = lines->get_text(i, &scratch);
+      text.assign(line.data(), line.size());
+
+      find_result_t match;
+      match.start.pos = -1;
+      match.end.pos = -1;
+      text_pos_t searched_from = -1;
+      while (finder->match(text, &match, false)) {
+        /* The next search starts at the end of this match, where the finder does not match an
+           empty string. A finder which does so anyway would find the same match again, so continue
+           one character further on instead. */
+        if (match.end.pos == searched_from) {
+          if (static_cast<size_t>(searched_from) >= text.size()) {
+            break;
+          }
+          size_t char_bytes = text.size() - searched_from;
+          t3_utf8_get(text.data() + searched_from, &char_bytes);
+          searched_from = match.start.pos = searched_from + char_bytes;
+          match.end.pos = -1;
+          continue;
+        }
+        ++result.count;
+        if (!count_only) {
+          match.start.line = match.end.line = i;
+          result.matches.push_back(match);
+        }
+        searched_from = match.start.pos = match.end.pos;
+        match.end.pos = -1;
+      }
+    }
+  }
+  if (--running == 0) {
+    signal_update();
+  }
+}
+
+void text_buffer_search_t::implementation_t::search_next(const line_storage_t *lines,
+                                                         finder_t *finder) {
+  std::string scratch;
+  std::string text;
+  find_result_t result;
+  result.start = from;
+  if (find_in_lines(line_count,
+                    [&](text_pos_t idx) -> const std::string & {
+                      string_view line = lines->get_text(idx, &scratch);
+                      text.assign(line.data(), line.size());
+                      return text;
+                    },
+                    [this] { return cancelled.load(); }, from, finder, &result, reverse)) {
+    results[0].matches.push_back(result);
+    results[0].count = 1;
+  }
+  if (--running == 0) {
+    signal_update();
+  }
+}
+
+void text_buffer_search_t::implementation_t::check_done() {
+  if (running == 0) {
+    finish();
+  }
+}
+
+void text_buffer_search_t::implementation_t::join() {
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+  finders.clear();
+  copies.clear();
+  update_connection.disconnect();
+}
+
+void text_buffer_search_t::implementation_t::finish() {
+  if (finished || cancelled) {
+    return;
+  }
+  join();
+  for (const block_result_t &result : results) {
+    count += result.count;
+  }
+  matches.reserve(count_only ? 0 : count);
+  for (const block_result_t &result : results) {
+    matches.insert(matches.end(), result.matches.begin(), result.matches.end());
+  }
+  results.clear();
+  finished = true;
+  done();
+}
+
+text_buffer_search_t::text_buffer_search_t(const line_storage_t &lines, finder_t &finder,
+                                           bool count_only, int threads)
+    : impl(new implementation_t(lines, count_only, text_coordinate_t(0, 0), false,
+                                (lines.size() + SEARCH_BLOCK_LINES - 1) / SEARCH_BLOCK_LINES)) {
+  if (threads <= 0) {
+    threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  }
+  threads = std::max<size_t>(1, std::min<size_t>(threads, impl->results.size()));
+  impl->start(lines, finder, threads, &implementation_t::search_blocks);
+}
+
+text_buffer_search_t::text_buffer_search_t(const line_storage_t &lines, finder_t &finder,
+                                           text_coordinate_t start, bool reverse)
+    : impl(new implementation_t(lines, false, start, reverse, 1)) {
+  impl->start(lines, finder, 1, &implementation_t::search_next);
+}
+
+text_buffer_search_t::~text_buffer_search_t() { cancel(); }
+
+bool text_buffer_search_t::is_done() const { return impl->finished; }
+
+void text_buffer_search_t::wait() { impl->finish(); }
+
+void text_buffer_search_t::cancel() {
+  if (impl->finished) {
+    return;
+  }
+  impl->cancelled = true;
+  impl->join();
+}
+
+text_pos_t text_buffer_search_t::get_count() const { return impl->count; }
+
+const std::vector<find_result_t> &text_buffer_search_t::get_matches() const {
+  return impl->matches;
+}
+
+size_t text_buffer_search_t::get_match_index(text_coordinate_t pos) const {
+  return std::lower_bound(impl->matches.begin(), impl->matches.end(), pos,
+                          [](const find_result_t &match, const text_coordinate_t &where) {
+                            return match.start < where;
+                          }) -
+         impl->matches.begin();
+}
+
+_T3_WIDGET_IMPL_SIGNAL(text_buffer_search_t, done)
+
 text_pos_t text_buffer_t::size() const { return impl->size(); }
 
 const text_line_t &text_buffer_t::get_line_data(text_pos_t idx) const { return *impl->lines[idx]; }
@@ -49,23 +405,138 @@ text_line_t *text_buffer_t::get_mutable_line_data(text_pos_t idx) { return impl-
 
 text_line_factory_t *text_buffer_t::get_line_factory() { return impl->line_factory; }
 
-bool text_buffer_t::insert_char(key_t c) { return impl->insert_char(c); }
+bool text_buffer_t::insert_char(key_t c) {
+  impl->wait_for_load_before_edit(impl->cursor.line);
+  return impl->insert_char(c);
+}
 
-bool text_buffer_t::overwrite_char(key_t c) { return impl->overwrite_char(c); }
+bool text_buffer_t::overwrite_char(key_t c) {
+  impl->wait_for_load_before_edit(impl->cursor.line);
+  return impl->overwrite_char(c);
+}
 
-bool text_buffer_t::delete_char() { return impl->delete_char(); }
+bool text_buffer_t::delete_char() {
+  impl->wait_for_load_before_edit(impl->cursor.line);
+  return impl->delete_char();
+}
 
-bool text_buffer_t::backspace_char() { return impl->backspace_char(); }
+bool text_buffer_t::backspace_char() {
+  impl->wait_for_load_before_edit(impl->cursor.line);
+  return impl->backspace_char();
+}
 
-bool text_buffer_t::backspace_word() { return impl->backspace_word(); }
+bool text_buffer_t::backspace_word() {
+  impl->wait_for_load_before_edit(impl->cursor.line);
+  return impl->backspace_word();
+}
 
 bool text_buffer_t::is_modified() const { return !impl->undo_list.is_at_mark(); }
 
-bool text_buffer_t::merge(bool backspace) { return impl->merge(backspace); }
+bool text_buffer_t::merge(bool backspace) {
+  impl->wait_for_load_before_edit(backspace ? impl->cursor.line : impl->cursor.line + 1);
+  return impl->merge(backspace);
+}
+
+bool text_buffer_t::append_text(string_view text) {
+  impl->wait_for_load();
+  return impl->append_text(text);
+}
+
+complex_error_t text_buffer_t::load_file(const std::string &name) {
+  int fd = open(name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return complex_error_t(complex_error_t::SRC_ERRNO, errno);
+  }
+  complex_error_t result = impl->load_file(fd);
+  close(fd);
+  return result;
+}
+
+complex_error_t text_buffer_t::load_file(int fd) { return impl->load_file(fd); }
+
+bool text_buffer_t::is_loading() const { return impl->load_indexer != nullptr; }
+
+complex_error_t text_buffer_t::write_to(int fd) { return impl->write_to(fd); }
+
+std::unique_ptr<text_buffer_snapshot_t> text_buffer_t::snapshot() {
+  wait_for_load();
+  return std::unique_ptr<text_buffer_snapshot_t>(new text_buffer_snapshot_t(impl->lines));
+}
+
+std::unique_ptr<text_buffer_search_t> text_buffer_t::find_all(finder_t &finder, bool count_only,
+                                                              int threads) {
+  wait_for_load();
+  return std::unique_ptr<text_buffer_search_t>(
+      new text_buffer_search_t(impl->lines, finder, count_only, threads));
+}
+
+std::unique_ptr<text_buffer_search_t> text_buffer_t::find_next(finder_t &finder,
+                                                               text_coordinate_t start,
+                                                               bool reverse) {
+  wait_for_load();
+  ASSERT(start.line >= 0 && start.line < size());
+  return std::unique_ptr<text_buffer_search_t>(
+      new text_buffer_search_t(impl->lines, finder, start, reverse));
+}
+
+void text_buffer_t::compress_inactive_lines(text_pos_t max_active_lines) {
+  impl->lines.compress_inactive(max_active_lines, impl->line_factory);
+}
+
+complex_error_t text_buffer_t::start_journal(int fd) {
+  int error;
+  std::unique_ptr<undo_journal_t> journal = undo_journal_t::open(fd, &error);
+  if (journal == nullptr) {
+    return complex_error_t(complex_error_t::SRC_ERRNO, error);
+  }
+  // Operations which are still being extended would not be written to the journal.
+  impl->last_undo_type = UNDO_NONE;
+  impl->undo_list.set_journal(std::move(journal));
+  return complex_error_t();
+}
+
+complex_error_t text_buffer_t::sync_journal() {
+  impl->last_undo_type = UNDO_NONE;
+  int error = impl->undo_list.sync_journal();
+  if (error != 0) {
+    return complex_error_t(complex_error_t::SRC_ERRNO, error);
+  }
+  return complex_error_t();
+}
+
+complex_error_t text_buffer_t::replay_journal(int fd) {
+  wait_for_load();
+  bool replayed = false;
+  bool valid = true;
+  int error = undo_journal_t::replay(
+      fd, [this, &replayed, &valid](undo_type_t type, text_coordinate_t start, string_view text) {
+        if (!impl->can_apply_undo_redo(type, start, text)) {
+          // The journal does not belong to the loaded file.
+          valid = false;
+          return false;
+        }
+        impl->apply_undo_redo(type, start, text);
+        replayed = true;
+        return true;
+      });
+  if (replayed) {
+    impl->undo_list.invalidate_mark();
+  }
+  if (error == 0 && !valid) {
+    error = EINVAL;
+  }
+  if (error != 0) {
+    return complex_error_t(complex_error_t::SRC_ERRNO, error);
+  }
+  return complex_error_t();
+}
 
-bool text_buffer_t::append_text(string_view text) { return impl->append_text(text); }
+void text_buffer_t::wait_for_load() { impl->wait_for_load(); }
 
-bool text_buffer_t::break_line(const std::string &indent) { return impl->break_line(indent); }
+bool text_buffer_t::break_line(const std::string &indent) {
+  impl->wait_for_load_before_edit(impl->cursor.line);
+  return impl->break_line(indent);
+}
 
 text_pos_t text_buffer_t::calculate_screen_pos(int tabsize) const {
   return calculate_screen_pos(impl->cursor, tabsize);
@@ -82,7 +553,7 @@ text_pos_t text_buffer_t::calculate_line_pos(text_pos_t line, text_pos_t pos, in
 void text_buffer_t::paint_line(t3window::window_t *win, text_pos_t line,
                                const text_line_t::paint_info_t &info) {
   prepare_paint_line(line);
-  impl->lines[line]->paint_line(win, info);
+  impl->get_line(line)->paint_line(win, info);
 }
 
 text_pos_t text_buffer_t::get_line_size(text_pos_t line) const { return impl->get_line_size(line); }
@@ -114,15 +585,21 @@ void text_buffer_t::delete_block(text_coordinate_t start, text_coordinate_t end)
     return;
   }
 
+  impl->wait_for_load_before_edit(std::max(start, end).line, &start, &end);
+
   start_undo_block();
   impl->delete_block_internal(start, end, impl->get_undo(UNDO_DELETE, std::min(start, end)));
   end_undo_block();
 }
 
-bool text_buffer_t::insert_block(const std::string &block) { return impl->insert_block(block); }
+bool text_buffer_t::insert_block(const std::string &block) {
+  impl->wait_for_load_before_edit(impl->cursor.line);
+  return impl->insert_block(block);
+}
 
 bool text_buffer_t::replace_block(text_coordinate_t start, text_coordinate_t end,
                                   const std::string &block) {
+  impl->wait_for_load_before_edit(std::max(start, end).line, &start, &end);
   return impl->replace_block(start, end, block);
 }
 
@@ -133,12 +610,17 @@ std::unique_ptr<std::string> text_buffer_t::convert_block(text_coordinate_t star
 
 void text_buffer_t::set_undo_mark() { impl->set_undo_mark(); }
 
+void text_buffer_t::set_undo_memory_limit(size_t limit) { impl->undo_list.set_memory_limit(limit); }
+
+size_t text_buffer_t::get_undo_memory_usage() const { return impl->undo_list.get_memory_usage(); }
+
 /*FIXME: define return values for:
         - nothing done
         - failure
         - success;
 */
 int text_buffer_t::apply_undo() {
+  impl->wait_for_load();
   undo_t *current = impl->undo_list.back();
 
   if (current == nullptr) {
@@ -150,6 +632,7 @@ int text_buffer_t::apply_undo() {
 }
 
 int text_buffer_t::apply_redo() {
+  impl->wait_for_load();
   undo_t *current = impl->undo_list.forward();
 
   if (current == nullptr) {
@@ -174,8 +657,10 @@ bool text_buffer_t::find_limited(finder_t *finder, text_coordinate_t start, text
 }
 
 void text_buffer_t::replace(const finder_t &finder, const find_result_t &result) {
-  std::string replacement_str = finder.get_replacement(impl->lines[result.start.line]->get_data());
-  replace_block(result.start, result.end, replacement_str);
+  text_coordinate_t start = result.start, end = result.end;
+  impl->wait_for_load_before_edit(end.line, &start, &end);
+  std::string replacement_str = finder.get_replacement(impl->lines[start.line]->get_data());
+  replace_block(start, end, replacement_str);
 }
 
 void text_buffer_t::set_selection_mode(selection_mode_t mode) {
@@ -185,21 +670,30 @@ void text_buffer_t::set_selection_mode(selection_mode_t mode) {
 selection_mode_t text_buffer_t::get_selection_mode() const { return impl->selection_mode; }
 
 bool text_buffer_t::indent_selection(int tabsize, bool tab_spaces) {
+  impl->wait_for_load_before_edit(impl->last_selected_line());
   return impl->indent_selection(tabsize, tab_spaces);
 }
 
 bool text_buffer_t::indent_block(text_coordinate_t &start, text_coordinate_t &end, int tabsize,
                                  bool tab_spaces) {
+  impl->wait_for_load_before_edit(std::max(start.line, end.line), &start, &end);
   return impl->indent_block(start, end, tabsize, tab_spaces);
 }
 
-bool text_buffer_t::unindent_selection(int tabsize) { return impl->unindent_selection(tabsize); }
+bool text_buffer_t::unindent_selection(int tabsize) {
+  impl->wait_for_load_before_edit(impl->last_selected_line());
+  return impl->unindent_selection(tabsize);
+}
 
 bool text_buffer_t::unindent_block(text_coordinate_t &start, text_coordinate_t &end, int tabsize) {
+  impl->wait_for_load_before_edit(std::max(start.line, end.line), &start, &end);
   return impl->unindent_block(start, end, tabsize);
 }
 
-bool text_buffer_t::unindent_line(int tabsize) { return impl->unindent_line(tabsize); }
+bool text_buffer_t::unindent_line(int tabsize) {
+  impl->wait_for_load_before_edit(impl->cursor.line);
+  return impl->unindent_line(tabsize);
+}
 
 void text_buffer_t::prepare_paint_line(text_pos_t line) { (void)line; }
 
@@ -216,6 +710,8 @@ void text_buffer_t::set_cursor(text_coordinate_t _cursor) { impl->cursor = _curs
 void text_buffer_t::set_cursor_pos(text_pos_t pos) { impl->cursor.pos = pos; }
 
 _T3_WIDGET_IMPL_SIGNAL(text_buffer_t, rewrap_required, rewrap_type_t, text_pos_t, text_pos_t)
+_T3_WIDGET_IMPL_SIGNAL(text_buffer_t, load_progress, size_t, size_t)
+_T3_WIDGET_IMPL_SIGNAL(text_buffer_t, save_progress, text_pos_t, text_pos_t)
 
 //==================================== implementation_t ============================================
 
@@ -298,7 +794,7 @@ bool text_buffer_t::implementation_t::merge_internal(text_pos_t line) {
   cursor.line = line;
   cursor.pos = lines[line]->size();
   lines[line]->merge(std::move(lines[line + 1]));
-  lines.erase(lines.begin() + line + 1);
+  lines.erase(line + 1, line + 2);
   rewrap_required(rewrap_type_t::DELETE_LINES, line + 1, line + 2);
   rewrap_required(rewrap_type_t::REWRAP_LINE, cursor.line, cursor.pos);
   return true;
@@ -318,7 +814,7 @@ bool text_buffer_t::implementation_t::insert_block_internal(text_coordinate_t in
 
   while (next_start > 0) {
     insert_at.line++;
-    lines.insert(lines.begin() + insert_at.line, block->break_on_nl(&next_start));
+    lines.insert(insert_at.line, block->break_on_nl(&next_start));
     rewrap_required(rewrap_type_t::INSERT_LINES, insert_at.line, insert_at.line + 1);
   }
 
@@ -400,7 +896,7 @@ void text_buffer_t::implementation_t::delete_block_internal(text_coordinate_t st
 
   if (start_part == nullptr) {
     if (undo != nullptr) {
-      undo->get_text()->append(lines[start.line]->get_data());
+      undo->get_text()->append(get_line(start.line)->get_data());
     }
     if (end_part != nullptr) {
       lines[start.line] = std::move(end_part);
@@ -419,16 +915,16 @@ void text_buffer_t::implementation_t::delete_block_internal(text_coordinate_t st
     undo->add_newline();
 
     for (text_pos_t i = start.line; i < end.line; i++) {
-      undo->get_text()->append(lines[i]->get_data());
+      undo->get_text()->append(get_line(i)->get_data());
       undo->add_newline();
     }
 
     if (end.pos != 0) {
-      undo->get_text()->append(lines[end.line]->get_data());
+      undo->get_text()->append(get_line(end.line)->get_data());
     }
   }
   end.line++;
-  lines.erase(lines.begin() + start.line, lines.begin() + end.line);
+  lines.erase(start.line, end.line);
   cursor.pos = lines[cursor.line]->adjust_position(cursor.pos, 0);
 
   rewrap_required(rewrap_type_t::DELETE_LINES, start.line, end.line);
@@ -440,7 +936,7 @@ void text_buffer_t::implementation_t::delete_block_internal(text_coordinate_t st
 
 bool text_buffer_t::implementation_t::break_line_internal(const std::string &indent) {
   std::unique_ptr<text_line_t> insert = lines[cursor.line]->break_line(cursor.pos);
-  lines.insert(lines.begin() + cursor.line + 1, std::move(insert));
+  lines.insert(cursor.line + 1, std::move(insert));
   rewrap_required(rewrap_type_t::REWRAP_LINE, cursor.line, cursor.pos);
   rewrap_required(rewrap_type_t::INSERT_LINES, cursor.line + 1, cursor.line + 2);
   cursor.line++;
@@ -474,6 +970,164 @@ bool text_buffer_t::implementation_t::append_text(string_view text) {
   return result;
 }
 
+complex_error_t text_buffer_t::implementation_t::load_file(int fd) {
+  if (load_indexer != nullptr) {
+    return complex_error_t(complex_error_t::SRC_ERRNO, EBUSY);
+  }
+  if (lines.size() != 1 || get_line(0)->size() != 0) {
+    return complex_error_t(complex_error_t::SRC_ERRNO, EINVAL);
+  }
+
+  int error;
+  std::shared_ptr<mapped_file_t> file = mapped_file_t::open(fd, &error);
+  if (file == nullptr) {
+    return complex_error_t(complex_error_t::SRC_ERRNO, error);
+  }
+
+  load_source = file;
+  load_next_line_start = 0;
+  lines.set_source(load_source, line_factory);
+  load_indexer.reset(new line_indexer_t(load_source));
+  load_connection = connect_update_notification([this] { process_loaded_lines(); });
+  return complex_error_t();
+}
+
+/* Write lines to fd, without copying them. Lazy lines are written straight from the mapped file.
+   The newline following them in the mapped file is used as well, which allows runs of such lines to
+   be written as a single range. */
+static complex_error_t write_lines(const line_storage_t &lines, int fd,
+                                   const std::function<void(text_pos_t, text_pos_t)> &progress) {
+  static const char newline = '\n';
+
+  const mapped_file_t *source = lines.source();
+  struct stat file_info;
+  if (source != nullptr && fstat(fd, &file_info) == 0 && source->is_file(file_info)) {
+    /* Writing would overwrite the lazy lines before they are read, or they were already lost
+       when the file was truncated. */
+    return complex_error_t(complex_error_t::SRC_ERRNO, EINVAL);
+  }
+
+  iovec_writer_t writer(fd);
+  const char *source_start = source == nullptr ? nullptr : source->data();
+  const char *source_end = source == nullptr ? nullptr : source->data() + source->size();
+  std::string scratch;
+  size_t last_bytes_written = 0;
+  text_pos_t count = lines.size();
+  for (text_pos_t i = 0; i < count; ++i) {
+    string_view text = lines.get_text(i, &scratch);
+    const char *line_end = &newline;
+    if (text.data() >= source_start && text.data() + text.size() < source_end &&
+        text.data()[text.size()] == '\n') {
+      line_end = text.data() + text.size();
+    }
+
+    // The contents of scratch are overwritten by the next line that needs it, so it must be copied.
+    int error = text.data() == scratch.data() ? writer.add_copy(text.data(), text.size())
+                                              : writer.add(text.data(), text.size());
+    if (error == 0 && i + 1 < count) {
+      error = writer.add(line_end, 1);
+    }
+    if (error != 0) {
+      return complex_error_t(complex_error_t::SRC_ERRNO, error);
+    }
+
+    if (writer.bytes_written() != last_bytes_written && progress) {
+      last_bytes_written = writer.bytes_written();
+      progress(i, count);
+    }
+  }
+  int error = writer.flush();
+  if (error != 0) {
+    return complex_error_t(complex_error_t::SRC_ERRNO, error);
+  }
+  if (progress) {
+    progress(count, count);
+  }
+  return complex_error_t();
+}
+
+complex_error_t text_buffer_t::implementation_t::write_to(int fd) {
+  wait_for_load();
+  const mapped_file_t *source = lines.source();
+  struct stat file_info;
+  if (source != nullptr && fstat(fd, &file_info) == 0 && source->is_file(file_info) &&
+      static_cast<size_t>(file_info.st_size) >= source->size()) {
+    // The lazy lines are read from the file that is about to be overwritten.
+    lines.materialize_all();
+  }
+  return write_lines(lines, fd, [this](text_pos_t done, text_pos_t total) {
+    save_progress(done, total);
+  });
+}
+
+void text_buffer_t::implementation_t::wait_for_load(text_coordinate_t *start,
+                                                   text_coordinate_t *end) {
+  if (load_indexer == nullptr) {
+    return;
+  }
+  load_indexer->wait();
+  process_loaded_lines(start, end);
+}
+
+void text_buffer_t::implementation_t::wait_for_load_before_edit(text_pos_t last_line,
+                                                                text_coordinate_t *start,
+                                                                text_coordinate_t *end) {
+  if (last_line >= size() - 1) {
+    wait_for_load(start, end);
+  }
+}
+
+void text_buffer_t::implementation_t::process_loaded_lines(text_coordinate_t *start,
+                                                           text_coordinate_t *end) {
+  if (load_indexer == nullptr) {
+    return;
+  }
+  text_coordinate_t *coordinates[] = {&cursor, &selection_start, &selection_end, start, end};
+
+  std::vector<size_t> offsets;
+  size_t bytes_done;
+  size_t file_size = load_source->size();
+  bool done = load_indexer->take_offsets(&offsets, &bytes_done);
+
+  /* Each newly found line start completes the line before it. The completed lines are inserted
+     before the last line of the buffer, which is where the remainder of the file will end up. */
+  if (!offsets.empty()) {
+    text_pos_t insert_at = lines.size() - 1;
+    text_pos_t count = offsets.size();
+    offsets.insert(offsets.begin(), load_next_line_start);
+    load_next_line_start = offsets.back();
+    lines.insert_lazy(insert_at, offsets.data(), count);
+
+    for (text_coordinate_t *coordinate : coordinates) {
+      if (coordinate != nullptr && coordinate->line >= insert_at) {
+        coordinate->line += count;
+      }
+    }
+    rewrap_required(rewrap_type_t::INSERT_LINES, insert_at, insert_at + count);
+  }
+
+  if (done) {
+    // The part of the file after the last newline is prepended to the last line.
+    text_pos_t last = lines.size() - 1;
+    std::unique_ptr<text_line_t> tail =
+        line_factory->new_text_line_t(load_source->line_at(load_next_line_start));
+    text_pos_t tail_size = tail->size();
+    tail->merge(std::move(lines[last]));
+    lines[last] = std::move(tail);
+    for (text_coordinate_t *coordinate : coordinates) {
+      if (coordinate != nullptr && coordinate->line == last) {
+        coordinate->pos += tail_size;
+      }
+    }
+    rewrap_required(rewrap_type_t::REWRAP_LINE, last, 0);
+
+    load_indexer.reset();
+    load_connection.disconnect();
+    load_source.reset();
+  }
+  load_progress(bytes_done, file_size);
+}
+
 bool text_buffer_t::implementation_t::break_line(const std::string &indent) {
   start_undo_block();
   undo_t *undo = get_undo(UNDO_ADD);
@@ -523,8 +1177,8 @@ bool text_buffer_t::implementation_t::replace_block(text_coordinate_t start, tex
   return true;
 }
 
-std::unique_ptr<std::string> text_buffer_t::implementation_t::convert_block(text_coordinate_t start,
-                                                                            text_coordinate_t end) {
+std::unique_ptr<std::string> text_buffer_t::implementation_t::convert_block(
+    text_coordinate_t start, text_coordinate_t end) const {
   text_coordinate_t current_start, current_end;
 
   current_start = start;
@@ -566,7 +1220,7 @@ std::unique_ptr<std::string> text_buffer_t::implementation_t::convert_block(text
 }
 
 void text_buffer_t::implementation_t::goto_next_word() {
-  text_line_t *line = lines[cursor.line].get();
+  const text_line_t *line = get_line(cursor.line);
 
   /* Use -1 as an indicator for end of line */
   if (cursor.pos >= line->size()) {
@@ -576,7 +1230,7 @@ void text_buffer_t::implementation_t::goto_next_word() {
       if (static_cast<size_t>(cursor.line) + 1 >= lines.size()) {
         break;
       }
-      line = lines[++cursor.line].get();
+      line = get_line(++cursor.line);
       cursor.pos = line->get_next_word(-1);
     }
   } else if (cursor.pos >= 0) {
@@ -590,13 +1244,13 @@ void text_buffer_t::implementation_t::goto_next_word() {
 }
 
 void text_buffer_t::implementation_t::goto_previous_word() {
-  text_line_t *line = lines[cursor.line].get();
+  const text_line_t *line = get_line(cursor.line);
 
   cursor.pos = line->get_previous_word(cursor.pos);
 
   /* Keep skipping to next line if no word can be found */
   while (cursor.pos < 0 && cursor.line > 0) {
-    line = lines[--cursor.line].get();
+    line = get_line(--cursor.line);
     cursor.pos = line->get_previous_word(-1);
   }
 
@@ -607,15 +1261,15 @@ void text_buffer_t::implementation_t::goto_previous_word() {
 }
 
 void text_buffer_t::implementation_t::goto_next_word_boundary() {
-  cursor.pos = lines[cursor.line]->get_next_word_boundary(cursor.pos);
+  cursor.pos = get_line(cursor.line)->get_next_word_boundary(cursor.pos);
 }
 
 void text_buffer_t::implementation_t::goto_previous_word_boundary() {
-  cursor.pos = lines[cursor.line]->get_previous_word_boundary(cursor.pos);
+  cursor.pos = get_line(cursor.line)->get_previous_word_boundary(cursor.pos);
 }
 
 void text_buffer_t::implementation_t::adjust_position(int adjust) {
-  cursor.pos = lines[cursor.line]->adjust_position(cursor.pos, adjust);
+  cursor.pos = get_line(cursor.line)->adjust_position(cursor.pos, adjust);
 }
 
 int text_buffer_t::implementation_t::width_at_cursor() const {
@@ -659,10 +1313,6 @@ undo_t *text_buffer_t::implementation_t::get_undo(undo_type_t type, text_coordin
     return last_undo;
   }
 
-  if (last_undo != nullptr) {
-    last_undo->minimize();
-  }
-
   ASSERT(type != UNDO_NONE && type <= UNDO_BLOCK_END);
   last_undo_position = coord;
 
@@ -683,9 +1333,6 @@ undo_t *text_buffer_t::implementation_t::get_undo(undo_type_t type, text_coordin
 
 void text_buffer_t::implementation_t::set_undo_mark() {
   undo_list.set_mark();
-  if (last_undo != nullptr) {
-    last_undo->minimize();
-  }
   last_undo_type = UNDO_NONE;
 }
 
@@ -693,44 +1340,64 @@ void text_buffer_t::implementation_t::set_undo_mark() {
 // operations.
 
 void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, undo_t *current) {
-  text_coordinate_t start, end;
+  switch (type) {
+    case UNDO_BLOCK_END:
+      do {
+        current = undo_list.back();
+        apply_undo_redo(current->get_type(), current);
+      } while (current != nullptr && current->get_type() != UNDO_BLOCK_START);
+      ASSERT(current != nullptr);
+      break;
+    case UNDO_BLOCK_START_REDO:
+      do {
+        current = undo_list.forward();
+        apply_undo_redo(current->get_redo_type(), current);
+      } while (current != nullptr && current->get_redo_type() != UNDO_BLOCK_END_REDO);
+      ASSERT(current != nullptr);
+      break;
+    default:
+      apply_undo_redo(type, current->get_start(), current->get_data());
+      break;
+  }
+}
+
+void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, text_coordinate_t start,
+                                                      string_view text) {
+  text_coordinate_t end;
 
   set_selection_mode(selection_mode_t::NONE);
   switch (type) {
     case UNDO_ADD: {
-      end = start = current->get_start();
-      size_t newline = current->get_text()->find_last_of('\n');
-      if (newline == std::string::npos) {
-        end.pos += current->get_text()->size();
+      end = start;
+      size_t newline = text.find_last_of('\n');
+      if (newline == string_view::npos) {
+        end.pos += text.size();
       } else {
-        end.pos = current->get_text()->size() - newline - 1;
-        tiny_string_t::iterator begin = current->get_text()->begin();
-        end.line += std::count(begin, begin + newline, '\n') + 1;
+        end.pos = text.size() - newline - 1;
+        end.line += std::count(text.begin(), text.begin() + newline, '\n') + 1;
       }
       delete_block_internal(start, end, nullptr);
       break;
     }
     case UNDO_ADD_REDO:
     case UNDO_DELETE:
-      start = current->get_start();
-      insert_block_internal(start, line_factory->new_text_line_t(*current->get_text()));
+      insert_block_internal(start, line_factory->new_text_line_t(text));
       if (type == UNDO_DELETE) {
         cursor = start;
       }
       break;
     case UNDO_BACKSPACE:
-      start = current->get_start();
-      start.pos -= current->get_text()->size();
-      insert_block_internal(start, line_factory->new_text_line_t(*current->get_text()));
+      start.pos -= text.size();
+      insert_block_internal(start, line_factory->new_text_line_t(text));
       break;
     case UNDO_BACKSPACE_REDO:
-      end = start = current->get_start();
-      start.pos -= current->get_text()->size();
+      end = start;
+      start.pos -= text.size();
       delete_block_internal(start, end, nullptr);
       break;
     case UNDO_OVERWRITE: {
-      double_string_adapter_t undo_adapter(current->get_text());
-      end = start = current->get_start();
+      double_string_adapter_t undo_adapter(text);
+      end = start;
       end.pos += undo_adapter.second().size();
       delete_block_internal(start, end, nullptr);
       insert_block_internal(start, line_factory->new_text_line_t(undo_adapter.first()));
@@ -738,8 +1405,8 @@ void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, undo_t *
       break;
     }
     case UNDO_OVERWRITE_REDO: {
-      double_string_adapter_t undo_adapter(current->get_text());
-      end = start = current->get_start();
+      double_string_adapter_t undo_adapter(text);
+      end = start;
       end.pos += undo_adapter.first().size();
       delete_block_internal(start, end, nullptr);
       insert_block_internal(start, line_factory->new_text_line_t(undo_adapter.second()));
@@ -747,25 +1414,11 @@ void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, undo_t *
     }
     case UNDO_INDENT:
     case UNDO_UNINDENT:
-      undo_indent_selection(current, type);
+      undo_indent_selection(type, start, text);
       break;
     case UNDO_BLOCK_START:
     case UNDO_BLOCK_END_REDO:
-      cursor = current->get_start();
-      break;
-    case UNDO_BLOCK_END:
-      do {
-        current = undo_list.back();
-        apply_undo_redo(current->get_type(), current);
-      } while (current != nullptr && current->get_type() != UNDO_BLOCK_START);
-      ASSERT(current != nullptr);
-      break;
-    case UNDO_BLOCK_START_REDO:
-      do {
-        current = undo_list.forward();
-        apply_undo_redo(current->get_redo_type(), current);
-      } while (current != nullptr && current->get_redo_type() != UNDO_BLOCK_END_REDO);
-      ASSERT(current != nullptr);
+      cursor = start;
       break;
     default:
       ASSERT(false);
@@ -774,6 +1427,88 @@ void text_buffer_t::implementation_t::apply_undo_redo(undo_type_t type, undo_t *
   last_undo_type = UNDO_NONE;
 }
 
+bool text_buffer_t::implementation_t::can_apply_undo_redo(undo_type_t type,
+                                                          text_coordinate_t start,
+                                                          string_view text) const {
+  // Checks that pos is in the buffer, and not in the middle of a UTF-8 sequence.
+  auto valid_position = [this](text_coordinate_t pos) {
+    if (pos.line < 0 || pos.line >= size() || pos.pos < 0 || pos.pos > lines[pos.line]->size()) {
+      return false;
+    }
+    const std::string &data = lines[pos.line]->get_data();
+    return pos.pos == static_cast<text_pos_t>(data.size()) || (data[pos.pos] & 0xc0) != 0x80;
+  };
+  // Checks that the buffer contains expected at pos, which may span multiple lines.
+  auto text_at = [this, &valid_position](text_coordinate_t pos, string_view expected) {
+    while (true) {
+      if (!valid_position(pos)) {
+        return false;
+      }
+      const std::string &data = lines[pos.line]->get_data();
+      size_t newline = expected.find('\n');
+      string_view part = expected.substr(0, newline);
+      if (string_view(data).compare(pos.pos, part.size(), part) != 0) {
+        return false;
+      }
+      if (newline == string_view::npos) {
+        return valid_position(text_coordinate_t(pos.line, pos.pos + part.size()));
+      }
+      if (pos.pos + part.size() != data.size()) {
+        return false;
+      }
+      expected = expected.substr(newline + 1);
+      pos = text_coordinate_t(pos.line + 1, 0);
+    }
+  };
+
+  switch (type) {
+    case UNDO_ADD:
+      return text_at(start, text);
+    case UNDO_ADD_REDO:
+    case UNDO_DELETE:
+      return valid_position(start);
+    case UNDO_BACKSPACE:
+      start.pos -= text.size();
+      return valid_position(start);
+    case UNDO_BACKSPACE_REDO:
+      start.pos -= text.size();
+      return text_at(start, text);
+    case UNDO_OVERWRITE:
+    case UNDO_OVERWRITE_REDO: {
+      // Check the length of the first string, as double_string_adapter_t does not.
+      size_t first_start = text.size();
+      size_t first_size = text.empty() ? 0 : t3_utf8_get(text.data(), &first_start);
+      if (text.empty() || first_start + first_size > text.size()) {
+        return false;
+      }
+      double_string_adapter_t adapter(text);
+      return text_at(start, type == UNDO_OVERWRITE ? adapter.second() : adapter.first());
+    }
+    case UNDO_INDENT:
+    case UNDO_UNINDENT: {
+      /* The text holds the indentation of consecutive lines, each followed by an X character.
+         Empty entries, such as the one after the last X, do not change the text. */
+      size_t pos = 0;
+      for (text_pos_t line = start.line;; ++line) {
+        size_t next_pos = std::min(text.find('X', pos), text.size());
+        if (next_pos != pos &&
+            (type == UNDO_INDENT ? !text_at(text_coordinate_t(line, 0),
+                                            text.substr(pos, next_pos - pos))
+                                 : !valid_position(text_coordinate_t(line, 0)))) {
+          return false;
+        }
+        if (next_pos == text.size()) {
+          return true;
+        }
+        pos = next_pos + 1;
+      }
+    }
+    default:
+      // Markers for blocks of operations are not written to the journal.
+      return false;
+  }
+}
+
 void text_buffer_t::implementation_t::set_selection_from_find(const find_result_t &result) {
   selection_start = result.start;
 
@@ -786,73 +1521,15 @@ void text_buffer_t::implementation_t::set_selection_from_find(const find_result_
 
 bool text_buffer_t::implementation_t::find(finder_t *finder, find_result_t *result,
                                            bool reverse) const {
-  text_pos_t start, idx;
-
-  /* Note: the value of result->start.line and result->end.line are ignored after the
-     search has started. The finder->match function does not take those values into
-     account. */
-
-  // Perform search
-  if (((finder->get_flags() & find_flags_t::BACKWARD) != 0) ^ reverse) {
-    start = idx = result->start.line;
-    result->end = result->start;
-    result->start.pos = -1;
-    if (finder->match(lines[idx]->get_data(), result, true)) {
-      result->start.line = result->end.line = idx;
-      return true;
-    }
-
-    result->end.pos = -1;
-    for (; idx > 0;) {
-      idx--;
-      if (finder->match(lines[idx]->get_data(), result, true)) {
-        result->start.line = result->end.line = idx;
-        return true;
-      }
-    }
-
-    if (!(finder->get_flags() & find_flags_t::WRAP)) {
-      return false;
-    }
-
-    for (idx = lines.size(); idx > start;) {
-      idx--;
-      if (finder->match(lines[idx]->get_data(), result, true)) {
-        result->start.line = result->end.line = idx;
-        return true;
-      }
-    }
-  } else {
-    start = idx = cursor.line;
-    result->start = cursor;
-    result->end.pos = -1;
-    if (finder->match(lines[idx]->get_data(), result, false)) {
-      result->start.line = result->end.line = idx;
-      return true;
-    }
-
-    result->start.pos = -1;
-    const size_t lines_size = lines.size();
-    for (idx++; idx < static_cast<text_pos_t>(lines_size); idx++) {
-      if (finder->match(lines[idx]->get_data(), result, false)) {
-        result->start.line = result->end.line = idx;
-        return true;
-      }
-    }
-
-    if (!(finder->get_flags() & find_flags_t::WRAP)) {
-      return false;
-    }
-
-    for (idx = 0; idx <= start; idx++) {
-      if (finder->match(lines[idx]->get_data(), result, false)) {
-        result->start.line = result->end.line = idx;
-        return true;
-      }
-    }
-  }
-
-  return false;
+  std::string scratch;
+  std::string text;
+  return find_in_lines(lines.size(),
+                       [&](text_pos_t idx) -> const std::string & {
+                         string_view line = lines.get_text(idx, &scratch);
+                         text.assign(line.data(), line.size());
+                         return text;
+                       },
+                       [] { return false; }, cursor, finder, result, reverse);
 }
 
 bool text_buffer_t::implementation_t::find_limited(finder_t *finder, text_coordinate_t start,
@@ -913,7 +1590,7 @@ bool text_buffer_t::implementation_t::indent_block(text_coordinate_t &start, tex
       end_line--;
     }
   }
-  tiny_string_t *undo_text = undo->get_text();
+  undo_text_t *undo_text = undo->get_text();
 
   for (; insert_at.line <= end_line; insert_at.line++) {
     undo_text->append(str);
@@ -941,19 +1618,20 @@ bool text_buffer_t::implementation_t::indent_selection(int tabsize, bool tab_spa
   return indent_block(selection_start, selection_end, tabsize, tab_spaces);
 }
 
-bool text_buffer_t::implementation_t::undo_indent_selection(undo_t *undo, undo_type_t type) {
+bool text_buffer_t::implementation_t::undo_indent_selection(undo_type_t type,
+                                                            text_coordinate_t start,
+                                                            string_view undo_text) {
   text_pos_t first_line;
   size_t pos = 0, next_pos = 0;
 
-  first_line = undo->get_start().line;
+  first_line = start.line;
 
-  tiny_string_t *undo_text = undo->get_text();
   bool last = false;
   for (; !last; first_line++) {
-    next_pos = undo_text->find('X', pos);
+    next_pos = undo_text.find('X', pos);
 
-    if (next_pos == std::string::npos) {
-      next_pos = undo_text->size();
+    if (next_pos == string_view::npos) {
+      next_pos = undo_text.size();
       last = true;
     }
 
@@ -966,8 +1644,8 @@ bool text_buffer_t::implementation_t::undo_indent_selection(undo_t *undo, undo_t
     } else {
       text_coordinate_t insert_at(first_line, 0);
       if (next_pos != pos) {
-        insert_block_internal(insert_at, line_factory->new_text_line_t(
-                                             string_view(undo_text->data() + pos, next_pos - pos)));
+        insert_block_internal(insert_at,
+                              line_factory->new_text_line_t(undo_text.substr(pos, next_pos - pos)));
       }
     }
     pos = next_pos + 1;
@@ -1105,7 +1783,7 @@ void text_buffer_t::implementation_t::goto_pos(text_pos_t line, text_pos_t pos)
     cursor.line = (line > size() ? size() : line) - 1;
   }
   if (pos >= 1) {
-    text_pos_t screen_pos = lines[cursor.line]->calculate_screen_width(0, pos - 1, 1);
+    text_pos_t screen_pos = get_line(cursor.line)->calculate_screen_width(0, pos - 1, 1);
     cursor.pos = calculate_line_pos(cursor.line, screen_pos, 1);
   }
 }
@@ -15,6 +15,7 @@
 #define T3_WIDGET_TEXTBUFFER_H
 
 #include <cstdio>
+#include <functional>
 #include <memory>
 #include <string>
 #include <t3widget/interfaces.h>
@@ -25,9 +26,106 @@
 namespace t3widget {
 
 struct find_result_t;
+class complex_error_t;
 class finder_t;
+class line_storage_t;
 class wrap_info_t;
 
+/** Read-only copy of the contents of a text_buffer_t, created by text_buffer_t::snapshot.
+
+    The snapshot shares its lines with the buffer, and a line is only copied when the buffer
+    modifies it while the snapshot still exists. This makes creating a snapshot cheap, and allows
+    it to be read from another thread while the buffer is being edited. A snapshot may only be used
+    by one thread at a time. The counts of the shared lines are not atomic, so the snapshot must be
+    created and destroyed in the main loop thread, which is the thread that modifies the buffer.
+*/
+class T3_WIDGET_API text_buffer_snapshot_t {
+  friend class text_buffer_t;
+
+ private:
+  struct T3_WIDGET_LOCAL implementation_t;
+  pimpl_t<implementation_t> impl;
+
+  explicit text_buffer_snapshot_t(const line_storage_t &lines);
+
+ public:
+  ~text_buffer_snapshot_t();
+
+  text_pos_t size() const;
+  /** Get the text of a line.
+      @param idx The index of the line.
+      @param scratch A string that may be used to store the text. The result remains valid until
+          @p scratch is modified or the snapshot is destroyed.
+  */
+  string_view get_line_text(text_pos_t idx, std::string *scratch) const;
+  /** Write the contents of the snapshot to a file, in the same way as text_buffer_t::write_to.
+      @param fd A file descriptor opened for writing. If the buffer was loaded with
+          text_buffer_t::load_file, this must not be the loaded file. @c EINVAL is returned in
+          that case.
+      @param progress A function which is called each time a batch of lines has been written, with
+          the number of lines written so far and the total number of lines. It is called in the
+          thread calling this function, and may be empty.
+  */
+  complex_error_t write_to(int fd,
+                           const std::function<void(text_pos_t, text_pos_t)> &progress) const;
+};
+
+/** Search for all matches of a finder_t in a text_buffer_t, created by text_buffer_t::find_all.
+
+    The lines are searched by background threads, which take blocks of lines in order. Each thread
+    uses its own clone of the finder_t, and reads the lines from its own copy of the line storage,
+    which shares the lines with the buffer in the same way as text_buffer_snapshot_t. The buffer may
+    therefore be edited while the search is running, but the results describe the contents of the
+    buffer at the time the search was started.
+
+    A search created by text_buffer_t::find_next instead looks for a single match in one
+    background thread, starting at a given position. It stops as soon as the match is found.
+
+    If the finder_t can not be cloned, the search is done with the finder_t itself in the thread
+    creating it, before the search is returned. The @c done signal is still emitted from the
+    #main_loop afterwards, and the results only become available at that point.
+
+    Once the search has finished, the @c done signal is emitted from the thread running the
+    #main_loop, and the results become available. Destroying the search cancels it, which only
+    waits for the line currently being searched. Like a snapshot, the search must be created and
+    destroyed in the thread running the #main_loop.
+*/
+class T3_WIDGET_API text_buffer_search_t {
+  friend class text_buffer_t;
+
+ private:
+  struct T3_WIDGET_LOCAL implementation_t;
+  pimpl_t<implementation_t> impl;
+
+  text_buffer_search_t(const line_storage_t &lines, finder_t &finder, bool count_only, int threads);
+  text_buffer_search_t(const line_storage_t &lines, finder_t &finder, text_coordinate_t start,
+                       bool reverse);
+
+ public:
+  ~text_buffer_search_t();
+
+  /** Returns whether the search has finished, and the results are available. */
+  bool is_done() const;
+  /** Block until the search has finished. If the @c done signal has not been emitted yet, it
+      is emitted before this returns. This must be called from the thread running the #main_loop.
+  */
+  void wait();
+  /** Stop searching. The results of a cancelled search do not become available. */
+  void cancel();
+
+  /** Returns the number of matches, once the search is done. */
+  text_pos_t get_count() const;
+  /** Returns the matches in the order of their position in the text, once the search is done.
+      This is empty if @c count_only was passed to text_buffer_t::find_all. */
+  const std::vector<find_result_t> &get_matches() const;
+  /** Returns the index in get_matches of the first match starting at or after @p pos, or the
+      number of matches if there is no such match. */
+  size_t get_match_index(text_coordinate_t pos) const;
+
+  /** Signal emitted when the search has finished. */
+  T3_WIDGET_DECLARE_SIGNAL(done);
+};
+
 class T3_WIDGET_API text_buffer_t {
   friend class wrap_info_t;
 
@@ -47,7 +145,12 @@ class T3_WIDGET_API text_buffer_t {
   virtual void prepare_paint_line(text_pos_t line);
 
  public:
-  text_buffer_t(text_line_factory_t *_line_factory = nullptr);
+  /** Create a new text_buffer_t.
+      @param _line_factory The factory used to create new lines, or @c nullptr for the default.
+      @param storage The storage engine used for the lines. See ::text_storage_t.
+  */
+  text_buffer_t(text_line_factory_t *_line_factory = nullptr,
+                text_storage_t storage = text_storage_t::VECTOR);
   virtual ~text_buffer_t();
 
   text_pos_t size() const;
@@ -64,6 +167,100 @@ class T3_WIDGET_API text_buffer_t {
 
   bool append_text(string_view text);
 
+  /** Load the contents of a file into the buffer.
+      @param name The name of the file to load.
+
+      The buffer must be empty, i.e. consist of a single empty line. The file is memory mapped, and
+      the line boundaries are determined in a background thread. Lines are added to the buffer
+      from the thread running the #main_loop as they are found, and each line is only converted to
+      a text_line_t when it is first used. The @c load_progress signal is emitted each time lines
+      are added. The lines of the file are added before the last line of the buffer, so the lines
+      before it can be edited while loading is in progress. Edits which involve the last line, and
+      undo and redo, first wait for the load to complete.
+
+      Until a line has been converted, its text is read from the file. If another process modifies
+      the file in place, the lines that have not been converted yet change with it. The file must
+      not be truncated while the buffer still exists, as that will cause the program to be
+      terminated with SIGBUS when an unconverted line is used, unless the application handles
+      that signal. Programs that modify files should write a new file and rename it over the old
+      one, which does not affect the loaded file.
+  */
+  complex_error_t load_file(const std::string &name);
+  /** Load the contents of a file into the buffer.
+      @param fd A file descriptor for the file to load. It may be closed after this call returns.
+
+      See load_file(const std::string &) for details.
+  */
+  complex_error_t load_file(int fd);
+  /** Returns whether a file load started with load_file is still in progress. */
+  bool is_loading() const;
+  /** Block until the file load started with load_file has completed, and add all its lines. */
+  void wait_for_load();
+  /** Write the contents of the buffer to a file.
+      @param fd A file descriptor opened for writing.
+
+      The lines are written with @c writev directly from the buffer, so no copy of the complete
+      contents is made in memory. Lines that have not been converted since load_file are written
+      straight from the loaded file. Lines are separated by a single newline character, and no
+      newline is written after the last line. If a file load is still in progress, this waits for
+      it to complete first. The @c save_progress signal is emitted each time a batch of lines has
+      been written. To write the buffer from another thread, use snapshot instead.
+
+      To save the buffer over the file passed to load_file, write it to a temporary file and rename
+      that over the original. Writing to the loaded file itself first converts all lines that are
+      still read from it, which needs as much memory as loading the file without mapping it. This is
+      only possible if the file was not truncated yet, so it must not be opened with @c O_TRUNC.
+      Otherwise the lines not converted yet are already lost, and @c EINVAL is returned without
+      writing anything.
+  */
+  complex_error_t write_to(int fd);
+  /** Create a snapshot of the contents of the buffer, which can be read from another thread.
+      If a file load is still in progress, this waits for it to complete first. This must be
+      called from the main loop thread, and the snapshot must also be destroyed there. See
+      text_buffer_snapshot_t for details.
+  */
+  std::unique_ptr<text_buffer_snapshot_t> snapshot();
+  /** Start writing all edits to a journal, from which they can be restored after a crash.
+      @param fd A file descriptor for the journal, opened for reading and writing. It may be
+          closed after this call returns.
+
+      Each operation recorded in the undo history is appended to the journal once it is complete,
+      and each undo and redo is recorded as well. Records are written and synced to disk in
+      batches, and when sync_journal is called. Undoing the last recorded operation removes it from
+      the journal, and the journal is emptied when the buffer is marked as saved, such that its
+      size is proportional to the changes since the file was last saved.
+
+      If @p fd already contains a journal, it must first be replayed with replay_journal, as the new
+      records are appended to the existing ones. Otherwise the file should be truncated first.
+  */
+  complex_error_t start_journal(int fd);
+  /** Write all complete operations to the journal, and sync it to disk.
+
+      An application should call this periodically, for example when the user stops typing, to
+      limit the amount of work lost in a crash.
+  */
+  complex_error_t sync_journal();
+  /** Apply the operations recorded in a journal by start_journal.
+      @param fd A file descriptor for the journal, opened for reading.
+
+      This must be called on a buffer containing the file as it was when the journal was started or
+      the buffer was last saved. The restored edits can not be undone, and the buffer is considered
+      modified afterwards. If a file load is still in progress, this waits for it to complete
+      first.
+  */
+  complex_error_t replay_journal(int fd);
+  /** Compress the lines which have not been used recently, to reduce the memory use.
+      @param max_active_lines The number of lines to keep uncompressed. These are taken from the
+          parts of the buffer that were used most recently.
+
+      Lines are compressed in blocks, which are decompressed as soon as any of their lines is used,
+      for example through get_line_data or paint_line. Lines which have not been converted since
+      load_file don't need to be compressed, as they only refer to the loaded file. This is only
+      supported for text_storage_t::ROPE, and does nothing for other storage types. Note that this
+      invalidates the references returned by get_line_data.
+  */
+  void compress_inactive_lines(text_pos_t max_active_lines);
+
   text_pos_t get_line_size(text_pos_t line) const;
   void adjust_position(int adjust);
   int width_at_cursor() const;
@@ -105,9 +302,49 @@ class T3_WIDGET_API text_buffer_t {
   bool find_limited(finder_t *finder, text_coordinate_t start, text_coordinate_t end,
                     find_result_t *result) const;
   void replace(const finder_t &finder, const find_result_t &result);
+  /** Find all matches in the text, searching in multiple threads.
+      @param finder The ::finder_t used to locate the matches. The search only uses clones of
+          @p finder, so it may be used and destroyed while the search is running. If
+          finder_t::clone returns @c nullptr, @p finder itself is used to search in the calling
+          thread instead.
+      @param count_only If @c true, only the matches are counted. This avoids storing them, which
+          can take a lot of memory for searches with many matches.
+      @param threads The number of threads to use, or 0 to use one for each processor.
+
+      Each line is searched in the same way as find searches forward: the search for the next
+      match in a line starts at the end of the previous match. If a file load is still in progress,
+      this waits for it to complete first. See text_buffer_search_t for details.
+  */
+  std::unique_ptr<text_buffer_search_t> find_all(finder_t &finder, bool count_only = false,
+                                                 int threads = 0);
+  /** Find the next match in the text in a background thread.
+      @param finder The ::finder_t used to locate the match. The search only uses a clone of
+          @p finder, unless finder_t::clone returns @c nullptr, in which case @p finder itself is
+          used to search in the calling thread.
+      @param start The position to search from.
+      @param reverse Reverse the direction of the find action.
+
+      The match found is the one find would return with both the cursor and the start of the
+      previous result at @p start. Once the search is done, text_buffer_search_t::get_matches
+      holds this match, or is empty if there is none. Editing the buffer does not affect the
+      search, so this can be used to search while the user is typing. If a file load is still in
+      progress, this waits for it to complete first.
+  */
+  std::unique_ptr<text_buffer_search_t> find_next(finder_t &finder, text_coordinate_t start,
+                                                  bool reverse = false);
 
   bool is_modified() const;
   std::unique_ptr<std::string> convert_block(text_coordinate_t start, text_coordinate_t end);
+  /** Limit the memory used for the undo history to @p limit bytes, or 0 for no limit.
+
+      When the limit is exceeded, the oldest operations are discarded, such that they can no longer
+      be undone. Operations grouped by start_undo_block and end_undo_block are discarded as a
+      whole. If the state marked as unmodified is discarded, is_modified will return @c true until
+      the buffer is saved again.
+  */
+  void set_undo_memory_limit(size_t limit);
+  /** Returns the number of bytes used for the undo history. */
+  size_t get_undo_memory_usage() const;
   int apply_undo();
   int apply_redo();
   void start_undo_block();
@@ -131,6 +368,12 @@ class T3_WIDGET_API text_buffer_t {
   void set_cursor_pos(text_pos_t pos);
 
   T3_WIDGET_DECLARE_SIGNAL(rewrap_required, rewrap_type_t, text_pos_t, text_pos_t);
+  /** Signal emitted when lines have been added by load_file.
+      The arguments are the number of bytes indexed so far and the size of the file. */
+  T3_WIDGET_DECLARE_SIGNAL(load_progress, size_t, size_t);
+  /** Signal emitted while write_to is writing the buffer.
+      The arguments are the number of lines written so far and the total number of lines. */
+  T3_WIDGET_DECLARE_SIGNAL(save_progress, text_pos_t, text_pos_t);
 };
 
 }  // namespace t3widget
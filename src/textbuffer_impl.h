@@ -18,13 +18,16 @@
 #error This header file is for internal use _only_!!
 #endif
 
+#include <algorithm>
+#include <t3widget/linestorage.h>
+#include <t3widget/mappedfile.h>
 #include <t3widget/textbuffer.h>
 #include <t3widget/undo.h>
 
 namespace t3widget {
 
 struct text_buffer_t::implementation_t {
-  std::vector<std::unique_ptr<text_line_t>> lines;
+  line_storage_t lines;
   text_coordinate_t selection_start;
   text_coordinate_t selection_end;
   selection_mode_t selection_mode;
@@ -38,8 +41,17 @@ struct text_buffer_t::implementation_t {
   signal_t<rewrap_type_t, text_pos_t, text_pos_t> rewrap_required;
   text_coordinate_t cursor;
 
-  implementation_t(text_line_factory_t *_line_factory)
-      : selection_start(-1, 0),
+  // State for load_file.
+  std::shared_ptr<const mapped_file_t> load_source;
+  std::unique_ptr<line_indexer_t> load_indexer;
+  connection_t load_connection;
+  size_t load_next_line_start = 0;
+  signal_t<size_t, size_t> load_progress;
+  signal_t<text_pos_t, text_pos_t> save_progress;
+
+  implementation_t(text_line_factory_t *_line_factory, text_storage_t storage)
+      : lines(storage),
+        selection_start(-1, 0),
         selection_end(-1, 0),
         selection_mode(selection_mode_t::NONE),
         last_undo_type(UNDO_NONE),
@@ -49,8 +61,12 @@ struct text_buffer_t::implementation_t {
     // Allocate a new, empty line
     lines.push_back(line_factory->new_text_line_t());
   }
+  ~implementation_t() { load_connection.disconnect(); }
 
   text_pos_t size() const { return lines.size(); }
+  /** Returns line @p idx for reading. Unlike the non-const @c lines[idx], this does not copy the
+      line and its chunk if they are shared with a snapshot or a search. */
+  const text_line_t *get_line(text_pos_t idx) const { return lines[idx].get(); }
   text_pos_t get_line_size(text_pos_t line) const { return lines[line]->size(); }
   text_pos_t calculate_line_pos(text_pos_t line, text_pos_t pos, int tabsize) const;
   bool insert_char(key_t c);
@@ -63,11 +79,24 @@ struct text_buffer_t::implementation_t {
   void delete_block_internal(text_coordinate_t start, text_coordinate_t end, undo_t *undo);
   bool break_line_internal(const std::string &indent = nullptr);
   bool append_text(string_view text);
+  complex_error_t load_file(int fd);
+  /** Block until the file load in progress has completed, and add all its lines. The coordinates
+      pointed to by @p start and @p end, if not @c nullptr, are adjusted for the added lines, in
+      the same way as the cursor. */
+  void wait_for_load(text_coordinate_t *start = nullptr, text_coordinate_t *end = nullptr);
+  /** Call wait_for_load if an edit of the lines up to @p last_line requires it. The lines of the
+      file are inserted before the last line of the buffer, so edits of the lines before it can be
+      made while the file is loading. Edits of the last line have to wait, as do undo and redo,
+      which do not know which lines they affect in advance. */
+  void wait_for_load_before_edit(text_pos_t last_line, text_coordinate_t *start = nullptr,
+                                 text_coordinate_t *end = nullptr);
+  void process_loaded_lines(text_coordinate_t *start = nullptr, text_coordinate_t *end = nullptr);
+  complex_error_t write_to(int fd);
   bool break_line(const std::string &indent);
   bool merge(bool backspace);
   bool insert_block(const std::string &block);
   bool replace_block(text_coordinate_t start, text_coordinate_t end, const std::string &block);
-  std::unique_ptr<std::string> convert_block(text_coordinate_t start, text_coordinate_t end);
+  std::unique_ptr<std::string> convert_block(text_coordinate_t start, text_coordinate_t end) const;
   void goto_next_word();
   void goto_previous_word();
   void goto_next_word_boundary();
@@ -76,6 +105,9 @@ struct text_buffer_t::implementation_t {
   int width_at_cursor() const;
   void set_selection_mode(selection_mode_t mode);
   bool selection_empty() const { return selection_start == selection_end; }
+  text_pos_t last_selected_line() const {
+    return std::max(cursor.line, std::max(selection_start.line, selection_end.line));
+  }
   void set_selection_end(bool update_primary);
   undo_t *get_undo(undo_type_t type);
   undo_t *get_undo(undo_type_t type, text_coordinate_t coord);
@@ -83,13 +115,20 @@ struct text_buffer_t::implementation_t {
   void end_undo_block() { get_undo(UNDO_BLOCK_END); }
   void set_undo_mark();
   void apply_undo_redo(undo_type_t type, undo_t *current);
+  /** Applies an operation of @p type at @p start with @p text, as recorded in an undo_t. Unlike
+      the overload taking an undo_t, this can not apply the blocks of operations in the undo list,
+      so it is used to replay operations which are not in the list. */
+  void apply_undo_redo(undo_type_t type, text_coordinate_t start, string_view text);
+  /** Returns whether applying an undo_t with @p start and @p text as @p type is possible, i.e.
+      whether all positions it affects are in the buffer, and the text it deletes is present. */
+  bool can_apply_undo_redo(undo_type_t type, text_coordinate_t start, string_view text) const;
   void set_selection_from_find(const find_result_t &result);
   bool find(finder_t *finder, find_result_t *result, bool reverse) const;
   bool find_limited(finder_t *finder, text_coordinate_t start, text_coordinate_t end,
                     find_result_t *result) const;
   bool indent_block(text_coordinate_t &start, text_coordinate_t &end, int tabsize, bool tab_spaces);
   bool indent_selection(int tabsize, bool tab_spaces);
-  bool undo_indent_selection(undo_t *undo, undo_type_t type);
+  bool undo_indent_selection(undo_type_t type, text_coordinate_t start, string_view undo_text);
   bool unindent_selection(int tabsize);
   bool unindent_block(text_coordinate_t &start, text_coordinate_t &end, int tabsize);
   bool unindent_line(int tabsize);
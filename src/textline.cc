@@ -15,22 +15,28 @@
 #define _XOPEN_SOURCE
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <string>
 #include <t3window/utf8.h>
 #include <type_traits>
 #include <unictype.h>
+#include <unordered_map>
+#include <vector>
 
 #include "t3widget/colorscheme.h"
 #include "t3widget/double_string_adapter.h"
 #include "t3widget/internal.h"
 #include "t3widget/key.h"
+#include "t3widget/modified_xxhash.h"
 #include "t3widget/string_view.h"
 #include "t3widget/textline.h"
 #include "t3widget/tinystring.h"
 #include "t3widget/undo.h"
+#include "t3widget/utf8validate.h"
 #include "t3widget/util.h"
 #include "t3window/terminal.h"
 #include "t3window/window.h"
@@ -62,21 +68,767 @@ static bool is_conjoining_jamo_lv(uint32_t c) {
   return false;
 }
 
+// Flags describing the contents of a line, as cached in text_line_t::implementation_t::metrics.
+enum {
+  METRICS_VALID = (1 << 0),
+  // All bytes are ASCII.
+  METRICS_ASCII = (1 << 1),
+  METRICS_TABS = (1 << 2),
+  // Contains ASCII control characters other than tab, including DEL.
+  METRICS_CONTROL = (1 << 3),
+  METRICS_WIDE = (1 << 4),
+  METRICS_ZERO_WIDTH = (1 << 5),
+};
+
+/* Lines of at least CHECKPOINT_MIN_LINE bytes keep a record of the screen column at roughly every
+   CHECKPOINT_INTERVAL bytes, such that column calculations don't have to start at the beginning of
+   the line. */
+#define CHECKPOINT_INTERVAL 4096
+#define CHECKPOINT_MIN_LINE 16384
+
+/* Single character insertions and deletions in lines of at least GAP_MIN_LINE bytes are done in a
+   gap in the buffer, to avoid moving the rest of the line for every key press. The gap is at least
+   GAP_MIN_SIZE bytes, or 1/GAP_LINE_FRACTION of the line. */
+#define GAP_MIN_LINE 4096
+#define GAP_MIN_SIZE 256
+#define GAP_LINE_FRACTION 64
+
+/* Read access to the text of a line without closing its gap. The gap is only opened at character
+   boundaries, so each character is stored contiguously. The view must not be used after the line
+   is modified, or its gap is closed or moved. */
+struct line_text_t {
+  const char *data;
+  text_pos_t data_size;
+  text_pos_t gap_start;
+  text_pos_t gap_size;
+
+  const char *ptr(text_pos_t pos) const {
+    return data + pos + (gap_size > 0 && pos >= gap_start ? gap_size : 0);
+  }
+  char operator[](text_pos_t pos) const { return *ptr(pos); }
+  text_pos_t size() const { return data_size - gap_size; }
+  // Returns the text from pos up to the gap or the end of the line, which is stored contiguously.
+  string_view from(text_pos_t pos) const {
+    text_pos_t end = gap_size > 0 && pos < gap_start ? gap_start : size();
+    return string_view(ptr(pos), end - pos);
+  }
+};
+
+/* Text of a line stored in a block of a text_line_t::pool_t, preceded by its length. Like
+   tiny_string_t::allocated_string_t, the text extends past the end of the struct. */
+struct pooled_text_t {
+  unsigned char size;
+  char data;
+};
+
+static const char *char_ptr(string_view str, text_pos_t pos) { return str.data() + pos; }
+static const char *char_ptr(const line_text_t &text, text_pos_t pos) { return text.ptr(pos); }
+
+/* Implementations of text_line_t::byte_width_from_first, width_at and adjust_position, for both
+   string_view and line_text_t. */
+static int codepoint_width(key_t key) {
+  int width = t3_utf8_wcwidth(static_cast<uint32_t>(key));
+  if (width < 0) {
+    width = key < 32 && key != '\t' ? 2 : 1;
+  }
+  return width;
+}
+
+template <class T>
+static int byte_width_from_first_in(const T &str, text_pos_t pos) {
+  switch (str[pos] & 0xF0) {
+    case 0xF0:
+      return 4;
+    case 0xE0:
+      return 3;
+    case 0xC0:
+    case 0xD0:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+template <class T>
+static int width_at_in(const T &str, text_pos_t pos) {
+  uint32_t c = t3_utf8_get(char_ptr(str, pos), nullptr);
+  if (is_conjoining_jamo_t(c) && pos > 0) {
+    do {
+      pos--;
+    } while (pos > 0 && (str[pos] & 0xc0) == 0x80);
+    c = t3_utf8_get(char_ptr(str, pos), nullptr);
+    if (is_conjoining_jamo_lv(c)) {
+      return 0;
+    }
+
+    if (is_conjoining_jamo_v(c) && pos > 0) {
+      do {
+        pos--;
+      } while (pos > 0 && (str[pos] & 0xc0) == 0x80);
+      c = t3_utf8_get(char_ptr(str, pos), nullptr);
+      if (is_conjoining_jamo_l(c)) {
+        return 0;
+      }
+    }
+    return 1;
+  } else if (is_conjoining_jamo_v(c) && pos > 0) {
+    do {
+      pos--;
+    } while (pos > 0 && (str[pos] & 0xc0) == 0x80);
+    c = t3_utf8_get(char_ptr(str, pos), nullptr);
+    return is_conjoining_jamo_l(c) ? 0 : 1;
+  }
+  return codepoint_width(c);
+}
+
+template <class T>
+static text_pos_t adjust_position_in(const T &str, text_pos_t pos, int adjust) {
+  if (adjust > 0) {
+    for (; adjust > 0 && pos < static_cast<text_pos_t>(str.size());
+         adjust -= (width_at_in(str, pos) ? 1 : 0)) {
+      pos += byte_width_from_first_in(str, pos);
+    }
+  } else if (adjust < 0) {
+    for (; adjust < 0 && pos > 0; adjust += (width_at_in(str, pos) ? 1 : 0)) {
+      do {
+        pos--;
+      } while (pos > 0 && (str[pos] & 0xc0) == 0x80);
+    }
+  } else {
+    while (pos > 0 && width_at_in(str, pos) == 0) {
+      do {
+        pos--;
+      } while (pos > 0 && (str[pos] & 0xc0) == 0x80);
+    }
+  }
+  return pos;
+}
+
+/* Data stored for a line by a line_metadata_cache_t. Each entry is part of two lists: the list of
+   entries for the line, and the list of entries of the cache, in order of last use. */
+struct line_metadata_entry_t {
+  struct lru_list_t {
+    line_metadata_entry_t *head = nullptr;
+    line_metadata_entry_t *tail = nullptr;
+    size_t size = 0;
+  };
+
+  lru_list_t *lru;
+  line_metadata_entry_t *lru_prev;
+  line_metadata_entry_t *lru_next;
+  // Pointer to the head of the list of entries of the line.
+  line_metadata_entry_t **line_entries;
+  line_metadata_entry_t *next_for_line;
+  std::unique_ptr<line_metadata_t> data;
+
+  void unlink_lru() {
+    (lru_prev == nullptr ? lru->head : lru_prev->lru_next) = lru_next;
+    (lru_next == nullptr ? lru->tail : lru_next->lru_prev) = lru_prev;
+  }
+
+  void push_lru_front() {
+    lru_prev = nullptr;
+    lru_next = lru->head;
+    (lru->head == nullptr ? lru->tail : lru->head->lru_prev) = this;
+    lru->head = this;
+  }
+
+  // Unlinks the entry from both lists, and deletes it.
+  void remove() {
+    unlink_lru();
+    --lru->size;
+    line_metadata_entry_t **ptr = line_entries;
+    while (*ptr != this) {
+      ptr = &(*ptr)->next_for_line;
+    }
+    *ptr = next_for_line;
+    delete this;
+  }
+};
+
+/* Table of the texts shared by lines created by an interning_text_line_factory_t. Each entry is
+   reference counted by the lines referring to it, and removed from the table when the last of
+   those is destroyed or modified. */
+struct text_line_t::intern_table_t {
+  struct entry_t {
+    std::string text;
+    size_t refs;
+    intern_table_t *table;
+  };
+  struct hash_t {
+    size_t operator()(string_view text) const {
+      return ModifiedXXHash(text.data(), text.size(), 0);
+    }
+  };
+
+  // The keys refer to the text of the entry, which is never modified.
+  std::unordered_map<string_view, entry_t *, hash_t> entries;
+  // Number of bytes in all entries, and the number of lines and bytes of text referring to them.
+  size_t unique_bytes = 0;
+  size_t line_count = 0;
+  size_t line_bytes = 0;
+
+  ~intern_table_t() {
+    ASSERT(entries.empty());
+    for (const std::pair<const string_view, entry_t *> &entry : entries) {
+      delete entry.second;
+    }
+  }
+
+  entry_t *acquire(string_view text) {
+    std::unordered_map<string_view, entry_t *, hash_t>::iterator iter = entries.find(text);
+    entry_t *entry;
+    if (iter != entries.end()) {
+      entry = iter->second;
+    } else {
+      entry = new entry_t{std::string(text.data(), text.size()), 0, this};
+      entries.emplace(string_view(entry->text), entry);
+      unique_bytes += text.size();
+    }
+    ++entry->refs;
+    ++line_count;
+    line_bytes += text.size();
+    return entry;
+  }
+
+  static entry_t *share(entry_t *entry) {
+    ++entry->refs;
+    ++entry->table->line_count;
+    entry->table->line_bytes += entry->text.size();
+    return entry;
+  }
+
+  static void release(entry_t *entry) {
+    intern_table_t *table = entry->table;
+    --table->line_count;
+    table->line_bytes -= entry->text.size();
+    if (--entry->refs == 0) {
+      table->entries.erase(string_view(entry->text));
+      table->unique_bytes -= entry->text.size();
+      delete entry;
+    }
+  }
+};
+
 struct text_line_t::implementation_t {
-  std::string buffer;
+  /* The bytes in [gap_start, gap_start + gap_size) of storage are not part of the text. The
+     single character editing functions, and painting and the screen position calculations, which
+     read the text through text(), work with the gap. Everything else should use buffer(), which
+     closes the gap first. */
+  mutable std::string storage;
+  mutable text_pos_t gap_start;
+  mutable text_pos_t gap_size;
+  /* Text used instead of storage if not nullptr. Lines allocated in a pool can store their text in
+     a block of the pool, other lines can share it with other lines through an intern table. Which
+     of the two is used is therefore determined by pool, which avoids a separate pointer for each.
+     Modifying the line requires copying the text to storage first, which is done by the non-const
+     buffer(). Reading pooled text through the const buffer() copies it to storage as well, but
+     keeps the block, as other threads may be reading it. */
+  union {
+    intern_table_t::entry_t *interned;
+    pooled_text_t *pooled;
+  };
   text_line_factory_t *factory;
+  // The pool this object was allocated from, or nullptr if it was allocated on the heap.
+  pool_t *pool;
+  // Entries for this line in line_metadata_cache_t's.
+  mutable line_metadata_entry_t *metadata;
   bool starts_with_combining;
 
+  /* Information about the contents of buffer(), calculated on first use. Must be reset by calling
+     content_changed whenever buffer() is modified. */
+  mutable int metrics;
+  /* Screen width of the whole line for tab size screen_width_tabsize, or -1 if unknown. It is
+     recorded by the calculations which happen to walk the whole line, rather than calculated
+     separately, such that an edit doesn't cause a scan of the whole line. */
+  mutable text_pos_t screen_width;
+  mutable int screen_width_tabsize;
+  /* Number of line_storage_t chunks referring to this line. Lines referred to by more than one
+     chunk are shared with a snapshot, and must not be modified. */
+  uint32_t shares;
+
+  /* The list in which the line is recorded while it has an open gap, and its index in the list.
+     Lines which are not part of a line_storage_t need not be recorded, as they are not shared. */
+  gap_list_t *gap_list;
+  mutable size_t gap_index;
+
+  /* Screen column at the start of the character at byte position pos, counted from the start of
+     the line. Only used for long lines, and only extended as far as required by the queries. */
+  struct checkpoint_t {
+    text_pos_t pos;
+    text_pos_t column;
+  };
+  // Allocated separately, to keep the size of short lines down.
+  struct checkpoint_index_t {
+    int tabsize;
+    std::vector<checkpoint_t> checkpoints;
+  };
+  mutable std::unique_ptr<checkpoint_index_t> checkpoint_index;
+
   implementation_t(text_line_factory_t *_factory)
-      : factory(_factory == nullptr ? &default_text_line_factory : _factory),
-        starts_with_combining(false) {}
+      : gap_start(0),
+        gap_size(0),
+        interned(nullptr),
+        factory(_factory == nullptr ? &default_text_line_factory : _factory),
+        pool(nullptr),
+        metadata(nullptr),
+        starts_with_combining(false),
+        metrics(0),
+        screen_width(-1),
+        screen_width_tabsize(0),
+        shares(1),
+        gap_list(nullptr),
+        gap_index(0) {}
+
+  ~implementation_t() {
+    drop_metadata();
+    if (gap_size > 0) {
+      forget_gap();
+    }
+    if (is_interned()) {
+      intern_table_t::release(interned);
+    }
+    if (is_pooled()) {
+      release_pooled();
+    }
+  }
+
+  void drop_metadata() {
+    while (metadata != nullptr) {
+      metadata->remove();
+    }
+  }
+
+  std::string &buffer() {
+    unshare_text();
+    close_gap();
+    return storage;
+  }
+  const std::string &buffer() const {
+    if (is_interned()) {
+      return interned->text;
+    }
+    if (is_pooled()) {
+      if (storage.empty()) {
+        storage.assign(&pooled->data, pooled->size);
+      }
+      return storage;
+    }
+    close_gap();
+    return storage;
+  }
+  // Returns the text like the const buffer(), but without copying pooled text.
+  string_view view() const {
+    if (is_pooled()) {
+      return string_view(&pooled->data, pooled->size);
+    }
+    return buffer();
+  }
+  text_pos_t size() const {
+    if (is_interned()) {
+      return interned->text.size();
+    }
+    return is_pooled() ? pooled->size : storage.size() - gap_size;
+  }
+  // Interned and pooled text never has a gap.
+  line_text_t text() const {
+    if (is_interned()) {
+      return line_text_t{interned->text.data(), static_cast<text_pos_t>(interned->text.size()), 0,
+                         0};
+    }
+    if (is_pooled()) {
+      return line_text_t{&pooled->data, pooled->size, 0, 0};
+    }
+    return line_text_t{storage.data(), static_cast<text_pos_t>(storage.size()), gap_start,
+                       gap_size};
+  }
+
+  // Make storage hold the text, if it is shared with other lines or stored in the pool.
+  void unshare_text() {
+    if (is_interned()) {
+      storage = interned->text;
+      intern_table_t::release(interned);
+      interned = nullptr;
+    } else if (is_pooled()) {
+      if (storage.empty()) {
+        storage.assign(&pooled->data, pooled->size);
+      }
+      release_pooled();
+    }
+  }
+  void release_pooled();
+
+  bool is_interned() const { return pool == nullptr && interned != nullptr; }
+  bool is_pooled() const { return pool != nullptr && pooled != nullptr; }
+
+  void close_gap() const {
+    if (gap_size > 0) {
+      storage.erase(gap_start, gap_size);
+      gap_size = 0;
+      forget_gap();
+    }
+  }
+  void remember_gap() const {
+    if (gap_list != nullptr) {
+      gap_index = gap_list->lines.size();
+      gap_list->lines.push_back(this);
+    }
+  }
+  void forget_gap() const {
+    if (gap_list != nullptr) {
+      std::vector<const implementation_t *> &lines = gap_list->lines;
+      ASSERT(gap_index < lines.size() && lines[gap_index] == this);
+      lines[gap_index] = lines.back();
+      lines[gap_index]->gap_index = gap_index;
+      lines.pop_back();
+    }
+  }
+  // Move the gap to pos, making sure it is at least size bytes.
+  void open_gap(text_pos_t pos, text_pos_t size);
+  bool use_gap() const { return gap_size > 0 || storage.size() >= GAP_MIN_LINE; }
+
+  /* Returns the text before pos, which only requires closing the gap if it is located before pos.
+   */
+  string_view text_before(text_pos_t pos) const {
+    if (gap_size > 0 && gap_start < pos) {
+      close_gap();
+    }
+    return text().from(0).substr(0, pos);
+  }
+
+  /* Must be called after modifying buffer(). The contents before pos must not have changed, which
+     allows keeping the checkpoints for that part of the line. */
+  void content_changed(text_pos_t pos = 0) {
+    metrics = 0;
+    screen_width = -1;
+    drop_metadata();
+    if (checkpoint_index != nullptr) {
+      std::vector<checkpoint_t> &checkpoints = checkpoint_index->checkpoints;
+      while (!checkpoints.empty() && checkpoints.back().pos > pos) {
+        checkpoints.pop_back();
+      }
+    }
+  }
+
+  /* Cheaper version of content_changed for inserting character c at pos, which updates the
+     metrics without scanning the whole line. */
+  void char_inserted(text_pos_t pos, key_t c) {
+    if (metrics & METRICS_VALID) {
+      if (c == '\t') {
+        metrics |= METRICS_TABS;
+      } else if (c < 32 || c == 127) {
+        metrics |= METRICS_CONTROL;
+      } else if (c >= 0x80) {
+        int width = key_width(c);
+        metrics &= ~METRICS_ASCII;
+        if (width == 0) {
+          metrics |= METRICS_ZERO_WIDTH;
+        } else if (width > 1) {
+          metrics |= METRICS_WIDE;
+        }
+      }
+    }
+    int saved_metrics = metrics;
+    content_changed(pos);
+    metrics = saved_metrics;
+  }
+
+  /* Cheaper version of content_changed for deleting characters at pos. The metrics are kept, which
+     means that the flags may refer to characters which are no longer in the line. This only
+     prevents the use of the fast paths, but never produces incorrect results. */
+  void chars_deleted(text_pos_t pos) {
+    int saved_metrics = metrics;
+    content_changed(pos);
+    metrics = saved_metrics;
+  }
+
+  int get_metrics() const {
+    if (!(metrics & METRICS_VALID)) {
+      metrics = calculate_metrics();
+    }
+    return metrics;
+  }
+
+  /* Returns whether the line consists only of printable ASCII characters and tabs. For such lines
+     each byte is a single character, and all characters except tab are one cell wide. */
+  bool is_simple() const {
+    return (get_metrics() & (METRICS_ASCII | METRICS_CONTROL)) == METRICS_ASCII;
+  }
+
+  /* Records width as the screen width of the whole line. Lines which start with a combining
+     character are skipped, because find_next_break_pos counts an extra column for them, which
+     also moves the tab stops. */
+  void set_screen_width(text_pos_t width, int tabsize) const {
+    if (!starts_with_combining) {
+      screen_width = width;
+      screen_width_tabsize = tabsize;
+    }
+  }
+
+  /* Returns whether the line is known to fit in length columns. Zero-width characters at the end
+     of the line are skipped together with the character before them by the break position
+     calculations, so those don't cause a break either. */
+  bool fits_in(text_pos_t length, int tabsize) const {
+    return screen_width >= 0 && screen_width_tabsize == tabsize && screen_width <= length &&
+           !starts_with_combining;
+  }
+
+  int calculate_metrics() const;
+
+  /* Returns the last checkpoint at or before byte position pos, which is also at or before screen
+     column column. If there is no such checkpoint, the start of the line is returned. Tabs are
+     counted as in calculate_screen_width. */
+  checkpoint_t find_checkpoint(text_pos_t pos, text_pos_t column, int tabsize) const;
+  void extend_checkpoints(text_pos_t pos, text_pos_t column, int tabsize) const;
+};
+
+int text_line_t::implementation_t::calculate_metrics() const {
+  int result = METRICS_VALID | METRICS_ASCII;
+  const line_text_t data = text();
+  const text_pos_t size = data.size();
+
+  for (text_pos_t i = 0; i < size;) {
+    unsigned char c = data[i];
+    if (c == '\t') {
+      result |= METRICS_TABS;
+      ++i;
+    } else if (c < 32 || c == 127) {
+      result |= METRICS_CONTROL;
+      ++i;
+    } else if (c < 0x80) {
+      ++i;
+    } else {
+      result &= ~METRICS_ASCII;
+      int width = width_at_in(data, i);
+      if (width == 0) {
+        result |= METRICS_ZERO_WIDTH;
+      } else if (width > 1) {
+        result |= METRICS_WIDE;
+      }
+      i += byte_width_from_first_in(data, i);
+    }
+  }
+  return result;
+}
+
+void text_line_t::implementation_t::open_gap(text_pos_t pos, text_pos_t size) {
+  unshare_text();
+  if (gap_size == 0 || gap_size < size) {
+    close_gap();
+    gap_size = std::max<text_pos_t>(
+        size, std::max<text_pos_t>(GAP_MIN_SIZE, storage.size() / GAP_LINE_FRACTION));
+    storage.insert(pos, gap_size, '\0');
+    remember_gap();
+  } else if (pos < gap_start) {
+    memmove(&storage[pos + gap_size], &storage[pos], gap_start - pos);
+  } else if (pos > gap_start) {
+    memmove(&storage[gap_start], &storage[gap_start + gap_size], pos - gap_start);
+  }
+  gap_start = pos;
+}
+
+text_line_t::implementation_t::checkpoint_t text_line_t::implementation_t::find_checkpoint(
+    text_pos_t pos, text_pos_t column, int tabsize) const {
+  checkpoint_t origin = {0, starts_with_combining ? 1 : 0};
+
+  if (size() < CHECKPOINT_MIN_LINE) {
+    return origin;
+  }
+
+  extend_checkpoints(pos, column, tabsize);
+  const std::vector<checkpoint_t> &checkpoints = checkpoint_index->checkpoints;
+  std::vector<checkpoint_t>::const_iterator iter =
+      std::partition_point(checkpoints.begin(), checkpoints.end(),
+                           [pos, column](const checkpoint_t &checkpoint) {
+                             return checkpoint.pos <= pos && checkpoint.column <= column;
+                           });
+  return iter == checkpoints.begin() ? origin : *(iter - 1);
+}
+
+void text_line_t::implementation_t::extend_checkpoints(text_pos_t pos, text_pos_t column,
+                                                       int tabsize) const {
+  if (checkpoint_index == nullptr) {
+    checkpoint_index.reset(new checkpoint_index_t);
+    checkpoint_index->tabsize = tabsize;
+  } else if (checkpoint_index->tabsize != tabsize) {
+    checkpoint_index->checkpoints.clear();
+    checkpoint_index->tabsize = tabsize;
+  }
+  std::vector<checkpoint_t> &checkpoints = checkpoint_index->checkpoints;
+
+  text_pos_t i = 0, total = starts_with_combining ? 1 : 0;
+  if (!checkpoints.empty()) {
+    i = checkpoints.back().pos;
+    total = checkpoints.back().column;
+  }
+
+  const line_text_t data = text();
+  const text_pos_t end = std::min<text_pos_t>(pos, data.size());
+  while (i + CHECKPOINT_INTERVAL <= end && total <= column) {
+    const text_pos_t next = i + CHECKPOINT_INTERVAL;
+    while (i < next) {
+      if (data[i] == '\t') {
+        total += tabsize > 0 ? tabsize - (total % tabsize) : 2;
+      } else {
+        total += width_at_in(data, i);
+      }
+      i += byte_width_from_first_in(data, i);
+    }
+    checkpoints.push_back({i, total});
+  }
+}
+
+/* Lines allocated by pooled_text_line_factory_t and their implementation_t objects are carved out
+   of slabs of POOL_SLAB_SIZE bytes. */
+#define POOL_SLAB_SIZE (64 * 1024)
+/* Text of POOL_MIN_TEXT_LENGTH up to POOL_MAX_TEXT_LENGTH bytes is stored in the slabs as well, in
+   blocks of a multiple of POOL_TEXT_GRANULARITY bytes. Shorter text does not require a separate
+   allocation, as std::string stores it in the object itself. */
+#define POOL_MIN_TEXT_LENGTH 16
+#define POOL_MAX_TEXT_LENGTH 255
+#define POOL_TEXT_GRANULARITY 8
+
+struct text_line_t::pool_t {
+  // Allocator for blocks of a single size. Freed blocks are kept in a list for reuse.
+  class block_allocator_t {
+   public:
+    block_allocator_t(pool_t *pool, size_t block_size)
+        : pool_(pool),
+          block_size_(block_size),
+          free_list_(nullptr),
+          next_(nullptr),
+          end_(nullptr) {}
+
+    void *allocate() {
+      if (free_list_ != nullptr) {
+        free_block_t *block = free_list_;
+        free_list_ = block->next;
+        return block;
+      }
+      if (static_cast<size_t>(end_ - next_) < block_size_) {
+        next_ = pool_->new_slab();
+        end_ = next_ + POOL_SLAB_SIZE;
+      }
+      void *block = next_;
+      next_ += block_size_;
+      return block;
+    }
+
+    void deallocate(void *ptr) {
+      free_block_t *block = static_cast<free_block_t *>(ptr);
+      block->next = free_list_;
+      free_list_ = block;
+    }
+
+   private:
+    struct free_block_t {
+      free_block_t *next;
+    };
+
+    pool_t *pool_;
+    const size_t block_size_;
+    free_block_t *free_list_;
+    char *next_;
+    char *end_;
+  };
+
+  static size_t round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  pool_t();
+
+  char *new_slab() {
+    slabs.emplace_back(new char[POOL_SLAB_SIZE]);
+    return slabs.back().get();
+  }
+
+  static size_t text_class(size_t length) {
+    return (offsetof(pooled_text_t, data) + length - 1) / POOL_TEXT_GRANULARITY;
+  }
+
+  pooled_text_t *allocate_text(string_view text) {
+    pooled_text_t *block = static_cast<pooled_text_t *>(texts[text_class(text.size())].allocate());
+    block->size = text.size();
+    memcpy(&block->data, text.data(), text.size());
+    return block;
+  }
+  void deallocate_text(pooled_text_t *block) { texts[text_class(block->size)].deallocate(block); }
+
+  std::vector<std::unique_ptr<char[]>> slabs;
+  block_allocator_t lines;
+  block_allocator_t impls;
+  // Allocators for the text blocks, indexed by text_class.
+  std::vector<block_allocator_t> texts;
+};
+
+/* text_line_t allocated in a pool_t. Each block starts with a pointer to the pool, such that the
+   memory can be returned to the pool when the line is deleted. */
+class text_line_t::pooled_line_t final : public text_line_t {
+ public:
+  pooled_line_t(text_line_factory_t *factory, pool_t *pool) : text_line_t(factory, pool) {}
+
+  static constexpr size_t header_size() {
+    return (sizeof(pool_t *) + alignof(pooled_line_t) - 1) / alignof(pooled_line_t) *
+           alignof(pooled_line_t);
+  }
+
+  static void *operator new(size_t size, pool_t *pool) {
+    ASSERT(size == sizeof(pooled_line_t));
+    (void)size;
+    char *block = static_cast<char *>(pool->lines.allocate());
+    *reinterpret_cast<pool_t **>(block) = pool;
+    return block + header_size();
+  }
+  static void operator delete(void *ptr) {
+    char *block = static_cast<char *>(ptr) - header_size();
+    (*reinterpret_cast<pool_t **>(block))->lines.deallocate(block);
+  }
+  // Only used when the constructor throws an exception.
+  static void operator delete(void *ptr, pool_t *pool) {
+    (void)pool;
+    operator delete(ptr);
+  }
 };
 
+text_line_t::pool_t::pool_t()
+    : lines(this, round_up(pooled_line_t::header_size() + sizeof(pooled_line_t),
+                           alignof(pooled_line_t))),
+      impls(this, round_up(sizeof(implementation_t), alignof(implementation_t))) {
+  static_assert(POOL_MAX_TEXT_LENGTH <= std::numeric_limits<unsigned char>::max(),
+                "length of pooled text must fit in pooled_text_t::size");
+  size_t classes = text_class(POOL_MAX_TEXT_LENGTH) + 1;
+  texts.reserve(classes);
+  for (size_t i = 0; i < classes; ++i) {
+    texts.emplace_back(this, (i + 1) * POOL_TEXT_GRANULARITY);
+  }
+}
+
+void text_line_t::implementation_t::release_pooled() {
+  pool->deallocate_text(pooled);
+  pooled = nullptr;
+}
+
+void text_line_t::impl_deleter_t::operator()(implementation_t *impl) const {
+  pool_t *pool = impl->pool;
+  if (pool == nullptr) {
+    delete impl;
+    return;
+  }
+  impl->~implementation_t();
+  pool->impls.deallocate(impl);
+}
+
 text_line_t::text_line_t(int buffersize, text_line_factory_t *factory)
     : impl(new implementation_t(factory)) {
   reserve(buffersize);
 }
 
+text_line_t::text_line_t(text_line_factory_t *factory, pool_t *pool)
+    : impl(new (pool->impls.allocate()) implementation_t(factory)) {
+  impl->pool = pool;
+}
+
 text_line_t::~text_line_t() {}
 
 void text_line_t::fill_line(string_view _buffer) {
@@ -90,13 +842,23 @@ void text_line_t::fill_line(string_view _buffer) {
   reserve(_buffer.size());
 
   while (!_buffer.empty()) {
+    // Valid UTF-8 survives the round trip below unchanged, so it can be copied in one go.
+    size_t valid_bytes = utf8_valid_prefix(_buffer.data(), _buffer.size());
+    impl->buffer().append(_buffer.data(), valid_bytes);
+    _buffer.remove_prefix(valid_bytes);
+    if (_buffer.empty()) {
+      break;
+    }
+
+    // Replace the invalid sequence by passing it through the UTF-8 decoder and encoder.
     char_bytes = _buffer.size();
     next = t3_utf8_get(_buffer.data(), &char_bytes);
     round_trip_bytes = t3_utf8_put(next, byte_buffer);
-    impl->buffer.append(byte_buffer, round_trip_bytes);
+    impl->buffer().append(byte_buffer, round_trip_bytes);
     _buffer.remove_prefix(char_bytes);
   }
-  impl->starts_with_combining = impl->buffer.size() > 0 && width_at(0) == 0;
+  impl->content_changed(0);
+  impl->starts_with_combining = impl->buffer().size() > 0 && width_at(0) == 0;
 }
 
 text_line_t::text_line_t(string_view buffer, text_line_factory_t *factory)
@@ -105,19 +867,22 @@ text_line_t::text_line_t(string_view buffer, text_line_factory_t *factory)
 }
 
 void text_line_t::set_text(string_view buffer) {
-  impl->buffer.clear();
+  impl->buffer().clear();
   fill_line(buffer);
 }
 
 /* Merge line2 into line1, freeing line2 */
 void text_line_t::merge(std::unique_ptr<text_line_t> other) {
-  if (impl->buffer.empty() && other->impl->starts_with_combining) {
-    impl->starts_with_combining = true;
+  if (impl->buffer().empty()) {
+    impl->starts_with_combining = other->impl->starts_with_combining;
   }
 
-  reserve(impl->buffer.size() + other->impl->buffer.size());
+  reserve(impl->buffer().size() + other->size());
 
-  impl->buffer += other->impl->buffer;
+  text_pos_t merge_pos = impl->buffer().size();
+  string_view other_text = other->impl->view();
+  impl->buffer().append(other_text.data(), other_text.size());
+  impl->content_changed(merge_pos);
 }
 
 /* Break up 'line' at position 'pos'. This means that the character at 'pos'
@@ -127,44 +892,52 @@ std::unique_ptr<text_line_t> text_line_t::break_line(t3widget::text_pos_t pos) {
   std::unique_ptr<text_line_t> newline;
 
   // FIXME: cut_line and break_line are very similar. Maybe we should combine them!
-  if (static_cast<size_t>(pos) == impl->buffer.size()) {
+  if (static_cast<size_t>(pos) == impl->buffer().size()) {
     return impl->factory->new_text_line_t();
   }
 
   /* Only allow line breaks at non-combining marks. This doesn't use width_at, because
      conjoining Jamo will make it return 0, but we need to allow them to be split. */
-  ASSERT(t3_utf8_wcwidth(t3_utf8_get(impl->buffer.data() + pos, nullptr)));
+  ASSERT(t3_utf8_wcwidth(t3_utf8_get(impl->buffer().data() + pos, nullptr)));
 
   /* copy the right part of the string into the new buffer */
-  newline = impl->factory->new_text_line_t(impl->buffer.size() - pos);
-  newline->impl->buffer.assign(impl->buffer.data() + pos, impl->buffer.size() - pos);
+  newline = impl->factory->new_text_line_t(impl->buffer().size() - pos);
+  newline->impl->buffer().assign(impl->buffer().data() + pos, impl->buffer().size() - pos);
+  newline->impl->content_changed(0);
 
-  impl->buffer.resize(pos);
+  impl->buffer().resize(pos);
+  impl->content_changed(pos);
+  if (pos == 0) {
+    impl->starts_with_combining = false;
+  }
   return newline;
 }
 
 std::unique_ptr<text_line_t> text_line_t::cut_line(text_pos_t start, text_pos_t end) {
   std::unique_ptr<text_line_t> retval;
 
-  ASSERT(static_cast<size_t>(end) == impl->buffer.size() ||
-         t3_utf8_wcwidth(t3_utf8_get(impl->buffer.data() + end, nullptr)) != 0);
+  ASSERT(static_cast<size_t>(end) == impl->buffer().size() ||
+         t3_utf8_wcwidth(t3_utf8_get(impl->buffer().data() + end, nullptr)) != 0);
   // FIXME: special case: if the selection cover a whole text_line_t (note: not wrapped) we
   // shouldn't copy
 
   retval = clone(start, end);
 
-  impl->buffer.erase(start, (end - start));
-  impl->starts_with_combining = !impl->buffer.empty() && width_at(0) == 0;
+  impl->buffer().erase(start, (end - start));
+  impl->content_changed(start);
+  impl->starts_with_combining = !impl->buffer().empty() && width_at(0) == 0;
 
   return retval;
 }
 
 std::unique_ptr<text_line_t> text_line_t::clone(text_pos_t start, text_pos_t end) {
+  // Only read through view, as the non-const buffer() stops sharing the text with other lines.
+  string_view text = impl->view();
   if (end == -1) {
-    end = impl->buffer.size();
+    end = text.size();
   }
 
-  ASSERT(static_cast<size_t>(end) <= impl->buffer.size());
+  ASSERT(static_cast<size_t>(end) <= text.size());
   ASSERT(start >= 0);
   ASSERT(start <= end);
 
@@ -172,42 +945,62 @@ std::unique_ptr<text_line_t> text_line_t::clone(text_pos_t start, text_pos_t end
     return impl->factory->new_text_line_t(0);
   }
 
+  if (impl->is_interned() && start == 0 && static_cast<size_t>(end) == text.size()) {
+    std::unique_ptr<text_line_t> retval = impl->factory->new_text_line_t(0);
+    retval->impl->interned = intern_table_t::share(impl->interned);
+    retval->impl->starts_with_combining = impl->starts_with_combining;
+    return retval;
+  }
+  if (impl->is_pooled() && start == 0 && end == impl->pooled->size) {
+    std::unique_ptr<text_line_t> retval = impl->factory->new_text_line_t(0);
+    retval->impl->pooled = retval->impl->pool->allocate_text(text);
+    retval->impl->starts_with_combining = impl->starts_with_combining;
+    return retval;
+  }
+
   std::unique_ptr<text_line_t> retval = impl->factory->new_text_line_t((end - start));
 
-  retval->impl->buffer.assign(impl->buffer.data() + start, (end - start));
+  retval->impl->buffer().assign(text.data() + start, (end - start));
+  retval->impl->content_changed(0);
   retval->impl->starts_with_combining = width_at(start) == 0;
 
   return retval;
 }
 
 std::unique_ptr<text_line_t> text_line_t::break_on_nl(text_pos_t *startFrom) {
+  string_view text = impl->view();
   text_pos_t i;
 
-  for (i = *startFrom; static_cast<size_t>(i) < impl->buffer.size(); i++) {
-    if (impl->buffer[i] == '\n') {
+  for (i = *startFrom; static_cast<size_t>(i) < text.size(); i++) {
+    if (text[i] == '\n') {
       break;
     }
   }
 
   std::unique_ptr<text_line_t> retval = clone(*startFrom, i);
 
-  *startFrom = static_cast<size_t>(i) == impl->buffer.size() ? -1 : i + 1;
+  *startFrom = static_cast<size_t>(i) == text.size() ? -1 : i + 1;
   return retval;
 }
 
 void text_line_t::insert(std::unique_ptr<text_line_t> other, t3widget::text_pos_t pos) {
-  ASSERT(pos >= 0 && static_cast<size_t>(pos) <= impl->buffer.size());
+  ASSERT(pos >= 0 && static_cast<size_t>(pos) <= impl->buffer().size());
 
-  reserve(impl->buffer.size() + other->impl->buffer.size());
-  impl->buffer.insert(pos, other->impl->buffer);
+  reserve(impl->buffer().size() + other->size());
+  string_view other_text = other->impl->view();
+  impl->buffer().insert(pos, other_text.data(), other_text.size());
+  impl->content_changed(pos);
   if (pos == 0) {
     impl->starts_with_combining = other->impl->starts_with_combining;
   }
 }
 
 void text_line_t::minimize() {
+  if (impl->is_interned() || impl->is_pooled()) {
+    return;
+  }
 #ifdef HAS_STRING_SHRINK_TO_FIT
-  impl->buffer.shrink_to_fit();
+  impl->buffer().shrink_to_fit();
 #else
   reserve(0);
 #endif
@@ -217,21 +1010,51 @@ void text_line_t::minimize() {
 /* tabsize == 0 -> tab as control */
 text_pos_t text_line_t::calculate_screen_width(text_pos_t start, text_pos_t pos,
                                                int tabsize) const {
-  text_pos_t i, total = 0;
+  text_pos_t i = start, total = 0;
 
-  if (impl->starts_with_combining && start == 0 && pos > 0) {
-    total++;
+  if (start >= pos) {
+    return 0;
   }
 
-  for (i = start; static_cast<size_t>(i) < impl->buffer.size() && i < pos;
-       i += byte_width_from_first(i)) {
-    if (impl->buffer[i] == '\t') {
-      total += tabsize > 0 ? tabsize - (total % tabsize) : 2;
-    } else {
-      total += width_at(i);
+  if (start == 0) {
+    implementation_t::checkpoint_t checkpoint =
+        impl->find_checkpoint(pos, std::numeric_limits<text_pos_t>::max(), tabsize);
+    i = checkpoint.pos;
+    total = checkpoint.column;
+  }
+
+  const line_text_t text = impl->text();
+  if (impl->is_simple()) {
+    const text_pos_t end_pos = std::min<text_pos_t>(pos, text.size());
+    // The text before and after the gap are handled as separate parts.
+    while (i < end_pos) {
+      string_view part = text.from(i).substr(0, end_pos - i);
+      const char *ptr = part.data();
+      const char *end = ptr + part.size();
+      if (impl->get_metrics() & METRICS_TABS) {
+        const char *tab;
+        while ((tab = static_cast<const char *>(memchr(ptr, '\t', end - ptr))) != nullptr) {
+          total += tab - ptr;
+          total += tabsize > 0 ? tabsize - (total % tabsize) : 2;
+          ptr = tab + 1;
+        }
+      }
+      total += end - ptr;
+      i += part.size();
+    }
+  } else {
+    for (; i < text.size() && i < pos; i += byte_width_from_first(i)) {
+      if (text[i] == '\t') {
+        total += tabsize > 0 ? tabsize - (total % tabsize) : 2;
+      } else {
+        total += width_at(i);
+      }
     }
   }
 
+  if (start == 0 && pos >= text.size()) {
+    impl->set_screen_width(total, tabsize);
+  }
   return total;
 }
 
@@ -245,13 +1068,51 @@ text_pos_t text_line_t::calculate_line_pos(text_pos_t start, text_pos_t max, tex
     return start;
   }
 
+  /* Columns in the checkpoints include the extra column for a leading combining character, but
+     the calculation below ignores it for the tab positions. */
+  if (start == 0 && tabsize > 0 && !impl->starts_with_combining) {
+    implementation_t::checkpoint_t checkpoint = impl->find_checkpoint(max, pos, tabsize);
+    start = checkpoint.pos;
+    total = checkpoint.column;
+  }
+
+  const line_text_t text = impl->text();
+  if (impl->is_simple() && tabsize > 0) {
+    const text_pos_t end_pos = std::min(max, size());
+    // The text before and after the gap are handled as separate parts.
+    for (i = start; i < end_pos;) {
+      string_view part = text.from(i).substr(0, end_pos - i);
+      const char *ptr = part.data();
+      const char *end = ptr + part.size();
+      while (ptr < end) {
+        const char *tab = (impl->get_metrics() & METRICS_TABS)
+                              ? static_cast<const char *>(memchr(ptr, '\t', end - ptr))
+                              : nullptr;
+        const char *run_end = tab == nullptr ? end : tab;
+        if (total + (run_end - ptr) > pos) {
+          return i + (ptr - part.data()) + (pos - total);
+        }
+        total += run_end - ptr;
+        if (tab == nullptr) {
+          break;
+        }
+        total += tabsize - (total % tabsize);
+        if (total > pos) {
+          return i + (tab - part.data());
+        }
+        ptr = tab + 1;
+      }
+      i += part.size();
+    }
+    return end_pos;
+  }
+
   if (start == 0 && impl->starts_with_combining) {
     pos--;
   }
 
-  for (i = start; static_cast<size_t>(i) < impl->buffer.size() && i < max;
-       i += byte_width_from_first(i)) {
-    if (impl->buffer[i] == '\t') {
+  for (i = start; i < text.size() && i < max; i += byte_width_from_first(i)) {
+    if (text[i] == '\t') {
       total += tabsize - (total % tabsize);
     } else {
       total += width_at(i);
@@ -326,21 +1187,39 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
     return;
   }
 
-  if (impl->starts_with_combining && info.leftcol > 0 && info.start == 0) {
-    total++;
+  const line_text_t text = impl->text();
+  const text_pos_t buffer_size = text.size();
+
+  text_pos_t i = info.start;
+  if (info.leftcol > 0 && info.start == 0) {
+    // This also accounts for the extra column taken by a leading combining character.
+    implementation_t::checkpoint_t checkpoint = impl->find_checkpoint(
+        info.max, info.leftcol, (flags & text_line_t::TAB_AS_CONTROL) ? 0 : info.tabsize);
+    i = checkpoint.pos;
+    total = checkpoint.column;
+    if (i > 0) {
+      selection_attr = get_draw_attrs(adjust_position(i, -1), info);
+    }
   }
 
-  const size_t buffer_size = impl->buffer.size();
-  const char *buffer_data = impl->buffer.data();
-
-  text_pos_t i;
-  for (i = info.start; static_cast<size_t>(i) < buffer_size && i < info.max && total < info.leftcol;
+  /* On lines without tabs or special characters, each byte takes up exactly one cell. Skip the
+     part before leftcol in one step. */
+  if (info.leftcol > 0 && impl->is_simple() && !(impl->get_metrics() & METRICS_TABS)) {
+    text_pos_t skip =
+        std::min(info.leftcol - total, std::min<text_pos_t>(info.max, buffer_size) - i);
+    if (skip > 0) {
+      i += skip;
+      total += skip;
+      selection_attr = get_draw_attrs(i - 1, info);
+    }
+  }
+  for (; i < buffer_size && i < info.max && total < info.leftcol;
        i += byte_width_from_first(i)) {
     if (width_at(i) != 0) {
       selection_attr = get_draw_attrs(i, info);
     }
 
-    if (buffer_data[i] == '\t' && !(flags & text_line_t::TAB_AS_CONTROL)) {
+    if (text[i] == '\t' && !(flags & text_line_t::TAB_AS_CONTROL)) {
       tabspaces = info.tabsize - (total % info.tabsize);
       total += tabspaces;
       if (total >= size) {
@@ -357,11 +1236,11 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
           win->addnstr(spaces, (total - info.leftcol), selection_attr);
         }
       }
-    } else if (static_cast<unsigned char>(buffer_data[i]) < 32) {
+    } else if (static_cast<unsigned char>(text[i]) < 32) {
       total += 2;
       // If total > info.leftcol than only the right side character is visible
       if (total > info.leftcol) {
-        win->addch(control_map[static_cast<int>(buffer_data[i])],
+        win->addch(control_map[static_cast<int>(text[i])],
                    t3_term_combine_attrs(attributes.non_print, selection_attr));
       }
     } else if (width_at(i) > 1) {
@@ -377,6 +1256,23 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
   }
 
   text_pos_t print_from, accumulated = 0;
+  // Paints the printable characters in [from, to), which may be interrupted by the gap.
+  auto paint_text = [win, &text](text_pos_t from, text_pos_t to, t3_attr_t attr) {
+    string_view part = text.from(from);
+    if (static_cast<size_t>(to - from) > part.size()) {
+      paint_part(win, part.data(), part.size(), true, attr);
+      from += part.size();
+    }
+    paint_part(win, text.ptr(from), to - from, true, attr);
+  };
+  // Paints the characters from print_from up to i.
+  auto paint_pending = [&]() {
+    if (_is_print) {
+      paint_text(print_from, i, selection_attr);
+    } else {
+      paint_part(win, nullptr, accumulated, false, selection_attr);
+    }
+  };
   if (impl->starts_with_combining && info.leftcol == 0 && info.start == 0) {
     selection_attr = get_draw_attrs(0, info);
     paint_part(win, " ", 1, true, t3_term_combine_attrs(attributes.non_print, selection_attr));
@@ -384,18 +1280,17 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
     print_from = i;
 
     /* Find the first non-zero-width char, and paint all zero-width chars now. */
-    while (static_cast<size_t>(i) < buffer_size && i < info.max && width_at(i) == 0) {
+    while (i < buffer_size && i < info.max && width_at(i) == 0) {
       i += byte_width_from_first(i);
     }
 
     /* Note that non-printable characters will be discarded by libt3window. Thus
        we don't have to filter for them here. */
-    paint_part(win, buffer_data + print_from, i - print_from, true,
-               t3_term_combine_attrs(attributes.non_print, selection_attr));
+    paint_text(print_from, i, t3_term_combine_attrs(attributes.non_print, selection_attr));
     total++;
   } else {
     /* Skip to first non-zero-width char */
-    while (static_cast<size_t>(i) < buffer_size && i < info.max && width_at(i) == 0) {
+    while (i < buffer_size && i < info.max && width_at(i) == 0) {
       i += byte_width_from_first(i);
     }
   }
@@ -403,7 +1298,7 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
   _is_print = is_print(i);
   print_from = i;
   new_selection_attr = selection_attr;
-  for (; static_cast<size_t>(i) < buffer_size && i < info.max && total + accumulated < size;
+  for (; i < buffer_size && i < info.max && total + accumulated < size;
        i += byte_width_from_first(i)) {
     if (width_at(i) != 0) {
       new_selection_attr = get_draw_attrs(i, info);
@@ -412,8 +1307,7 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
     /* If selection changed between this char and the previous, print what
        we had so far. */
     if (new_selection_attr != selection_attr) {
-      paint_part(win, buffer_data + print_from, _is_print ? i - print_from : accumulated, _is_print,
-                 selection_attr);
+      paint_pending();
       total += accumulated;
       accumulated = 0;
       print_from = i;
@@ -421,10 +1315,9 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
     selection_attr = new_selection_attr;
 
     new_is_print = is_print(i);
-    if (buffer_data[i] == '\t' && !(flags & text_line_t::TAB_AS_CONTROL)) {
+    if (text[i] == '\t' && !(flags & text_line_t::TAB_AS_CONTROL)) {
       /* Calculate the correct number of spaces for a tab character. */
-      paint_part(win, buffer_data + print_from, _is_print ? i - print_from : accumulated, _is_print,
-                 selection_attr);
+      paint_pending();
       total += accumulated;
       accumulated = 0;
       tabspaces = info.tabsize - (total % info.tabsize);
@@ -454,24 +1347,22 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
       }
       total += tabspaces;
       print_from = i + 1;
-    } else if (static_cast<unsigned char>(buffer_data[i]) < 32) {
+    } else if (static_cast<unsigned char>(text[i]) < 32) {
       /* Print control characters as ^ followed by a letter indicating the control char. */
-      paint_part(win, buffer_data + print_from, _is_print ? i - print_from : accumulated, _is_print,
-                 selection_attr);
+      paint_pending();
       total += accumulated;
       accumulated = 0;
       win->addch('^', t3_term_combine_attrs(attributes.non_print, selection_attr));
       total += 2;
       if (total <= size) {
-        win->addch(control_map[static_cast<int>(buffer_data[i])],
+        win->addch(control_map[static_cast<int>(text[i])],
                    t3_term_combine_attrs(attributes.non_print, selection_attr));
       }
       print_from = i + 1;
     } else if (_is_print != new_is_print) {
       /* Print part of the buffer as either printable or control characters, because
          the next character is in the other category. */
-      paint_part(win, buffer_data + print_from, _is_print ? i - print_from : accumulated, _is_print,
-                 selection_attr);
+      paint_pending();
       total += accumulated;
       accumulated = width_at(i);
       print_from = i;
@@ -485,12 +1376,11 @@ void text_line_t::paint_line(t3window::window_t *win, const text_line_t::paint_i
     }
     _is_print = new_is_print;
   }
-  while (static_cast<size_t>(i) < buffer_size && i < info.max && width_at(i) == 0) {
+  while (i < buffer_size && i < info.max && width_at(i) == 0) {
     i += byte_width_from_first(i);
   }
 
-  paint_part(win, buffer_data + print_from, _is_print ? i - print_from : accumulated, _is_print,
-             selection_attr);
+  paint_pending();
   total += accumulated;
 
   if ((flags & text_line_t::PARTIAL_CHAR) && i >= info.max) {
@@ -541,15 +1431,21 @@ text_line_t::break_pos_t text_line_t::find_next_break_pos(text_pos_t start, text
   break_pos_t possible_break = {start, 0};
   bool graph_seen = false, last_was_graph = false;
 
+  // Most lines fit completely, which the width of the line recorded earlier tells us.
+  if (start == 0 && impl->fits_in(length, tabsize)) {
+    possible_break.flags = 0;
+    possible_break.pos = -1;
+    return possible_break;
+  }
+
   if (impl->starts_with_combining && start == 0) {
     total++;
   }
 
-  const size_t buffer_size = impl->buffer.size();
-  const char *buffer_data = impl->buffer.data();
-  for (i = start; static_cast<size_t>(i) < buffer_size && total < length;
-       i = adjust_position(i, 1)) {
-    if (buffer_data[i] == '\t') {
+  const line_text_t text = impl->text();
+  const text_pos_t buffer_size = text.size();
+  for (i = start; i < buffer_size && total < length; i = adjust_position(i, 1)) {
+    if (text[i] == '\t') {
       total += tabsize > 0 ? tabsize - (total % tabsize) : 2;
     } else {
       total += width_at(i);
@@ -562,8 +1458,8 @@ text_line_t::break_pos_t text_line_t::find_next_break_pos(text_pos_t start, text
       break;
     }
 
-    int cclass = get_class(impl->buffer, i);
-    if (buffer_data[i] < 32 && (buffer_data[i] != '\t' || tabsize == 0)) {
+    int cclass = get_class(text.from(i), 0);
+    if (text[i] < 32 && (text[i] != '\t' || tabsize == 0)) {
       cclass = CLASS_GRAPH;
     }
 
@@ -581,18 +1477,104 @@ text_line_t::break_pos_t text_line_t::find_next_break_pos(text_pos_t start, text
     }
   }
 
-  if (static_cast<size_t>(i) < buffer_size) {
+  if (i < buffer_size) {
     if (possible_break.pos == start) {
       possible_break.pos = i;
     }
     possible_break.flags |= text_line_t::BREAK;
     return possible_break;
   }
+  if (start == 0) {
+    impl->set_screen_width(total, tabsize);
+  }
   possible_break.flags = 0;
   possible_break.pos = -1;
   return possible_break;
 }
 
+text_line_t::break_pos_t text_line_t::find_next_char_break_pos(text_pos_t start,
+                                                               text_pos_t length,
+                                                               int tabsize) const {
+  text_pos_t i = start, total = 0;
+  break_pos_t result = {-1, 0};
+
+  if (start == 0 && impl->fits_in(length, tabsize)) {
+    return result;
+  }
+
+  const line_text_t text = impl->text();
+  const text_pos_t buffer_size = text.size();
+  if (impl->is_simple()) {
+    /* Every character is one cell wide, except for tabs. Without tabs, the break position can
+       therefore be calculated directly. The text before and after the gap are handled as separate
+       parts. */
+    bool found = false;
+    for (text_pos_t part_start = start; !found && part_start < buffer_size;) {
+      string_view part = text.from(part_start);
+      const char *ptr = part.data();
+      const char *end = ptr + part.size();
+      while (ptr < end) {
+        const char *tab = (impl->get_metrics() & METRICS_TABS)
+                              ? static_cast<const char *>(memchr(ptr, '\t', end - ptr))
+                              : nullptr;
+        const char *run_end = tab == nullptr ? end : tab;
+        if (total + (run_end - ptr) > length) {
+          i = part_start + (ptr - part.data()) + (length - total);
+          found = true;
+          break;
+        }
+        total += run_end - ptr;
+        if (tab == nullptr) {
+          break;
+        }
+        total += tabsize > 0 ? tabsize - (total % tabsize) : 2;
+        if (total > length) {
+          i = part_start + (tab - part.data());
+          found = true;
+          break;
+        }
+        ptr = tab + 1;
+      }
+      part_start += part.size();
+    }
+    if (!found) {
+      if (start == 0) {
+        impl->set_screen_width(total, tabsize);
+      }
+      return result;
+    }
+  } else {
+    if (impl->starts_with_combining && start == 0) {
+      total++;
+    }
+    for (i = start; i < buffer_size && total < length; i = adjust_position(i, 1)) {
+      if (text[i] == '\t') {
+        total += tabsize > 0 ? tabsize - (total % tabsize) : 2;
+      } else {
+        total += width_at(i);
+      }
+      if (total > length) {
+        break;
+      }
+    }
+    if (start == 0 && i >= buffer_size) {
+      impl->set_screen_width(total, tabsize);
+    }
+  }
+
+  if (i == start) {
+    result.flags = text_line_t::PARTIAL_CHAR;
+    i = adjust_position(i, 1);
+  }
+  if (i < buffer_size) {
+    result.pos = i;
+    result.flags |= text_line_t::BREAK;
+  } else {
+    result.flags = 0;
+  }
+  return result;
+}
+
 text_pos_t text_line_t::get_next_word(text_pos_t start) const {
   text_pos_t i;
   int cclass, newCclass;
@@ -601,18 +1583,18 @@ text_pos_t text_line_t::get_next_word(text_pos_t start) const {
     start = 0;
     cclass = CLASS_WHITESPACE;
   } else {
-    cclass = get_class(impl->buffer, start);
+    cclass = get_class(impl->view(), start);
     start = adjust_position(start, 1);
   }
 
   for (i = start;
-       static_cast<size_t>(i) < impl->buffer.size() &&
-       ((newCclass = get_class(impl->buffer, i)) == cclass || newCclass == CLASS_WHITESPACE);
+       static_cast<size_t>(i) < impl->view().size() &&
+       ((newCclass = get_class(impl->view(), i)) == cclass || newCclass == CLASS_WHITESPACE);
        i = adjust_position(i, 1)) {
     cclass = newCclass;
   }
 
-  return static_cast<size_t>(i) >= impl->buffer.size() ? -1 : i;
+  return static_cast<size_t>(i) >= impl->view().size() ? -1 : i;
 }
 
 text_pos_t text_line_t::get_previous_word(text_pos_t start) const {
@@ -621,13 +1603,13 @@ text_pos_t text_line_t::get_previous_word(text_pos_t start) const {
   }
 
   if (start < 0) {
-    start = impl->buffer.size();
+    start = impl->view().size();
   }
 
   text_pos_t i;
   int cclass = CLASS_WHITESPACE;
   for (i = adjust_position(start, -1);
-       i > 0 && (cclass = get_class(impl->buffer, i)) == CLASS_WHITESPACE;
+       i > 0 && (cclass = get_class(impl->view(), i)) == CLASS_WHITESPACE;
        i = adjust_position(i, -1)) {
   }
 
@@ -637,12 +1619,12 @@ text_pos_t text_line_t::get_previous_word(text_pos_t start) const {
 
   text_pos_t savePos = i;
 
-  for (i = adjust_position(i, -1); i > 0 && get_class(impl->buffer, i) == cclass;
+  for (i = adjust_position(i, -1); i > 0 && get_class(impl->view(), i) == cclass;
        i = adjust_position(i, -1)) {
     savePos = i;
   }
 
-  if (i == 0 && get_class(impl->buffer, i) == cclass) {
+  if (i == 0 && get_class(impl->view(), i) == cclass) {
     savePos = i;
   }
 
@@ -650,11 +1632,11 @@ text_pos_t text_line_t::get_previous_word(text_pos_t start) const {
 }
 
 text_pos_t text_line_t::get_next_word_boundary(text_pos_t start) const {
-  int cclass = get_class(impl->buffer, start);
+  int cclass = get_class(impl->view(), start);
 
   text_pos_t i;
   for (i = adjust_position(start, 1);
-       static_cast<size_t>(i) < impl->buffer.size() && get_class(impl->buffer, i) == cclass;
+       static_cast<size_t>(i) < impl->view().size() && get_class(impl->view(), i) == cclass;
        i = adjust_position(i, 1)) {
   }
 
@@ -666,16 +1648,16 @@ text_pos_t text_line_t::get_previous_word_boundary(text_pos_t start) const {
     return 0;
   }
 
-  int cclass = get_class(impl->buffer, start);
+  int cclass = get_class(impl->view(), start);
   text_pos_t savePos = start;
 
   text_pos_t i;
-  for (i = adjust_position(start, -1); i > 0 && get_class(impl->buffer, i) == cclass;
+  for (i = adjust_position(start, -1); i > 0 && get_class(impl->view(), i) == cclass;
        i = adjust_position(i, -1)) {
     savePos = i;
   }
 
-  if (i == 0 && get_class(impl->buffer, i) == cclass) {
+  if (i == 0 && get_class(impl->view(), i) == cclass) {
     return 0;
   }
 
@@ -689,12 +1671,8 @@ bool text_line_t::insert_char(text_pos_t pos, key_t c, undo_t *undo) {
 
   conversion_length = t3_utf8_put(c, conversion_buffer);
 
-  reserve(impl->buffer.size() + conversion_length + 1);
-
   if (undo != nullptr) {
-    tiny_string_t *undo_text = undo->get_text();
-    undo_text->reserve(undo_text->size() + conversion_length);
-
+    undo_text_t *undo_text = undo->get_text();
     ASSERT(undo->get_type() == UNDO_ADD);
     undo_text->append(string_view(conversion_buffer, conversion_length));
   }
@@ -703,7 +1681,19 @@ bool text_line_t::insert_char(text_pos_t pos, key_t c, undo_t *undo) {
     impl->starts_with_combining = key_width(c) == 0;
   }
 
-  impl->buffer.insert(pos, conversion_buffer, conversion_length);
+  if (impl->use_gap()) {
+    impl->open_gap(pos, conversion_length);
+    memcpy(&impl->storage[pos], conversion_buffer, conversion_length);
+    impl->gap_start += conversion_length;
+    impl->gap_size -= conversion_length;
+    if (impl->gap_size == 0) {
+      impl->forget_gap();
+    }
+  } else {
+    reserve(impl->buffer().size() + conversion_length + 1);
+    impl->buffer().insert(pos, conversion_buffer, conversion_length);
+  }
+  impl->char_inserted(pos, c);
   return true;
 }
 
@@ -736,17 +1726,18 @@ bool text_line_t::overwrite_char(text_pos_t pos, key_t c, undo_t *undo) {
 
   oldspace = adjust_position(pos, 1) - pos;
   if (static_cast<size_t>(oldspace) < conversion_length) {
-    reserve(impl->buffer.size() + conversion_length - oldspace);
+    reserve(impl->buffer().size() + conversion_length - oldspace);
   }
 
   if (undo != nullptr) {
     ASSERT(undo->get_type() == UNDO_OVERWRITE);
     double_string_adapter_t undo_adapter(undo->get_text());
-    undo_adapter.append_first(string_view(impl->buffer.data() + pos, oldspace));
+    undo_adapter.append_first(string_view(impl->buffer().data() + pos, oldspace));
     undo_adapter.append_second(string_view(conversion_buffer, conversion_length));
   }
 
-  impl->buffer.replace(pos, oldspace, conversion_buffer, conversion_length);
+  impl->buffer().replace(pos, oldspace, conversion_buffer, conversion_length);
+  impl->content_changed(pos);
   return true;
 }
 
@@ -754,7 +1745,7 @@ bool text_line_t::overwrite_char(text_pos_t pos, key_t c, undo_t *undo) {
 bool text_line_t::delete_char(text_pos_t pos, undo_t *undo) {
   text_pos_t oldspace;
 
-  if (pos < 0 || static_cast<size_t>(pos) >= impl->buffer.size()) {
+  if (pos < 0 || pos >= impl->size()) {
     return false;
   }
 
@@ -762,35 +1753,55 @@ bool text_line_t::delete_char(text_pos_t pos, undo_t *undo) {
     impl->starts_with_combining = false;
   }
 
-  oldspace = adjust_position(pos, 1) - pos;
+  /* With the gap at pos, the text following it is contiguous. Determining the extent of the
+     character only requires looking back into the text before pos if the character is a conjoining
+     Jamo V, so use the regular path for that. */
+  string_view text_after;
+  bool use_gap = impl->use_gap();
+  if (use_gap) {
+    impl->open_gap(pos, 0);
+    text_after = string_view(impl->storage.data() + pos + impl->gap_size, impl->size() - pos);
+    use_gap = !is_conjoining_jamo_v(t3_utf8_get(text_after.data(), nullptr));
+  }
 
-  if (undo != nullptr) {
-    tiny_string_t *undo_text = undo->get_text();
-    undo_text->reserve(oldspace);
+  if (use_gap) {
+    oldspace = adjust_position(text_after, 0, 1);
+  } else {
+    text_after = string_view(impl->buffer().data() + pos, impl->size() - pos);
+    oldspace = adjust_position(pos, 1) - pos;
+  }
+  oldspace = std::min<text_pos_t>(oldspace, text_after.size());
 
+  if (undo != nullptr) {
+    undo_text_t *undo_text = undo->get_text();
     ASSERT(undo->get_type() == UNDO_DELETE || undo->get_type() == UNDO_BACKSPACE);
     undo_text->insert(undo->get_type() == UNDO_DELETE ? undo_text->size() : 0,
-                      string_view(impl->buffer.data() + pos, oldspace));
+                      string_view(text_after.data(), oldspace));
   }
 
-  impl->buffer.erase(pos, oldspace);
+  if (use_gap) {
+    impl->gap_size += oldspace;
+  } else {
+    impl->buffer().erase(pos, oldspace);
+  }
+  impl->chars_deleted(pos);
   return true;
 }
 
 /* Append character 'c' to 'line' */
 bool text_line_t::append_char(key_t c, undo_t *undo) {
-  return insert_char(impl->buffer.size(), c, undo);
+  return insert_char(impl->size(), c, undo);
 }
 
 /* Backspace word at 'pos' */
 bool text_line_t::backspace_word(text_pos_t pos, text_pos_t newpos, undo_t *undo) {
   text_pos_t oldspace;
 
-  if (pos < 0 || static_cast<size_t>(pos) > impl->buffer.size()) {
+  if (pos < 0 || pos > impl->size()) {
     return false;
   }
 
-  if (newpos < 0 || static_cast<size_t>(newpos) > impl->buffer.size()) {
+  if (newpos < 0 || newpos > impl->size()) {
     return false;
   }
 
@@ -800,13 +1811,13 @@ bool text_line_t::backspace_word(text_pos_t pos, text_pos_t newpos, undo_t *undo
 
   oldspace = pos - newpos;
   if (undo != nullptr) {
-    tiny_string_t *undo_text = undo->get_text();
-    undo_text->reserve(oldspace);
+    undo_text_t *undo_text = undo->get_text();
     ASSERT(undo->get_type() == UNDO_BACKSPACE);
-    undo_text->insert(0, string_view(impl->buffer.data() + newpos, oldspace));
+    undo_text->insert(0, string_view(impl->buffer().data() + newpos, oldspace));
   }
 
-  impl->buffer.erase(newpos, oldspace);
+  impl->buffer().erase(newpos, oldspace);
+  impl->content_changed(newpos);
 
   return true;
 }
@@ -816,7 +1827,7 @@ bool text_line_t::backspace_char(text_pos_t pos, undo_t *undo) {
   if (pos == 0) {
     return false;
   }
-  return delete_char(adjust_position(pos, -1), undo);
+  return delete_char(adjust_position(impl->text_before(pos), pos, -1), undo);
 }
 
 /** Adjust the line position @a adjust non-zero-width characters.
@@ -827,109 +1838,94 @@ bool text_line_t::backspace_char(text_pos_t pos, undo_t *undo) {
     means skipping all zero-width characters between the current position and the next
     non-zero-width character, and repeating for @a adjust times. */
 text_pos_t text_line_t::adjust_position(string_view str, text_pos_t pos, int adjust) {
-  if (adjust > 0) {
-    for (; adjust > 0 && static_cast<size_t>(pos) < str.size();
-         adjust -= (width_at(str, pos) ? 1 : 0)) {
-      pos += byte_width_from_first(str, pos);
-    }
-  } else if (adjust < 0) {
-    for (; adjust < 0 && pos > 0; adjust += (width_at(str, pos) ? 1 : 0)) {
-      do {
-        pos--;
-      } while (pos > 0 && (str[pos] & 0xc0) == 0x80);
-    }
-  } else {
-    while (pos > 0 && width_at(str, pos) == 0) {
-      do {
-        pos--;
-      } while (pos > 0 && (str[pos] & 0xc0) == 0x80);
-    }
-  }
-  return pos;
+  return adjust_position_in(str, pos, adjust);
 }
 
 text_pos_t text_line_t::adjust_position(text_pos_t pos, int adjust) const {
-  return adjust_position(impl->buffer, pos, adjust);
+  return adjust_position_in(impl->text(), pos, adjust);
 }
 
-text_pos_t text_line_t::size() const { return impl->buffer.size(); }
+text_pos_t text_line_t::size() const { return impl->size(); }
 
 int text_line_t::byte_width_from_first(string_view str, text_pos_t pos) {
-  switch (str[pos] & 0xF0) {
-    case 0xF0:
-      return 4;
-    case 0xE0:
-      return 3;
-    case 0xC0:
-    case 0xD0:
-      return 2;
-    default:
-      return 1;
-  }
+  return byte_width_from_first_in(str, pos);
 }
 
 int text_line_t::byte_width_from_first(text_pos_t pos) const {
-  return byte_width_from_first(impl->buffer, pos);
+  return byte_width_from_first_in(impl->text(), pos);
 }
 
-int text_line_t::key_width(key_t key) {
-  int width = t3_utf8_wcwidth(static_cast<uint32_t>(key));
-  if (width < 0) {
-    width = key < 32 && key != '\t' ? 2 : 1;
-  }
-  return width;
-}
-
-int text_line_t::width_at(string_view str, text_pos_t pos) {
-  const char *buffer_data = str.data();
-  uint32_t c = t3_utf8_get(buffer_data + pos, nullptr);
-  if (is_conjoining_jamo_t(c) && pos > 0) {
-    do {
-      pos--;
-    } while (pos > 0 && (buffer_data[pos] & 0xc0) == 0x80);
-    c = t3_utf8_get(buffer_data + pos, nullptr);
-    if (is_conjoining_jamo_lv(c)) {
-      return 0;
-    }
+int text_line_t::key_width(key_t key) { return codepoint_width(key); }
 
-    if (is_conjoining_jamo_v(c) && pos > 0) {
-      do {
-        pos--;
-      } while (pos > 0 && (buffer_data[pos] & 0xc0) == 0x80);
-      c = t3_utf8_get(buffer_data + pos, nullptr);
-      if (is_conjoining_jamo_l(c)) {
-        return 0;
-      }
-    }
-    return 1;
-  } else if (is_conjoining_jamo_v(c) && pos > 0) {
-    do {
-      pos--;
-    } while (pos > 0 && (buffer_data[pos] & 0xc0) == 0x80);
-    c = t3_utf8_get(buffer_data + pos, nullptr);
-    return is_conjoining_jamo_l(c) ? 0 : 1;
-  }
-  return key_width(c);
-}
+int text_line_t::width_at(string_view str, text_pos_t pos) { return width_at_in(str, pos); }
 
-int text_line_t::width_at(text_pos_t pos) const { return width_at(impl->buffer, pos); }
+int text_line_t::width_at(text_pos_t pos) const { return width_at_in(impl->text(), pos); }
 
 bool text_line_t::is_print(text_pos_t pos) const {
-  return impl->buffer[pos] == '\t' ||
-         !uc_is_general_category_withtable(t3_utf8_get(impl->buffer.data() + pos, nullptr),
-                                           T3_UTF8_CONTROL_MASK);
+  const char *data = impl->text().ptr(pos);
+  return *data == '\t' ||
+         !uc_is_general_category_withtable(t3_utf8_get(data, nullptr), T3_UTF8_CONTROL_MASK);
 }
 bool text_line_t::is_alnum(text_pos_t pos) const {
-  return get_class(impl->buffer, pos) == CLASS_ALNUM;
+  return get_class(impl->text().from(pos), 0) == CLASS_ALNUM;
 }
 bool text_line_t::is_space(text_pos_t pos) const {
-  return get_class(impl->buffer, pos) == CLASS_WHITESPACE;
+  return get_class(impl->text().from(pos), 0) == CLASS_WHITESPACE;
 }
 bool text_line_t::is_bad_draw(text_pos_t pos) const {
-  return !t3_term_can_draw(impl->buffer.data() + pos, (adjust_position(pos, 1) - pos));
+  const line_text_t text = impl->text();
+  const text_pos_t length = adjust_position(pos, 1) - pos;
+  string_view part = text.from(pos);
+  if (static_cast<size_t>(length) <= part.size()) {
+    return !t3_term_can_draw(part.data(), length);
+  }
+  // The zero-width characters following the character continue after the gap.
+  std::string joined(part.data(), part.size());
+  joined.append(text.ptr(pos + part.size()), length - part.size());
+  return !t3_term_can_draw(joined.data(), joined.size());
+}
+
+const std::string &text_line_t::get_data() const { return impl->buffer(); }
+
+string_view text_line_t::get_text() const { return impl->view(); }
+
+void text_line_t::add_share() { ++impl->shares; }
+
+bool text_line_t::remove_share() {
+  if (impl->shares == 1) {
+    return true;
+  }
+  --impl->shares;
+  return false;
+}
+
+bool text_line_t::is_shared() const { return impl->shares > 1; }
+
+void text_line_t::set_gap_list(gap_list_t *list) {
+  if (impl->gap_list == list) {
+    return;
+  }
+  if (impl->gap_size > 0) {
+    impl->forget_gap();
+    impl->gap_list = list;
+    impl->remember_gap();
+  } else {
+    impl->gap_list = list;
+  }
 }
 
-const std::string &text_line_t::get_data() const { return impl->buffer; }
+text_line_t::gap_list_t::~gap_list_t() {
+  // The remaining lines are no longer part of the line_storage_t, and need not be recorded.
+  for (const implementation_t *line : lines) {
+    const_cast<implementation_t *>(line)->gap_list = nullptr;
+  }
+}
+
+void text_line_t::gap_list_t::close_gaps() {
+  while (!lines.empty()) {
+    lines.back()->close_gap();
+  }
+}
 
 void text_line_t::init() {
   memset(spaces, ' ', sizeof(spaces));
@@ -940,13 +1936,13 @@ void text_line_t::init() {
   }
 }
 
-void text_line_t::reserve(text_pos_t size) { impl->buffer.reserve(size); }
+void text_line_t::reserve(text_pos_t size) { impl->buffer().reserve(size); }
 
 bool text_line_t::check_boundaries(text_pos_t match_start, text_pos_t match_end) const {
-  return (match_start == 0 || get_class(impl->buffer, match_start) !=
-                                  get_class(impl->buffer, adjust_position(match_start, -1))) &&
-         (match_end == size() || get_class(impl->buffer, match_end) !=
-                                     get_class(impl->buffer, adjust_position(match_end, 1)));
+  return (match_start == 0 || get_class(impl->view(), match_start) !=
+                                  get_class(impl->view(), adjust_position(match_start, -1))) &&
+         (match_end == size() || get_class(impl->view(), match_end) !=
+                                     get_class(impl->view(), adjust_position(match_end, 1)));
 }
 
 text_line_factory_t *text_line_t::get_line_factory() const { return impl->factory; }
@@ -962,4 +1958,139 @@ std::unique_ptr<text_line_t> text_line_factory_t::new_text_line_t(string_view _b
   return t3widget::make_unique<text_line_t>(_buffer, this);
 }
 
+pooled_text_line_factory_t::pooled_text_line_factory_t() : pool(new text_line_t::pool_t) {}
+pooled_text_line_factory_t::~pooled_text_line_factory_t() {}
+
+std::unique_ptr<text_line_t> pooled_text_line_factory_t::new_text_line_t(int buffersize) {
+  /* The buffer size is only a hint. Reserving space up-front for each line would defeat the
+     purpose of this factory, and appending to the line will allocate as needed. */
+  (void)buffersize;
+  text_line_t::pool_t *line_pool = pool;
+  return std::unique_ptr<text_line_t>(new (line_pool) text_line_t::pooled_line_t(this, line_pool));
+}
+
+std::unique_ptr<text_line_t> pooled_text_line_factory_t::new_text_line_t(string_view _buffer) {
+  std::unique_ptr<text_line_t> line = new_text_line_t(0);
+  // Invalid UTF-8 is replaced by fill_line, so only valid text can be stored as is.
+  if (_buffer.size() < POOL_MIN_TEXT_LENGTH || _buffer.size() > POOL_MAX_TEXT_LENGTH ||
+      utf8_valid_prefix(_buffer.data(), _buffer.size()) != _buffer.size()) {
+    line->fill_line(_buffer);
+    return line;
+  }
+  line->impl->pooled = pool->allocate_text(_buffer);
+  line->impl->starts_with_combining = line->width_at(0) == 0;
+  return line;
+}
+
+size_t pooled_text_line_factory_t::get_pool_size() const {
+  return pool->slabs.size() * POOL_SLAB_SIZE;
+}
+
+/* Lines shorter than this are not shared, as std::string stores them without a separate
+   allocation. */
+#define INTERN_MIN_LENGTH 16
+
+interning_text_line_factory_t::interning_text_line_factory_t()
+    : table(new text_line_t::intern_table_t) {}
+interning_text_line_factory_t::~interning_text_line_factory_t() {}
+
+std::unique_ptr<text_line_t> interning_text_line_factory_t::new_text_line_t(string_view _buffer) {
+  // Invalid UTF-8 is replaced by fill_line, so only valid text can be shared as is.
+  if (_buffer.size() < INTERN_MIN_LENGTH ||
+      utf8_valid_prefix(_buffer.data(), _buffer.size()) != _buffer.size()) {
+    return text_line_factory_t::new_text_line_t(_buffer);
+  }
+  std::unique_ptr<text_line_t> line = text_line_factory_t::new_text_line_t(0);
+  line->impl->interned = table->acquire(_buffer);
+  line->impl->starts_with_combining = line->width_at(0) == 0;
+  return line;
+}
+
+size_t interning_text_line_factory_t::get_shared_lines() const { return table->line_count; }
+
+size_t interning_text_line_factory_t::get_unique_texts() const { return table->entries.size(); }
+
+double interning_text_line_factory_t::get_dedup_ratio() const {
+  if (table->unique_bytes == 0) {
+    return 1.0;
+  }
+  return static_cast<double>(table->line_bytes) / table->unique_bytes;
+}
+
+line_metadata_t::~line_metadata_t() {}
+
+struct line_metadata_cache_t::implementation_t {
+  compute_func_t compute;
+  size_t max_lines;
+  line_metadata_entry_t::lru_list_t lru;
+
+  implementation_t(compute_func_t _compute, size_t _max_lines)
+      : compute(std::move(_compute)), max_lines(std::max<size_t>(_max_lines, 1)) {}
+
+  line_metadata_entry_t *find(line_metadata_entry_t *entry) const {
+    while (entry != nullptr && entry->lru != &lru) {
+      entry = entry->next_for_line;
+    }
+    return entry;
+  }
+
+  void evict(size_t keep) {
+    while (lru.size > keep) {
+      lru.tail->remove();
+    }
+  }
+};
+
+line_metadata_cache_t::line_metadata_cache_t(compute_func_t compute, size_t max_lines)
+    : impl(new implementation_t(std::move(compute), max_lines)) {}
+
+line_metadata_cache_t::~line_metadata_cache_t() { clear(); }
+
+line_metadata_t *line_metadata_cache_t::get(const text_line_t &line) {
+  line_metadata_entry_t *entry = impl->find(line.impl->metadata);
+  if (entry != nullptr) {
+    if (entry != impl->lru.head) {
+      entry->unlink_lru();
+      entry->push_lru_front();
+    }
+    return entry->data.get();
+  }
+
+  /* Computing the data may use the cache for other lines, for example if it depends on the data
+     of the previous line. Therefore the entry is only added afterwards. */
+  std::unique_ptr<line_metadata_t> data = impl->compute(line);
+  entry = new line_metadata_entry_t;
+  entry->lru = &impl->lru;
+  entry->line_entries = &line.impl->metadata;
+  entry->next_for_line = line.impl->metadata;
+  line.impl->metadata = entry;
+  entry->data = std::move(data);
+  entry->push_lru_front();
+  ++impl->lru.size;
+  // As max_lines is at least 1, this never evicts the new entry.
+  impl->evict(impl->max_lines);
+  return entry->data.get();
+}
+
+line_metadata_t *line_metadata_cache_t::peek(const text_line_t &line) const {
+  line_metadata_entry_t *entry = impl->find(line.impl->metadata);
+  return entry == nullptr ? nullptr : entry->data.get();
+}
+
+void line_metadata_cache_t::invalidate(const text_line_t &line) {
+  line_metadata_entry_t *entry = impl->find(line.impl->metadata);
+  if (entry != nullptr) {
+    entry->remove();
+  }
+}
+
+void line_metadata_cache_t::clear() { impl->evict(0); }
+
+void line_metadata_cache_t::set_max_lines(size_t max_lines) {
+  impl->max_lines = std::max<size_t>(max_lines, 1);
+  impl->evict(impl->max_lines);
+}
+
+size_t line_metadata_cache_t::size() const { return impl->lru.size; }
+
 }  // namespace t3widget
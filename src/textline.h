@@ -17,6 +17,8 @@
 #define BUFFERSIZE 64
 #define BUFFERINC 16
 
+#include <functional>
+#include <memory>
 #include <stdio.h>
 #include <string>
 #include <sys/types.h>
@@ -25,6 +27,7 @@
 #include <t3widget/string_view.h>
 #include <t3widget/widget_api.h>
 #include <t3window/window.h>
+#include <vector>
 
 namespace t3widget {
 
@@ -33,6 +36,7 @@ class undo_t;
 #define _T3_MAX_TAB 80
 
 class text_line_factory_t;
+class line_metadata_cache_t;
 
 class T3_WIDGET_API text_line_t {
  public:
@@ -78,7 +82,17 @@ class T3_WIDGET_API text_line_t {
   static const char *wrap_symbol;
 
   struct implementation_t;
-  pimpl_t<implementation_t> impl;
+  /* The implementation is either allocated on the heap, or in a pool_t. The deleter takes care of
+     returning the memory to the right place. */
+  struct T3_WIDGET_LOCAL impl_deleter_t {
+    void operator()(implementation_t *impl) const;
+  };
+  propagate_const<const std::unique_ptr<implementation_t, impl_deleter_t>> impl;
+
+  struct pool_t;
+  class pooled_line_t;
+  struct intern_table_t;
+  text_line_t(text_line_factory_t *factory, pool_t *pool);
 
   static void paint_part(t3window::window_t *win, const char *paint_buffer, text_pos_t todo,
                          bool is_print, t3_attr_t selection_attr);
@@ -94,8 +108,40 @@ class T3_WIDGET_API text_line_t {
 
   void reserve(text_pos_t size);
   int byte_width_from_first(text_pos_t pos) const;
+  /* Returns the text of the line. Unlike get_data, this does not require the text to be copied to
+     a std::string if it is stored in a pool. */
+  string_view get_text() const;
+
+  /* Reference counting for lines shared between the line_storage_t of a text_buffer_t and its
+     snapshots. remove_share returns true if the caller held the last reference, and should delete
+     the line. */
+  void add_share();
+  bool remove_share();
+  bool is_shared() const;
+
+  /* The lines of a line_storage_t which have an open gap. These must be closed before the lines
+     are shared with another thread, such that reading them doesn't modify them. */
+  class T3_WIDGET_LOCAL gap_list_t {
+   public:
+    gap_list_t() = default;
+    gap_list_t(const gap_list_t &) = delete;
+    gap_list_t &operator=(const gap_list_t &) = delete;
+    ~gap_list_t();
+    void close_gaps();
+
+   private:
+    friend class text_line_t;
+    std::vector<const implementation_t *> lines;
+  };
+  /* Set the list in which the line is recorded while it has an open gap. Must only be called for
+     lines which are not shared. */
+  void set_gap_list(gap_list_t *list);
 
   friend class regex_finder_t;
+  friend class line_storage_t;
+  friend class pooled_text_line_factory_t;
+  friend class interning_text_line_factory_t;
+  friend class line_metadata_cache_t;
 
  protected:
   text_line_factory_t *get_line_factory() const;
@@ -124,6 +170,9 @@ class T3_WIDGET_API text_line_t {
   void paint_line(t3window::window_t *win, const paint_info_t &info) const;
 
   break_pos_t find_next_break_pos(text_pos_t start, text_pos_t length, int tabsize) const;
+  /** Find the next break position for wrapping at any character, rather than at word boundaries.
+      If not even the first character fits in @p length, it is put on a line by itself. */
+  break_pos_t find_next_char_break_pos(text_pos_t start, text_pos_t length, int tabsize) const;
   text_pos_t get_next_word(text_pos_t start) const;
   text_pos_t get_previous_word(text_pos_t start) const;
 
@@ -161,5 +210,102 @@ class T3_WIDGET_API text_line_factory_t {
 
 T3_WIDGET_API extern text_line_factory_t default_text_line_factory;
 
+/** Factory which allocates its lines from a pool.
+
+    Lines created by this factory are allocated together with their internal data in large slabs,
+    instead of requiring several separate heap allocations per line. The text of lines created
+    from text of up to 255 bytes is stored in the slabs as well, until the line is modified. Short
+    lines also don't reserve any space up-front. Memory of destroyed lines is reused for new lines,
+    and the slabs are only freed when the factory is destroyed. This makes it suitable for buffers
+    with many short lines.
+
+    The factory must outlive all lines created by it.
+*/
+class T3_WIDGET_API pooled_text_line_factory_t : public text_line_factory_t {
+ public:
+  pooled_text_line_factory_t();
+  ~pooled_text_line_factory_t() override;
+  std::unique_ptr<text_line_t> new_text_line_t(int buffersize = BUFFERSIZE) override;
+  std::unique_ptr<text_line_t> new_text_line_t(string_view _buffer) override;
+
+  /** Returns the number of bytes allocated for the pool. */
+  size_t get_pool_size() const;
+
+ private:
+  pimpl_t<text_line_t::pool_t> pool;
+};
+
+/** Factory which shares the text of identical lines.
+
+    Lines created from text by this factory refer to a single copy of the text, shared by all such
+    lines with the same contents. Identical lines are found through a hash table. A line gets its
+    own copy of the text when it is first modified. This reduces the memory used for files with
+    many repeated lines, such as logs and generated files. Short lines are not shared, as their
+    text does not require a separate allocation.
+
+    The factory must outlive all lines created by it.
+*/
+class T3_WIDGET_API interning_text_line_factory_t : public text_line_factory_t {
+ public:
+  interning_text_line_factory_t();
+  ~interning_text_line_factory_t() override;
+  using text_line_factory_t::new_text_line_t;
+  std::unique_ptr<text_line_t> new_text_line_t(string_view _buffer) override;
+
+  /** Returns the number of lines currently sharing their text. */
+  size_t get_shared_lines() const;
+  /** Returns the number of distinct texts shared by the lines. */
+  size_t get_unique_texts() const;
+  /** Returns the ratio between the size of the text of the sharing lines and the size of the
+      distinct texts, or 1 if no lines share their text. */
+  double get_dedup_ratio() const;
+
+ private:
+  pimpl_t<text_line_t::intern_table_t> table;
+};
+
+/** Base class for data associated with lines through a line_metadata_cache_t. */
+class T3_WIDGET_API line_metadata_t {
+ public:
+  virtual ~line_metadata_t();
+};
+
+/** Cache of data associated with lines, which is only created when it is needed.
+
+    The data for a line is created on first use, by calling the function passed to the constructor.
+    It is dropped when the contents of the line change, or when the line is destroyed. Only the data
+    for the @p max_lines most recently used lines is kept. Using the cache only for the lines which
+    are painted, e.g. from text_buffer_t::prepare_paint_line, makes the memory use scale with the
+    size of the visible region rather than with the size of the file.
+
+    The cache may only be used from the thread which modifies the lines.
+*/
+class T3_WIDGET_API line_metadata_cache_t {
+ public:
+  using compute_func_t = std::function<std::unique_ptr<line_metadata_t>(const text_line_t &)>;
+
+  line_metadata_cache_t(compute_func_t compute, size_t max_lines);
+  ~line_metadata_cache_t();
+
+  /** Returns the data for @p line, creating it if necessary. */
+  line_metadata_t *get(const text_line_t &line);
+  /** Returns the data for @p line if it is available, or @c nullptr otherwise.
+      In contrast to #get, this does not count as a use of the data. */
+  line_metadata_t *peek(const text_line_t &line) const;
+  /** Drop the data for @p line, for example because information it depends on changed. */
+  void invalidate(const text_line_t &line);
+  /** Drop the data for all lines. */
+  void clear();
+
+  /** Set the maximum number of lines for which data is kept. */
+  void set_max_lines(size_t max_lines);
+  /** Returns the number of lines for which data is currently kept. */
+  size_t size() const;
+
+ private:
+  struct T3_WIDGET_LOCAL implementation_t;
+  pimpl_t<implementation_t> impl;
+};
+
 }  // namespace t3widget
 #endif
@@ -11,46 +11,96 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <algorithm>
+#include <cstring>
 #include <deque>
+#include <memory>
 #include <type_traits>
 
-#include "t3widget/tinystring.h"
+#include "t3widget/internal.h"
 #include "t3widget/undo.h"
+#include "t3widget/undojournal.h"
 #include "t3widget/util.h"
 
 namespace t3widget {
+
+/* The text of undo records is stored in chunks of at least ARENA_CHUNK_SIZE bytes. */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
 struct undo_list_t::implementation_t {
   std::deque<undo_t> list;
-  std::deque<undo_t>::iterator current = list.end(), mark = list.end();
+  /* Append-only storage for the text of the records, which replaces a separate allocation for
+     each record. Only the last record is filled, and its text is at the end of the arena, so the
+     text in the arena is in the same order as the records. This allows growing the text of the
+     last record in place, and releasing memory from the front and the back as records are
+     removed. */
+  struct arena_chunk_t {
+    std::unique_ptr<char[]> data;
+    size_t size;
+    size_t used;
+
+    bool contains(const char *ptr) const { return ptr >= data.get() && ptr < data.get() + used; }
+  };
+  std::deque<arena_chunk_t> arena;
+  // Total size of the chunks in the arena, including the unused space at their ends.
+  size_t arena_allocated = 0;
+  /* Indices of the first record that can be redone, and of the first record after the state that
+     was marked by set_mark. Indices are used rather than iterators, as the oldest records are
+     removed from the front of the list when the memory limit is exceeded. */
+  size_t current = 0, mark = 0;
   bool mark_is_valid = true;
   bool mark_beyond_current = false;
+  // Maximum number of bytes used by the records, or 0 for no limit.
+  size_t memory_limit = 0;
+  /* Number of bytes used by the records. The last record is still filled by the caller of add, so
+     its contribution is updated by update_last_size. */
+  size_t memory_used = 0;
+  size_t last_size = 0;
+  /* Journal to which the applied operations are written. Records are identified in the journal by
+     the number of records added before them. */
+  std::unique_ptr<undo_journal_t> journal;
+  uint64_t first_id = 0;
+  /* Whether the last record is complete, i.e. the next record was added or an operation was
+     undone. Complete records are written to the journal. */
+  bool last_complete = true;
+  // The text of the last record while it is not complete.
+  undo_text_t open_text{this};
 
   undo_t *add(undo_type_t type, text_coordinate_t coord) {
-    if (list.empty()) {
-      mark = list.emplace(list.end(), type, coord);
-      current = list.end();
-      return &*mark;
-    }
-
     // Everything beyond current will be deleted, so mark will be invalid afterwards.
     if (mark_beyond_current) {
       mark_is_valid = false;
     }
 
     const bool mark_at_current = mark_is_valid && current == mark;
-    if (current != list.end()) {
-      list.erase(current, list.end());
+    while (list.size() > current) {
+      remove_last();
     }
-    auto iter = list.emplace(list.end(), type, coord);
-    current = list.end();
+
+    /* Continue the last record if possible. This is not allowed if the mark is at the end of the
+       list, because undoing the combined record would skip over the marked state. */
+    if (!list.empty() && !mark_at_current && !last_complete &&
+        continues(&list.back(), type, coord)) {
+      return &list.back();
+    }
+
+    complete_last();
+    update_last_size();
+    list.emplace_back(type, coord);
+    list.back().open_text = &open_text;
+    last_complete = false;
+    last_size = list.back().get_memory_usage();
+    memory_used += last_size;
+    current = list.size();
     if (mark_at_current) {
-      mark = iter;
+      mark = current - 1;
     }
-    return &*iter;
+    enforce_limit();
+    return &list.back();
   }
 
   undo_t *back() {
-    if (current == list.begin()) {
+    if (current == 0) {
       return nullptr;
     }
 
@@ -58,14 +108,22 @@ struct undo_list_t::implementation_t {
       mark_beyond_current = true;
     }
 
-    return &*--current;
+    complete_last();
+    --current;
+    if (journal != nullptr && !journal->retract(first_id + current)) {
+      journal_record(current, false);
+    }
+    return &list[current];
   }
 
   undo_t *forward() {
-    if (current == list.end()) {
+    if (current == list.size()) {
       return nullptr;
     }
-    undo_t *retval = &*current;
+    undo_t *retval = &list[current];
+    if (journal != nullptr) {
+      journal_record(current, true);
+    }
     ++current;
 
     if (mark_is_valid && mark_beyond_current && current == mark) {
@@ -78,9 +136,190 @@ struct undo_list_t::implementation_t {
     mark_is_valid = true;
     mark_beyond_current = false;
     mark = current;
+    complete_last();
+    // The marked state is the one written to disk, so the journal can start from there.
+    if (journal != nullptr) {
+      journal->reset();
+    }
+  }
+
+  void complete_last() {
+    if (last_complete) {
+      return;
+    }
+    last_complete = true;
+    list.back().open_text = nullptr;
+    if (journal != nullptr) {
+      journal_record(list.size() - 1, true);
+    }
+  }
+
+  char *arena_allocate(size_t size) {
+    if (arena.empty() || arena.back().size - arena.back().used < size) {
+      arena_add_chunk(std::max<size_t>(size, ARENA_CHUNK_SIZE), 0);
+    }
+    char *result = arena.back().data.get() + arena.back().used;
+    arena.back().used += size;
+    return result;
+  }
+
+  /* Changes the size of the text of the last record, which is at the end of the arena, and
+     returns the text. If the text no longer fits in its chunk, it is moved to a new chunk with
+     room to grow. */
+  char *resize_last_text(size_t size) {
+    undo_t *record = &list.back();
+    const size_t needed = sizeof(size_t) + size;
+    if (record->arena_text == nullptr) {
+      record->arena_text = arena_allocate(needed);
+    } else {
+      arena_chunk_t *chunk = &arena.back();
+      size_t offset = record->arena_text - chunk->data.get();
+      if (chunk->size - offset >= needed) {
+        chunk->used = offset + needed;
+      } else {
+        arena_add_chunk(std::max<size_t>(2 * needed, ARENA_CHUNK_SIZE), needed);
+        memcpy(arena.back().data.get(), record->arena_text, chunk->used - offset);
+        record->arena_text = arena.back().data.get();
+        chunk->used = offset;
+        if (offset == 0) {
+          arena_allocated -= chunk->size;
+          arena.erase(arena.end() - 2);
+        }
+      }
+    }
+    memcpy(record->arena_text, &size, sizeof(size_t));
+    return record->arena_text + sizeof(size_t);
+  }
+
+  void arena_add_chunk(size_t size, size_t used) {
+    arena.push_back(arena_chunk_t{std::unique_ptr<char[]>(new char[size]), size, used});
+    arena_allocated += size;
+  }
+
+  // Releases the memory in the arena from ptr onwards.
+  void arena_truncate(const char *ptr) {
+    while (!arena.back().contains(ptr)) {
+      arena_allocated -= arena.back().size;
+      arena.pop_back();
+    }
+    arena.back().used = ptr - arena.back().data.get();
+  }
+
+  // Releases the chunks in the arena before the first one still used by a record.
+  void arena_drop_unused() {
+    const char *first = nullptr;
+    for (const undo_t &record : list) {
+      if (record.arena_text != nullptr) {
+        first = record.arena_text;
+        break;
+      }
+    }
+    while (!arena.empty() && (first == nullptr || !arena.front().contains(first))) {
+      arena_allocated -= arena.front().size;
+      arena.pop_front();
+    }
+  }
+
+  /* Writes the record at idx to the journal, with the type with which it is applied when redone
+     if forward is true, or undone otherwise. The markers for blocks of operations are not needed
+     to replay the operations. */
+  void journal_record(size_t idx, bool forward) {
+    undo_t *record = &list[idx];
+    undo_type_t type = forward ? record->get_redo_type() : record->get_type();
+    if (type == UNDO_BLOCK_START || type == UNDO_BLOCK_END || type == UNDO_BLOCK_START_REDO ||
+        type == UNDO_BLOCK_END_REDO) {
+      return;
+    }
+    journal->append(first_id + idx, forward, type, record->get_start(), record->get_data());
   }
 
   bool is_at_mark() const { return mark_is_valid && mark == current; }
+
+  /* Returns the number of bytes allocated for the records and the arena. Unlike memory_used,
+     this includes the unused space at the end of the arena chunks. */
+  size_t get_memory_usage() const { return list.size() * sizeof(undo_t) + arena_allocated; }
+
+  void update_last_size() {
+    if (!list.empty()) {
+      memory_used -= last_size;
+      last_size = list.back().get_memory_usage();
+      memory_used += last_size;
+    }
+  }
+
+  void remove_last() {
+    update_last_size();
+    last_complete = true;
+    list.back().open_text = nullptr;
+    memory_used -= last_size;
+    if (list.back().arena_text != nullptr) {
+      arena_truncate(list.back().arena_text);
+    }
+    list.pop_back();
+    // All records but the last are complete, so their size no longer changes.
+    last_size = list.empty() ? 0 : list.back().get_memory_usage();
+  }
+
+  /* Returns whether an operation of type type at coord directly continues the operation recorded
+     in last, such that its text can be added to last instead of to a new record. */
+  static bool continues(undo_t *last, undo_type_t type, text_coordinate_t coord) {
+    text_coordinate_t start = last->get_start();
+    if (type != last->get_type() || coord.line != start.line) {
+      return false;
+    }
+    string_view text = last->get_data();
+    switch (type) {
+      case UNDO_ADD:
+        return text.find('\n') == string_view::npos &&
+               coord.pos == start.pos + static_cast<text_pos_t>(text.size());
+      case UNDO_BACKSPACE:
+        return text.find('\n') == string_view::npos &&
+               coord.pos == start.pos - static_cast<text_pos_t>(text.size());
+      default:
+        return false;
+    }
+  }
+
+  /* Removes the oldest operations until the memory used is within the limit. A block of
+     operations is only removed as a whole, and the last record is never removed, as the caller of
+     add may still be filling it. */
+  void enforce_limit() {
+    if (memory_limit == 0) {
+      return;
+    }
+    update_last_size();
+    bool removed = false;
+    while (memory_used > memory_limit) {
+      size_t group_end = 0;
+      if (list.front().get_type() == UNDO_BLOCK_START) {
+        while (group_end < list.size() && list[group_end].get_type() != UNDO_BLOCK_END) {
+          ++group_end;
+        }
+      }
+      ++group_end;
+      if (group_end >= list.size() || group_end > current) {
+        break;
+      }
+
+      for (size_t i = 0; i < group_end; ++i) {
+        memory_used -= list.front().get_memory_usage();
+        list.pop_front();
+      }
+      removed = true;
+      current -= group_end;
+      first_id += group_end;
+      // The marked state can no longer be reached if it was before the removed records.
+      if (mark < group_end) {
+        mark_is_valid = false;
+        mark = 0;
+      } else {
+        mark -= group_end;
+      }
+    }
+    if (removed) {
+      arena_drop_unused();
+    }
+  }
 };
 
 undo_list_t::undo_list_t() : impl(new implementation_t) {}
@@ -98,6 +337,28 @@ void undo_list_t::set_mark() { impl->set_mark(); }
 
 bool undo_list_t::is_at_mark() const { return impl->is_at_mark(); }
 
+void undo_list_t::set_memory_limit(size_t limit) {
+  impl->memory_limit = limit;
+  impl->enforce_limit();
+}
+
+size_t undo_list_t::get_memory_usage() const { return impl->get_memory_usage(); }
+
+void undo_list_t::set_journal(std::unique_ptr<undo_journal_t> journal) {
+  impl->complete_last();
+  impl->journal = std::move(journal);
+}
+
+int undo_list_t::sync_journal() {
+  if (impl->journal == nullptr) {
+    return 0;
+  }
+  impl->complete_last();
+  return impl->journal->sync();
+}
+
+void undo_list_t::invalidate_mark() { impl->mark_is_valid = false; }
+
 #if 0
 #ifdef DEBUG
 #include "log.h"
@@ -153,8 +414,53 @@ undo_type_t undo_t::redo_map[] = {
 undo_type_t undo_t::get_type() const { return type; }
 undo_type_t undo_t::get_redo_type() const { return redo_map[type]; }
 text_coordinate_t undo_t::get_start() { return start; }
-void undo_t::add_newline() { text.append(1, '\n'); }
-tiny_string_t *undo_t::get_text() { return &text; }
-void undo_t::minimize() { text.shrink_to_fit(); }
+void undo_t::add_newline() { get_text()->append(1, '\n'); }
+undo_text_t *undo_t::get_text() {
+  ASSERT(open_text != nullptr);
+  return open_text;
+}
+string_view undo_t::get_data() const {
+  if (arena_text == nullptr) {
+    return string_view();
+  }
+  size_t size;
+  memcpy(&size, arena_text, sizeof(size_t));
+  return string_view(arena_text + sizeof(size_t), size);
+}
+size_t undo_t::get_memory_usage() const {
+  if (arena_text != nullptr) {
+    return sizeof(undo_t) + sizeof(size_t) + get_data().size();
+  }
+  return sizeof(undo_t);
+}
+
+undo_text_t &undo_text_t::append(size_t count, char ch) {
+  size_t old_size = size();
+  memset(list_->resize_last_text(old_size + count) + old_size, ch, count);
+  return *this;
+}
+
+undo_text_t &undo_text_t::replace(size_t pos, size_t count, string_view str) {
+  size_t old_size = size();
+  size_t tail = old_size - pos - count;
+  char *text;
+  if (str.size() > count) {
+    text = list_->resize_last_text(old_size - count + str.size());
+    memmove(text + pos + str.size(), text + pos + count, tail);
+  } else {
+    if (tail > 0) {
+      text = const_cast<char *>(data());
+      memmove(text + pos + str.size(), text + pos + count, tail);
+    }
+    text = list_->resize_last_text(old_size - count + str.size());
+  }
+  if (!str.empty()) {
+    memcpy(text + pos, str.data(), str.size());
+  }
+  return *this;
+}
+
+const char *undo_text_t::data() const { return list_->list.back().get_data().data(); }
+size_t undo_text_t::size() const { return list_->list.back().get_data().size(); }
 
 }  // namespace t3widget
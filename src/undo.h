@@ -14,9 +14,10 @@
 #ifndef T3_WIDGET_UNDO_H
 #define T3_WIDGET_UNDO_H
 
+#include <memory>
 #include <string>
+#include <t3widget/string_view.h>
 #include <t3widget/textline.h>
-#include <t3widget/tinystring.h>
 #include <t3widget/util.h>
 
 #ifndef _T3_WIDGET_INTERNAL
@@ -25,6 +26,8 @@
 
 namespace t3widget {
 
+class undo_journal_t;
+
 enum undo_type_t {
   UNDO_NONE,
   UNDO_DELETE,
@@ -52,6 +55,8 @@ class T3_WIDGET_API undo_list_t {
   struct T3_WIDGET_LOCAL implementation_t;
   pimpl_t<implementation_t> impl;
 
+  friend class undo_text_t;
+
  public:
   undo_list_t();
   ~undo_list_t();
@@ -60,28 +65,82 @@ class T3_WIDGET_API undo_list_t {
   undo_t *forward();
   void set_mark();
   bool is_at_mark() const;
+  /* Sets the maximum number of bytes used by the undo records, or 0 for no limit. When the limit
+     is exceeded, the oldest operations are discarded. */
+  void set_memory_limit(size_t limit);
+  /* Returns the number of bytes allocated for the undo records and their text. This includes the
+     unused space in the storage for the text, so it may exceed the memory limit. */
+  size_t get_memory_usage() const;
+  /* Sets the journal to which all operations added, undone and redone are written. set_mark
+     resets the journal, as the marked state is the one saved to disk. */
+  void set_journal(std::unique_ptr<undo_journal_t> journal);
+  /* Writes all complete operations to the journal and syncs it. Returns 0 on success, or an errno
+     value on failure. The last operation is complete after this call, so the caller must not add
+     any text to it. */
+  int sync_journal();
+  /* Makes is_at_mark return false until set_mark is called again. */
+  void invalidate_mark();
 
 #ifdef DEBUG
   void dump();
 #endif
 };
 
+/* The text of the last record of an undo_list_t, while the operation it records is still being
+   performed. The text is stored at the end of the arena of the undo_list_t, such that it can grow
+   in place and does not have to be copied when the record is complete. */
+class T3_WIDGET_API undo_text_t {
+ public:
+  undo_text_t(const undo_text_t &) = delete;
+  undo_text_t &operator=(const undo_text_t &) = delete;
+
+  undo_text_t &operator=(string_view str) { return assign(str); }
+  operator string_view() const { return string_view(data(), size()); }
+
+  undo_text_t &insert(size_t index, string_view str) { return replace(index, 0, str); }
+  undo_text_t &append(size_t count, char ch);
+  undo_text_t &append(string_view str) { return replace(size(), 0, str); }
+  undo_text_t &assign(string_view str) { return replace(0, size(), str); }
+  undo_text_t &replace(size_t pos, size_t count, string_view str);
+
+  const char *data() const;
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+
+ private:
+  friend class undo_list_t;
+
+  explicit undo_text_t(undo_list_t::implementation_t *list) : list_(list) {}
+
+  undo_list_t::implementation_t *list_;
+};
+
 class T3_WIDGET_API undo_t {
  private:
   static undo_type_t redo_map[];
 
-  tiny_string_t text;
+  /* The text of the record in the arena of the undo_list_t, preceded by its size, or nullptr if
+     the record has no text. */
+  char *arena_text;
+  // The text while this is the last record of the undo_list_t and not yet complete.
+  undo_text_t *open_text;
   text_coordinate_t start;
   undo_type_t type;
 
+  friend class undo_list_t;
+
  public:
-  undo_t(undo_type_t _type, text_coordinate_t _start) : start(_start), type(_type) {}
+  undo_t(undo_type_t _type, text_coordinate_t _start)
+      : arena_text(nullptr), open_text(nullptr), start(_start), type(_type) {}
   undo_type_t get_type() const;
   undo_type_t get_redo_type() const;
   text_coordinate_t get_start();
   void add_newline();
-  tiny_string_t *get_text();
-  void minimize();
+  /* Returns the text for modification. Only allowed until the next operation is added to the
+     undo_list_t, or an operation is undone. */
+  undo_text_t *get_text();
+  string_view get_data() const;
+  size_t get_memory_usage() const;
 };
 
 }  // namespace t3widget
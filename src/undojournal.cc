@@ -0,0 +1,268 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "t3widget/modified_xxhash.h"
+#include "t3widget/undojournal.h"
+
+namespace t3widget {
+
+/* Records are written to disk once this many bytes have been collected, or when sync is called
+   explicitly. */
+#define JOURNAL_BATCH_SIZE 4096
+
+/* The journal starts with a header identifying the file format. Each record consists of a 32-bit
+   checksum, the type as a single byte, and the line, position and text size as LEB128 encoded
+   numbers, followed by the text. The checksum covers everything after it, and allows detecting
+   records which were only partially written. As ModifiedXXHash is not portable between
+   platforms, neither is the journal. */
+static const char journal_header[8] = {'T', '3', 'W', 'J', 1, 0, 0, 0};
+#define CHECKSUM_SIZE 4
+
+static void put_number(std::string *data, uint64_t value) {
+  while (value >= 0x80) {
+    data->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  data->push_back(static_cast<char>(value));
+}
+
+static bool get_number(string_view *data, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && !data->empty(); shift += 7) {
+    unsigned char byte = data->front();
+    data->remove_prefix(1);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint32_t checksum(const char *data, size_t size) {
+  return static_cast<uint32_t>(ModifiedXXHash(data, size, 0));
+}
+
+/* Decodes the record at the start of data, removing it from data.
+   @return Whether a complete record with a valid checksum was found. */
+static bool decode_record(string_view *data, undo_type_t *type, text_coordinate_t *start,
+                          string_view *text) {
+  if (data->size() < CHECKSUM_SIZE + 1) {
+    return false;
+  }
+  uint32_t stored_checksum;
+  memcpy(&stored_checksum, data->data(), CHECKSUM_SIZE);
+  string_view record = data->substr(CHECKSUM_SIZE);
+  const char *record_start = record.data();
+
+  *type = static_cast<undo_type_t>(static_cast<unsigned char>(record.front()));
+  record.remove_prefix(1);
+  uint64_t line, pos, size;
+  if (!get_number(&record, &line) || !get_number(&record, &pos) || !get_number(&record, &size) ||
+      size > record.size()) {
+    return false;
+  }
+  *text = record.substr(0, size);
+  record.remove_prefix(size);
+  if (checksum(record_start, record.data() - record_start) != stored_checksum ||
+      *type <= UNDO_NONE || *type > UNDO_BLOCK_END_REDO) {
+    return false;
+  }
+  *start = text_coordinate_t(line, pos);
+  data->remove_prefix(record.data() - data->data());
+  return true;
+}
+
+/* Reads the complete contents of fd. */
+static int read_file(int fd, std::string *contents) {
+  char buffer[65536];
+  off_t offset = 0;
+  contents->clear();
+  while (true) {
+    ssize_t result = pread(fd, buffer, sizeof(buffer), offset);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    } else if (result == 0) {
+      return 0;
+    }
+    contents->append(buffer, result);
+    offset += result;
+  }
+}
+
+/* Calls callback for each valid record in contents, and returns the size of the valid part of
+   contents, or 0 if it does not start with a journal header. */
+static size_t decode_records(const std::string &contents,
+                             const undo_journal_t::replay_callback_t &callback) {
+  if (contents.size() < sizeof(journal_header) ||
+      memcmp(contents.data(), journal_header, sizeof(journal_header)) != 0) {
+    return 0;
+  }
+  string_view data(contents);
+  data.remove_prefix(sizeof(journal_header));
+  undo_type_t type;
+  text_coordinate_t start;
+  string_view text;
+  while (decode_record(&data, &type, &start, &text)) {
+    if (callback && !callback(type, start, text)) {
+      break;
+    }
+  }
+  return contents.size() - data.size();
+}
+
+undo_journal_t::undo_journal_t(int fd, off_t size) : fd_(fd), file_size_(size), error_(0) {}
+
+undo_journal_t::~undo_journal_t() {
+  sync();
+  close(fd_);
+}
+
+std::unique_ptr<undo_journal_t> undo_journal_t::open(int fd, int *error) {
+  std::string contents;
+  if ((*error = read_file(fd, &contents)) != 0) {
+    return nullptr;
+  }
+
+  size_t size = decode_records(contents, replay_callback_t());
+  if (size == 0 && !contents.empty()) {
+    *error = EINVAL;
+    return nullptr;
+  }
+
+  int own_fd = dup(fd);
+  if (own_fd < 0) {
+    *error = errno;
+    return nullptr;
+  }
+  if (size < contents.size() && ftruncate(own_fd, size) < 0) {
+    *error = errno;
+    close(own_fd);
+    return nullptr;
+  }
+  std::unique_ptr<undo_journal_t> journal(new undo_journal_t(own_fd, size));
+  if (size == 0) {
+    journal->pending_.assign(journal_header, sizeof(journal_header));
+  }
+  if ((*error = journal->sync()) != 0) {
+    return nullptr;
+  }
+  return journal;
+}
+
+int undo_journal_t::replay(int fd, const replay_callback_t &callback) {
+  std::string contents;
+  int error = read_file(fd, &contents);
+  if (error != 0) {
+    return error;
+  }
+  if (!contents.empty() && decode_records(contents, callback) == 0) {
+    return EINVAL;
+  }
+  return 0;
+}
+
+void undo_journal_t::append(uint64_t id, bool forward, undo_type_t type, text_coordinate_t start,
+                            string_view text) {
+  if (error_ != 0) {
+    return;
+  }
+  entries_.push_back({id, forward, file_size_ + static_cast<off_t>(pending_.size())});
+
+  size_t record_start = pending_.size();
+  pending_.append(CHECKSUM_SIZE, '\0');
+  pending_.push_back(static_cast<char>(type));
+  put_number(&pending_, start.line);
+  put_number(&pending_, start.pos);
+  put_number(&pending_, text.size());
+  pending_.append(text.data(), text.size());
+  uint32_t record_checksum = checksum(pending_.data() + record_start + CHECKSUM_SIZE,
+                                      pending_.size() - record_start - CHECKSUM_SIZE);
+  memcpy(&pending_[record_start], &record_checksum, CHECKSUM_SIZE);
+
+  if (pending_.size() >= JOURNAL_BATCH_SIZE) {
+    sync();
+  }
+}
+
+bool undo_journal_t::retract(uint64_t id) {
+  if (entries_.empty() || entries_.back().id != id || !entries_.back().forward) {
+    return false;
+  }
+  off_t offset = entries_.back().offset;
+  entries_.pop_back();
+  if (offset >= file_size_) {
+    pending_.resize(offset - file_size_);
+    return true;
+  }
+  // The record has been written already, which means nothing follows it.
+  if (ftruncate(fd_, offset) < 0) {
+    if (error_ == 0) {
+      error_ = errno;
+    }
+  } else {
+    file_size_ = offset;
+  }
+  return true;
+}
+
+void undo_journal_t::reset() {
+  entries_.clear();
+  pending_.clear();
+  if (file_size_ > static_cast<off_t>(sizeof(journal_header))) {
+    if (ftruncate(fd_, sizeof(journal_header)) < 0) {
+      if (error_ == 0) {
+        error_ = errno;
+      }
+      return;
+    }
+    file_size_ = sizeof(journal_header);
+  }
+}
+
+int undo_journal_t::write_pending() {
+  const char *data = pending_.data();
+  size_t size = pending_.size();
+  while (size > 0) {
+    ssize_t result = pwrite(fd_, data, size, file_size_);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    data += result;
+    size -= result;
+    file_size_ += result;
+  }
+  pending_.clear();
+  return 0;
+}
+
+int undo_journal_t::sync() {
+  if (error_ == 0 && !pending_.empty()) {
+    if ((error_ = write_pending()) == 0 && fdatasync(fd_) < 0) {
+      error_ = errno;
+    }
+  }
+  return error_;
+}
+
+}  // namespace t3widget
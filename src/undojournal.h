@@ -0,0 +1,102 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_UNDOJOURNAL_H
+#define T3_WIDGET_UNDOJOURNAL_H
+
+#ifndef _T3_WIDGET_INTERNAL
+#error This header file is for internal use _only_!!
+#endif
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <t3widget/string_view.h>
+#include <t3widget/undo.h>
+#include <t3widget/util.h>
+#include <t3widget/widget_api.h>
+#include <vector>
+
+namespace t3widget {
+
+/** Append-only file recording the operations applied to a text_buffer_t.
+
+    Each record holds the type with which an undo_t was applied (see
+    text_buffer_t::implementation_t::apply_undo_redo), its start coordinate and its text. Replaying
+    the records against the file the buffer was loaded from restores the contents of the buffer.
+    Records are collected in memory, and written and synced to disk in batches.
+
+    To keep the journal proportional to the net change, undoing the most recently recorded
+    operation removes its record instead of adding a new one, and reset discards all records
+    when the buffer has been saved.
+*/
+class T3_WIDGET_LOCAL undo_journal_t {
+ public:
+  typedef std::function<bool(undo_type_t type, text_coordinate_t start, string_view text)>
+      replay_callback_t;
+
+  ~undo_journal_t();
+
+  /** Open a journal for writing. The file descriptor is duplicated.
+
+      Valid records already in the file are kept, and any partially written record at the end is
+      discarded. An empty file is initialized as a new journal.
+      @return The journal, or @c nullptr if the file is not a journal or an error occurred. In the
+          latter case @p error is set to an @c errno value.
+  */
+  static std::unique_ptr<undo_journal_t> open(int fd, int *error);
+  /** Call @p callback for each valid record in the journal in @p fd, until it returns @c false.
+      @return 0 on success, or an @c errno value on failure.
+  */
+  static int replay(int fd, const replay_callback_t &callback);
+
+  /** Append a record for an operation identified by @p id. If @p forward is @c true, the
+      operation can later be retracted with retract. */
+  void append(uint64_t id, bool forward, undo_type_t type, text_coordinate_t start,
+              string_view text);
+  /** Remove the record for operation @p id, if it is the last record and was appended with
+      @p forward set.
+      @return Whether the record was removed.
+  */
+  bool retract(uint64_t id);
+  /** Remove all records. */
+  void reset();
+  /** Write and sync all records appended so far.
+      @return 0 on success, or the @c errno value of the first write that failed.
+  */
+  int sync();
+
+ private:
+  struct entry_t {
+    uint64_t id;
+    bool forward;
+    off_t offset;
+  };
+
+  undo_journal_t(int fd, off_t size);
+  int write_pending();
+
+  int fd_;
+  // Size of the file, and the records appended after it that have not been written yet.
+  off_t file_size_;
+  std::string pending_;
+  // Records in the order they were appended, for retract. Cleared by reset.
+  std::vector<entry_t> entries_;
+  int error_;
+};
+
+}  // namespace t3widget
+
+#endif
@@ -0,0 +1,177 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <cstdint>
+#include <cstring>
+
+#include "t3widget/utf8validate.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace t3widget {
+
+/* Returns the length of the valid UTF-8 sequence starting at ptr, or 0 if the sequence is invalid
+   or truncated. */
+static inline size_t valid_sequence_length(const unsigned char *ptr, const unsigned char *end) {
+  unsigned char c = ptr[0];
+  size_t available = end - ptr;
+
+  if (c < 0x80) {
+    return 1;
+  } else if (c < 0xC2) {
+    // Stray continuation byte or overlong two byte sequence.
+    return 0;
+  } else if (c < 0xE0) {
+    return available >= 2 && (ptr[1] & 0xC0) == 0x80 ? 2 : 0;
+  } else if (c < 0xF0) {
+    if (available < 3 || (ptr[1] & 0xC0) != 0x80 || (ptr[2] & 0xC0) != 0x80) {
+      return 0;
+    }
+    // Reject overlong sequences and surrogates.
+    if ((c == 0xE0 && ptr[1] < 0xA0) || (c == 0xED && ptr[1] >= 0xA0)) {
+      return 0;
+    }
+    return 3;
+  } else if (c < 0xF5) {
+    if (available < 4 || (ptr[1] & 0xC0) != 0x80 || (ptr[2] & 0xC0) != 0x80 ||
+        (ptr[3] & 0xC0) != 0x80) {
+      return 0;
+    }
+    // Reject overlong sequences and code points beyond U+10FFFF.
+    if ((c == 0xF0 && ptr[1] < 0x90) || (c == 0xF4 && ptr[1] >= 0x90)) {
+      return 0;
+    }
+    return 4;
+  }
+  return 0;
+}
+
+/* Validates non-ASCII characters starting at ptr, until either an ASCII byte or an invalid
+   sequence is found. Returns the position at which it stopped. */
+static inline const unsigned char *validate_non_ascii(const unsigned char *ptr,
+                                                      const unsigned char *end) {
+  while (ptr < end && *ptr >= 0x80) {
+    size_t length = valid_sequence_length(ptr, end);
+    if (length == 0) {
+      break;
+    }
+    ptr += length;
+  }
+  return ptr;
+}
+
+static size_t valid_prefix_scalar(const unsigned char *data, size_t size) {
+  const unsigned char *ptr = data;
+  const unsigned char *end = data + size;
+
+  while (ptr < end) {
+    // Skip ASCII a word at a time.
+    while (end - ptr >= 8) {
+      uint64_t word;
+      memcpy(&word, ptr, 8);
+      if (word & UINT64_C(0x8080808080808080)) {
+        break;
+      }
+      ptr += 8;
+    }
+    while (ptr < end && *ptr < 0x80) {
+      ++ptr;
+    }
+    const unsigned char *stop = validate_non_ascii(ptr, end);
+    if (stop < end && *stop >= 0x80) {
+      return stop - data;
+    }
+    ptr = stop;
+  }
+  return size;
+}
+
+#ifdef HAS_X86_SIMD
+__attribute__((target("sse2"))) static size_t valid_prefix_sse2(const unsigned char *data,
+                                                                 size_t size) {
+  const unsigned char *ptr = data;
+  const unsigned char *end = data + size;
+
+  while (ptr < end) {
+    while (end - ptr >= 16) {
+      int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr)));
+      if (mask != 0) {
+        ptr += __builtin_ctz(mask);
+        break;
+      }
+      ptr += 16;
+    }
+    while (ptr < end && *ptr < 0x80) {
+      ++ptr;
+    }
+    const unsigned char *stop = validate_non_ascii(ptr, end);
+    if (stop < end && *stop >= 0x80) {
+      return stop - data;
+    }
+    ptr = stop;
+  }
+  return size;
+}
+
+__attribute__((target("avx2"))) static size_t valid_prefix_avx2(const unsigned char *data,
+                                                                 size_t size) {
+  const unsigned char *ptr = data;
+  const unsigned char *end = data + size;
+
+  while (ptr < end) {
+    while (end - ptr >= 32) {
+      unsigned mask = static_cast<unsigned>(
+          _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr))));
+      if (mask != 0) {
+        ptr += __builtin_ctz(mask);
+        break;
+      }
+      ptr += 32;
+    }
+    while (ptr < end && *ptr < 0x80) {
+      ++ptr;
+    }
+    const unsigned char *stop = validate_non_ascii(ptr, end);
+    if (stop < end && *stop >= 0x80) {
+      return stop - data;
+    }
+    ptr = stop;
+  }
+  return size;
+}
+#endif
+
+typedef size_t (*valid_prefix_func_t)(const unsigned char *data, size_t size);
+
+static valid_prefix_func_t select_valid_prefix() {
+#ifdef HAS_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return valid_prefix_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return valid_prefix_sse2;
+  }
+#endif
+  return valid_prefix_scalar;
+}
+
+size_t utf8_valid_prefix(const char *data, size_t size) {
+  static const valid_prefix_func_t valid_prefix = select_valid_prefix();
+  return valid_prefix(reinterpret_cast<const unsigned char *>(data), size);
+}
+
+}  // namespace t3widget
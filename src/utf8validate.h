@@ -0,0 +1,36 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_UTF8VALIDATE_H
+#define T3_WIDGET_UTF8VALIDATE_H
+
+#ifndef _T3_WIDGET_INTERNAL
+#error This header file is for internal use _only_!!
+#endif
+
+#include <cstddef>
+#include <t3widget/widget_api.h>
+
+namespace t3widget {
+
+/** Returns the length of the longest prefix of @p data that is valid UTF-8.
+
+    The prefix always ends on a character boundary. Overlong encodings, surrogates and code points
+    beyond U+10FFFF are considered invalid, as is a sequence truncated by the end of the data. Runs
+    of ASCII are skipped with SSE2 or AVX2 instructions where the CPU supports them.
+*/
+T3_WIDGET_LOCAL size_t utf8_valid_prefix(const char *data, size_t size);
+
+}  // namespace t3widget
+
+#endif
@@ -341,6 +341,14 @@ enum class rewrap_type_t { REWRAP_ALL, REWRAP_LINE, REWRAP_LINE_LOCAL, INSERT_LI
 
 enum class wrap_type_t { NONE, WORD, CHARACTER };
 
+/** Storage engine used by text_buffer_t to hold its lines.
+
+    @c VECTOR keeps all lines in a single array, which is the most compact choice for small
+    buffers. @c ROPE keeps the lines in a balanced tree of chunks, such that inserting and
+    deleting lines does not require moving all lines that follow. Use it for very large buffers.
+*/
+enum class text_storage_t { VECTOR, ROPE };
+
 #undef _T3_WIDGET_ENUM
 
 struct free_deleter {
@@ -62,6 +62,8 @@ goto_dialog_t *edit_window_t::goto_dialog;
 connection_t edit_window_t::goto_connection;
 find_dialog_t *edit_window_t::global_find_dialog;
 connection_t edit_window_t::global_find_dialog_connection;
+connection_t edit_window_t::global_incremental_find_connection;
+connection_t edit_window_t::global_find_dialog_closed_connection;
 std::shared_ptr<finder_t> edit_window_t::global_finder;
 replace_buttons_dialog_t *edit_window_t::replace_buttons;
 connection_t edit_window_t::replace_buttons_connection;
@@ -70,6 +72,10 @@ connection_t edit_window_t::right_click_menu_connection;
 
 connection_t edit_window_t::init_connected = connect_on_init(edit_window_t::init);
 
+/* Whether the shared find dialog is in incremental mode. This is stored separately, because the
+   dialog is only created by init. */
+static bool incremental_find_enabled = false;
+
 #define _T3_ACTION_FILE "t3widget/widgets/editwindow.actions.h"
 #define _T3_ACTION_TYPE edit_window_t
 #include "t3widget/key_binding_def.h"
@@ -107,9 +113,18 @@ struct edit_window_t::implementation_t {
   find_dialog_t *find_dialog = nullptr;
   bool use_local_finder = false;
   std::shared_ptr<finder_t> finder;          /**< Object used for find actions in the text. */
+  /** Background search for the incremental find, or @c nullptr if none is running. */
+  std::unique_ptr<text_buffer_search_t> incremental_search;
+  /** Whether an incremental find was started since the find dialog was shown. */
+  bool incremental_active = false;
+  /** Position from which the incremental find searches, which is where the cursor was when the
+      find dialog was shown. */
+  text_coordinate_t incremental_start;
   wrap_type_t wrap_type = wrap_type_t::NONE; /**< The wrap_type_t used for display. */
-  wrap_info_t *wrap_info =
-      nullptr; /**< Required information for wrapped display, or @c nullptr if not in use. */
+  /** Required information for wrapped display, or @c nullptr if not in use. This is shared with
+      other edit_window_t's showing the same text with the same settings. */
+  std::shared_ptr<wrap_info_t> wrap_info;
+  connection_t layout_connection; /**< Connection to the layout_changed signal of wrap_info. */
   /** The top-left coordinate in the text.
           This is either a proper text_coordinate_t when wrapping is disabled, or
           a line and sub-line (pos @c member) coordinate when wrapping is enabled.
@@ -152,6 +167,7 @@ void edit_window_t::init(bool _init) {
        gettext therefore returns the correctly localized strings. */
     goto_dialog = new goto_dialog_t();
     global_find_dialog = new find_dialog_t();
+    global_find_dialog->set_incremental(incremental_find_enabled);
     replace_buttons = new replace_buttons_dialog_t();
     right_click_menu = new menu_panel_t("");
     right_click_menu->insert_item(nullptr, _("Cu_t"), "", ACTION_CUT);
@@ -215,7 +231,7 @@ edit_window_t::edit_window_t(text_buffer_t *_text, const behavior_parameters_t *
   set_text(_text == nullptr ? new text_buffer_t() : _text, params);
 }
 
-edit_window_t::~edit_window_t() { delete impl->wrap_info; }
+edit_window_t::~edit_window_t() { impl->layout_connection.disconnect(); }
 
 void edit_window_t::set_text(text_buffer_t *_text, const view_parameters_t *params) {
   if (text == _text) {
@@ -235,13 +251,12 @@ void edit_window_t::set_text(text_buffer_t *_text, const behavior_parameters_t *
   }
 
   text = _text;
+  impl->incremental_search.reset();
+  impl->incremental_active = false;
   if (params != nullptr) {
     params->apply_parameters(this);
   } else {
-    if (impl->wrap_info != nullptr) {
-      impl->wrap_info->set_text_buffer(text);
-      impl->wrap_info->set_wrap_width(impl->edit_window.get_width() - 1);
-    }
+    update_wrap_info();
     impl->top_left.line = 0;
     impl->top_left.pos = 0;
     impl->last_set_pos = 0;
@@ -272,7 +287,7 @@ bool edit_window_t::set_size(optint height, optint width) {
   if (impl->wrap_type != wrap_type_t::NONE) {
     impl->top_left.pos =
         impl->wrap_info->calculate_line_pos(impl->top_left.line, 0, impl->top_left.pos);
-    impl->wrap_info->set_wrap_width(width.value() - 1);
+    update_wrap_info();
     impl->top_left.pos = impl->wrap_info->find_line(impl->top_left);
     impl->last_set_pos = impl->wrap_info->calculate_screen_pos();
   }
@@ -326,16 +341,14 @@ void edit_window_t::ensure_cursor_on_screen() {
       bottom = impl->top_left;
       impl->wrap_info->add_lines(bottom, impl->edit_window.get_height() - 1);
 
-      while (cursor.line > bottom.line) {
-        impl->wrap_info->add_lines(impl->top_left,
-                                   impl->wrap_info->get_line_count(bottom.line) - bottom.pos);
-        bottom.line++;
-        bottom.pos = 0;
-        update_repaint_lines(0, std::numeric_limits<text_pos_t>::max());
-      }
-
-      if (cursor.line == bottom.line && sub_line > bottom.pos) {
-        impl->wrap_info->add_lines(impl->top_left, sub_line - bottom.pos);
+      /* Rather than moving the top line down until the cursor is on the bottom line, which takes
+         time proportional to the distance, count back from the cursor. */
+      if (cursor.line > bottom.line || (cursor.line == bottom.line && sub_line > bottom.pos)) {
+        impl->top_left.line = cursor.line;
+        impl->top_left.pos = sub_line;
+        if (impl->edit_window.get_height() > 1) {
+          impl->wrap_info->sub_lines(impl->top_left, impl->edit_window.get_height() - 1);
+        }
         update_repaint_lines(0, std::numeric_limits<text_pos_t>::max());
       }
     }
@@ -769,8 +782,12 @@ void edit_window_t::delete_selection() {
 
 void edit_window_t::find_activated(std::shared_ptr<finder_t> _finder, find_action_t action) {
   find_result_t result;
+  bool incremental = false;
 
   if (_finder) {
+    incremental = impl->incremental_active;
+    impl->incremental_search.reset();
+    impl->incremental_active = false;
     if (impl->use_local_finder) {
       impl->finder = _finder;
     } else {
@@ -781,6 +798,11 @@ void edit_window_t::find_activated(std::shared_ptr<finder_t> _finder, find_actio
 
   switch (action) {
     case find_action_t::FIND:
+      if (incremental) {
+        // Search from the same position as the incremental find, to select the match it showed.
+        reset_selection();
+        text->set_cursor(impl->incremental_start);
+      }
       result.start = text->get_cursor();
 
       if (!text->find(local_finder, &result)) {
@@ -1253,11 +1275,7 @@ void edit_window_t::update_contents() {
         std::max(text->size(), impl->top_left.line + impl->edit_window.get_height()),
         impl->top_left.line, impl->edit_window.get_height());
   } else {
-    text_pos_t count = 0;
-    for (text_pos_t i = 0; i < impl->top_left.line; i++) {
-      count += impl->wrap_info->get_line_count(i);
-    }
-    count += impl->top_left.pos;
+    text_pos_t count = impl->wrap_info->to_wrapped_line(impl->top_left);
 
     impl->scrollbar->set_parameters(
         std::max(impl->wrap_info->wrapped_size(), count + impl->edit_window.get_height()), count,
@@ -1451,6 +1469,12 @@ void edit_window_t::find_replace(bool replace) {
     global_find_dialog_connection.disconnect();
     global_find_dialog_connection =
         global_find_dialog->connect_activate(bind_front(&edit_window_t::find_activated, this));
+    global_incremental_find_connection.disconnect();
+    global_incremental_find_connection = global_find_dialog->connect_incremental_find(
+        bind_front(&edit_window_t::incremental_find, this));
+    global_find_dialog_closed_connection.disconnect();
+    global_find_dialog_closed_connection =
+        global_find_dialog->connect_closed(bind_front(&edit_window_t::find_dialog_closed, this));
     dialog = global_find_dialog;
   } else {
     dialog = impl->find_dialog;
@@ -1458,6 +1482,14 @@ void edit_window_t::find_replace(bool replace) {
   dialog->center_over(center_window);
   dialog->set_replace(replace);
 
+  impl->incremental_search.reset();
+  impl->incremental_active = false;
+  if (text->selection_empty()) {
+    impl->incremental_start = text->get_cursor();
+  } else {
+    impl->incremental_start = std::min(text->get_selection_start(), text->get_selection_end());
+  }
+
   if (!text->selection_empty() &&
       text->get_selection_start().line == text->get_selection_end().line) {
     std::unique_ptr<std::string> selected_text(
@@ -1467,6 +1499,45 @@ void edit_window_t::find_replace(bool replace) {
   dialog->show();
 }
 
+void edit_window_t::incremental_find(std::shared_ptr<finder_t> finder) {
+  // Destroying the previous search cancels it.
+  impl->incremental_search.reset();
+  impl->incremental_active = true;
+  if (finder == nullptr) {
+    return;
+  }
+  if (impl->incremental_start.line >= text->size()) {
+    impl->incremental_start = text->get_cursor();
+  }
+  impl->incremental_search = text->find_next(*finder, impl->incremental_start);
+  impl->incremental_search->connect_done(bind_front(&edit_window_t::incremental_find_done, this));
+}
+
+void edit_window_t::incremental_find_done() {
+  const std::vector<find_result_t> &matches = impl->incremental_search->get_matches();
+  reset_selection();
+  if (matches.empty() || matches.front().end.line >= text->size()) {
+    text->set_cursor(impl->incremental_start);
+  } else {
+    text->set_selection_from_find(matches.front());
+    update_repaint_lines(matches.front().start.line, matches.front().end.line);
+  }
+  ensure_cursor_on_screen();
+}
+
+void edit_window_t::find_dialog_closed() {
+  impl->incremental_search.reset();
+  if (!impl->incremental_active) {
+    return;
+  }
+  impl->incremental_active = false;
+  reset_selection();
+  if (impl->incremental_start.line < text->size()) {
+    text->set_cursor(impl->incremental_start);
+  }
+  ensure_cursor_on_screen();
+}
+
 void edit_window_t::find_next(bool backward) {
   find_result_t result;
   if (text->get_selection_mode() == selection_mode_t::NONE) {
@@ -1504,6 +1575,13 @@ void edit_window_t::set_find_dialog(find_dialog_t *_find_dialog) {
   impl->find_dialog = _find_dialog;
 }
 
+void edit_window_t::set_incremental_find(bool incremental) {
+  incremental_find_enabled = incremental;
+  if (global_find_dialog != nullptr) {
+    global_find_dialog->set_incremental(incremental);
+  }
+}
+
 void edit_window_t::set_use_local_finder(bool _use_local_finder) {
   impl->use_local_finder = _use_local_finder;
 }
@@ -1519,9 +1597,7 @@ void edit_window_t::set_tabsize(int _tabsize) {
     return;
   }
   impl->tabsize = _tabsize;
-  if (impl->wrap_info != nullptr) {
-    impl->wrap_info->set_tabsize(impl->tabsize);
-  }
+  update_wrap_info();
   force_redraw();
 }
 
@@ -1610,26 +1686,30 @@ void edit_window_t::set_wrap(wrap_type_t wrap) {
     return;
   }
 
+  impl->wrap_type = wrap;
+  update_wrap_info();
   if (wrap == wrap_type_t::NONE) {
     impl->top_left.pos = 0;
-    if (impl->wrap_info != nullptr) {
-      delete impl->wrap_info;
-      impl->wrap_info = nullptr;
-    }
   } else {
-    // FIXME: differentiate between wrap types
-    if (impl->wrap_info == nullptr) {
-      impl->wrap_info = new wrap_info_t(impl->edit_window.get_width() - 1, impl->tabsize);
-    }
-    impl->wrap_info->set_text_buffer(text);
-    impl->wrap_info->set_wrap_width(impl->edit_window.get_width() - 1);
     impl->top_left.pos = impl->wrap_info->find_line(impl->top_left);
   }
-  impl->wrap_type = wrap;
   update_repaint_lines(0, std::numeric_limits<text_pos_t>::max());
   ensure_cursor_on_screen();
 }
 
+void edit_window_t::update_wrap_info() {
+  impl->layout_connection.disconnect();
+  if (impl->wrap_type == wrap_type_t::NONE) {
+    impl->wrap_info.reset();
+    return;
+  }
+  wrap_info_t::get_shared(&impl->wrap_info, text, impl->edit_window.get_width() - 1,
+                          impl->tabsize, impl->wrap_type);
+  // Only the scrollbar depends on the parts of the text that are wrapped in the background.
+  impl->layout_connection =
+      impl->wrap_info->connect_layout_changed([this] { widget_t::force_redraw(); });
+}
+
 void edit_window_t::set_tab_spaces(bool _tab_spaces) { impl->tab_spaces = _tab_spaces; }
 
 void edit_window_t::set_auto_indent(bool _auto_indent) { impl->auto_indent = _auto_indent; }
@@ -1705,16 +1785,8 @@ void edit_window_t::activate_autocomplete(bool autocomplete_single) {
     } else {
       text_pos_t sub_line = impl->wrap_info->find_line(cursor);
       text_pos_t position = impl->wrap_info->calculate_screen_pos(anchor);
-      text_pos_t line;
-
-      if (cursor.line == impl->top_left.line) {
-        line = sub_line - impl->top_left.pos;
-      } else {
-        line = impl->wrap_info->get_line_count(impl->top_left.line) - impl->top_left.pos + sub_line;
-        for (text_pos_t i = impl->top_left.line + 1; i < cursor.line; i++) {
-          line += impl->wrap_info->get_line_count(i);
-        }
-      }
+      text_pos_t line = impl->wrap_info->to_wrapped_line(text_coordinate_t(cursor.line, sub_line)) -
+                        impl->wrap_info->to_wrapped_line(impl->top_left);
       impl->autocomplete_panel->set_position(line + 1, position - 1);
     }
     impl->autocomplete_panel->show();
@@ -1747,25 +1819,18 @@ text_coordinate_t edit_window_t::xy_to_text_coordinate(int x, int y) const {
       coord.pos = text->calculate_line_pos(coord.line, x_pos, impl->tabsize);
     }
   } else {
-    coord.line = impl->top_left.line;
-    y_pos += impl->top_left.pos;
-    while (y_pos < 0 && coord.line > 0) {
-      coord.line--;
-      y_pos += impl->wrap_info->get_line_count(coord.line);
-    }
-    while (coord.line < impl->wrap_info->unwrapped_size() - 1 &&
-           y_pos >= impl->wrap_info->get_line_count(coord.line)) {
-      y_pos -= impl->wrap_info->get_line_count(coord.line);
-      coord.line++;
-    }
-    if (y_pos >= impl->wrap_info->get_line_count(coord.line)) {
-      y_pos = impl->wrap_info->get_line_count(coord.line) - 1;
-      x_pos = std::numeric_limits<text_pos_t>::max();
-    }
+    y_pos += impl->wrap_info->to_wrapped_line(impl->top_left);
     if (y_pos < 0) {
+      coord.line = 0;
       coord.pos = 0;
     } else {
-      coord.pos = impl->wrap_info->calculate_line_pos(coord.line, x_pos, y_pos);
+      if (y_pos >= impl->wrap_info->wrapped_size()) {
+        coord = impl->wrap_info->get_end();
+        x_pos = std::numeric_limits<text_pos_t>::max();
+      } else {
+        coord = impl->wrap_info->from_wrapped_line(y_pos);
+      }
+      coord.pos = impl->wrap_info->calculate_line_pos(coord.line, x_pos, coord.pos);
     }
   }
   return coord;
@@ -1821,25 +1886,12 @@ void edit_window_t::scrollbar_dragged(text_pos_t start) {
       update_repaint_lines(0, std::numeric_limits<text_pos_t>::max());
     }
   } else {
-    text_coordinate_t new_top_left(0, 0);
-    text_pos_t count = 0;
-
     if (start < 0 || start + impl->edit_window.get_height() > impl->wrap_info->wrapped_size()) {
       return;
     }
 
-    for (new_top_left.line = 0; new_top_left.line < text->size() && count < start;
-         new_top_left.line++) {
-      count += impl->wrap_info->get_line_count(new_top_left.line);
-    }
-
-    if (count > start) {
-      new_top_left.line--;
-      count -= impl->wrap_info->get_line_count(new_top_left.line);
-      new_top_left.pos = start - count;
-    }
-
-    if (new_top_left == impl->top_left || new_top_left.line < 0) {
+    text_coordinate_t new_top_left = impl->wrap_info->from_wrapped_line(start);
+    if (new_top_left == impl->top_left) {
       return;
     }
     impl->top_left = new_top_left;
@@ -1945,8 +1997,8 @@ void edit_window_t::view_parameters_t::apply_parameters(edit_window_t *view) con
   view->set_wrap(wrap_type);
   /* view->set_wrap will make sure that view->wrap_info is nullptr if
      wrap_type != NONE. */
+  view->update_wrap_info();
   if (view->impl->wrap_info != nullptr) {
-    view->impl->wrap_info->set_text_buffer(view->text);
     view->impl->top_left.pos = view->impl->wrap_info->find_line(top_left);
   }
   // the calling function will call ensure_cursor_on_screen
@@ -2022,8 +2074,8 @@ void edit_window_t::behavior_parameters_t::apply_parameters(edit_window_t *view)
   view->set_wrap(impl->wrap_type);
   /* view->set_wrap will make sure that view->wrap_info is nullptr if
      wrap_type != NONE. */
+  view->update_wrap_info();
   if (view->impl->wrap_info != nullptr) {
-    view->impl->wrap_info->set_text_buffer(view->text);
     view->impl->top_left.pos = view->impl->wrap_info->find_line(impl->top_left);
   }
   // the calling function will call ensure_cursor_on_screen
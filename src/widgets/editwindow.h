@@ -54,6 +54,8 @@ class T3_WIDGET_API edit_window_t : public widget_t,
   static connection_t goto_connection;
   static find_dialog_t *global_find_dialog;
   static connection_t global_find_dialog_connection;
+  static connection_t global_incremental_find_connection;
+  static connection_t global_find_dialog_closed_connection;
   static std::shared_ptr<finder_t> global_finder;
   static replace_buttons_dialog_t *replace_buttons;
   static connection_t replace_buttons_connection;
@@ -102,8 +104,19 @@ class T3_WIDGET_API edit_window_t : public widget_t,
 
   /** The find or replace action has been activated in the find or replace buttons dialog. */
   void find_activated(std::shared_ptr<finder_t> finder, find_action_t action);
+  /** The search was changed in the find dialog, while in incremental mode. Starts searching for the
+      first match from where the cursor was when the find dialog was shown, in the background. */
+  void incremental_find(std::shared_ptr<finder_t> finder);
+  /** Select the match found by the search started by incremental_find. */
+  void incremental_find_done();
+  /** The find dialog was closed without searching. Cancels the incremental find, and moves the
+      cursor back to where it was when the find dialog was shown. */
+  void find_dialog_closed();
   /** Handle setting of the wrap mode. */
   void set_wrap_internal(wrap_type_t wrap);
+  /** Get the wrap_info_t for the current text, width, tab size and wrap type, or release it if
+      wrapping is disabled. */
+  void update_wrap_info();
 
   void scroll(text_pos_t lines);
   void scrollbar_clicked(scrollbar_t::step_t step);
@@ -248,6 +261,13 @@ class T3_WIDGET_API edit_window_t : public widget_t,
       The finder_t is used for example for the find-next action.
   */
   void set_use_local_finder(bool _use_local_finder);
+  /** Set whether the shared find dialog searches while the user types.
+      See find_dialog_t::set_incremental for details. The match is searched for in the background,
+      and selected once it has been found. Cancelling the dialog moves the cursor back to where it
+      was when the dialog was shown. This does not apply to a find_dialog_t set with
+      set_find_dialog.
+  */
+  static void set_incremental_find(bool incremental);
 
   /** Set the size of a tab. */
   void set_tabsize(int _tabsize);
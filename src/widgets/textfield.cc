@@ -124,6 +124,7 @@ struct text_field_t::implementation_t {
 
   std::unique_ptr<drop_down_list_t> drop_down_list;
   signal_t<> activate;
+  signal_t<> changed;
 
   implementation_t()
       : pos(0),
@@ -140,6 +141,11 @@ struct text_field_t::implementation_t {
         filter_keys_size(0),
         filter_keys_accept(true),
         label(nullptr) {}
+
+  void set_edited() {
+    edited = true;
+    changed();
+  }
 };
 
 text_field_t::text_field_t()
@@ -200,7 +206,7 @@ void text_field_t::delete_selection(bool save_to_copy_buffer) {
   ensure_cursor_on_screen();
   reset_selection();
   force_redraw();
-  impl->edited = true;
+  impl->set_edited();
 }
 
 bool text_field_t::process_key(key_t key) {
@@ -234,7 +240,7 @@ bool text_field_t::process_key(key_t key) {
           impl->pos = newpos;
           ensure_cursor_on_screen();
           force_redraw();
-          impl->edited = true;
+          impl->set_edited();
         }
       }
       break;
@@ -247,7 +253,7 @@ bool text_field_t::process_key(key_t key) {
         impl->pos = newpos;
         ensure_cursor_on_screen();
         force_redraw();
-        impl->edited = true;
+        impl->set_edited();
       }
       break;
     case EKEY_DEL:
@@ -256,7 +262,7 @@ bool text_field_t::process_key(key_t key) {
       } else if (impl->pos < impl->line->size()) {
         impl->line->delete_char(impl->pos, nullptr);
         force_redraw();
-        impl->edited = true;
+        impl->set_edited();
       }
       break;
     case EKEY_LEFT:
@@ -382,7 +388,7 @@ bool text_field_t::process_key(key_t key) {
               impl->pos += cursor_move;
               ensure_cursor_on_screen();
               force_redraw();
-              impl->edited = true;
+              impl->set_edited();
             }
             return true;
           }
@@ -452,7 +458,7 @@ bool text_field_t::process_key(key_t key) {
       impl->pos = impl->line->adjust_position(impl->pos, 1);
       ensure_cursor_on_screen();
       force_redraw();
-      impl->edited = true;
+      impl->set_edited();
     }
   }
 
@@ -722,6 +728,7 @@ void text_field_t::set_selection_end(bool update_primary) {
 bool text_field_t::has_focus() const { return impl->focus; }
 
 _T3_WIDGET_IMPL_SIGNAL(text_field_t, activate)
+_T3_WIDGET_IMPL_SIGNAL(text_field_t, changed)
 
 /*======================
   == drop_down_list_t ==
@@ -92,6 +92,8 @@ class T3_WIDGET_API text_field_t : public widget_t,
   bool process_mouse_event(mouse_event_t event) override;
 
   T3_WIDGET_DECLARE_SIGNAL(activate);
+  /** Signal emitted when the user changes the text. It is not emitted for set_text. */
+  T3_WIDGET_DECLARE_SIGNAL(changed);
 
 #define _T3_ACTION_FILE <t3widget/widgets/textfield.actions.h>
 #include <t3widget/key_binding_decl.h>
@@ -42,6 +42,13 @@ struct text_window_t::implementation_t {
   bool focus;
 
   implementation_t() : top(0, 0), focus(false) {}
+
+  /* Change the wrap width, keeping the same text at the top of the window. */
+  void set_wrap_width(int width) {
+    top.pos = wrap_info->calculate_line_pos(top.line, 0, top.pos);
+    wrap_info->set_wrap_width(width);
+    top.pos = wrap_info->find_line(top);
+  }
 };
 
 text_window_t::text_window_t(text_buffer_t *_text, bool with_scrollbar)
@@ -67,6 +74,7 @@ text_window_t::text_window_t(text_buffer_t *_text, bool with_scrollbar)
 
   impl->wrap_info.reset(new wrap_info_t(impl->scrollbar != nullptr ? 11 : 12));
   impl->wrap_info->set_text_buffer(impl->text);
+  impl->wrap_info->connect_layout_changed([this] { force_redraw(); });
 }
 
 text_window_t::~text_window_t() {}
@@ -100,9 +108,9 @@ bool text_window_t::set_size(optint height, optint width) {
   result &= window.resize(height.value(), width.value());
   if (impl->scrollbar != nullptr) {
     result &= impl->scrollbar->set_size(height, None);
-    impl->wrap_info->set_wrap_width(width.value());
+    impl->set_wrap_width(width.value());
   } else {
-    impl->wrap_info->set_wrap_width(width.value() + 1);
+    impl->set_wrap_width(width.value() + 1);
   }
 
   return result;
@@ -117,10 +125,10 @@ void text_window_t::set_scrollbar(bool with_scrollbar) {
     set_widget_parent(impl->scrollbar.get());
     impl->scrollbar->set_anchor(this, T3_PARENT(T3_ANCHOR_TOPRIGHT) | T3_CHILD(T3_ANCHOR_TOPRIGHT));
     impl->scrollbar->set_size(window.get_height(), None);
-    impl->wrap_info->set_wrap_width(window.get_width());
+    impl->set_wrap_width(window.get_width());
   } else {
     impl->scrollbar = nullptr;
-    impl->wrap_info->set_wrap_width(window.get_width() + 1);
+    impl->set_wrap_width(window.get_width() + 1);
   }
   force_redraw();
 }
@@ -233,11 +241,7 @@ void text_window_t::update_contents() {
 
   window.clrtobot();
 
-  text_pos_t count = 0;
-  for (text_pos_t i = 0; i < impl->top.line; i++) {
-    count += impl->wrap_info->get_line_count(i);
-  }
-  count += impl->top.pos;
+  text_pos_t count = impl->wrap_info->to_wrapped_line(impl->top);
 
   if (impl->scrollbar != nullptr) {
     impl->scrollbar->set_parameters(
@@ -303,25 +307,12 @@ void text_window_t::scrollbar_clicked(scrollbar_t::step_t step) {
 }
 
 void text_window_t::scrollbar_dragged(text_pos_t start) {
-  text_coordinate_t new_top_left(0, 0);
-  text_pos_t count = 0;
-
   if (start < 0 || start + window.get_height() > impl->wrap_info->wrapped_size()) {
     return;
   }
 
-  for (new_top_left.line = 0; new_top_left.line < impl->text->size() && count < start;
-       new_top_left.line++) {
-    count += impl->wrap_info->get_line_count(new_top_left.line);
-  }
-
-  if (count > start) {
-    new_top_left.line--;
-    count -= impl->wrap_info->get_line_count(new_top_left.line);
-    new_top_left.pos = start - count;
-  }
-
-  if (new_top_left == impl->top || new_top_left.line < 0) {
+  text_coordinate_t new_top_left = impl->wrap_info->from_wrapped_line(start);
+  if (new_top_left == impl->top) {
     return;
   }
   impl->top = new_top_left;
@@ -14,91 +14,486 @@
 
 #include "t3widget/wrapinfo.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <limits>
+#include <map>
 #include <memory>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
 #include "t3widget/internal.h"
+#include "t3widget/key.h"
+#include "t3widget/linestorage.h"
 #include "t3widget/log.h"
+#include "t3widget/main.h"
 #include "t3widget/textbuffer.h"
 #include "t3widget/textbuffer_impl.h"
 #include "t3widget/util.h"
 
 namespace t3widget {
 
+/* The number of bytes of text, approximately, that rewrap_stale wraps per call. */
+#define REWRAP_BATCH_SIZE 65536
+/* The number of lines handed to a thread at a time by wrap_all. */
+#define WRAP_ALL_BLOCK_LINES 16384
+/* The number of lines per entry of the Fenwick tree. Within a block, the counts of the individual
+   lines are summed. */
+#define INDEX_BLOCK_LINES 64
+/* add_lines and sub_lines step through the lines for distances up to this number of wrapped
+   lines, which keeps the result exact when stale lines are involved. Longer distances are
+   covered using the index. */
+#define MAX_STEP_LINES 1024
+
+// Flag in line_entries marking stale lines.
+static const uint32_t STALE_LINE = UINT32_C(1) << 31;
+// Flag in the count of an entry in wrap_points, indicating that wrap points take two words each.
+static const uint32_t WIDE_POINTS = UINT32_C(1) << 31;
+
+/* The wrap_info_t's handed out by get_shared. The entries are removed when the wrap_info_t is
+   destroyed, i.e. when its last user releases it. */
+typedef std::tuple<const text_buffer_t *, int, int, wrap_type_t> layout_key_t;
+static std::map<layout_key_t, std::weak_ptr<wrap_info_t>> shared_layouts;
+
 wrap_info_t::wrap_info_t(int width, int _tabsize)
-    : text(nullptr), tabsize(_tabsize), wrap_width(width), size(0) {}
+    : unused_points(0),
+      text(nullptr),
+      tabsize(_tabsize),
+      wrap_width(width),
+      wrap_type(wrap_type_t::WORD),
+      shared(false),
+      size(0),
+      index_valid(0),
+      stale_count(0),
+      next_stale(0),
+      rewrap_scheduled(false) {}
 
 wrap_info_t::~wrap_info_t() {
-  rewrap_connection.disconnect();
-  for (wrap_points_t *iter : wrap_data) {
-    delete iter;
+  if (shared) {
+    shared_layouts.erase(layout_key_t(text, wrap_width, tabsize, wrap_type));
   }
+  rewrap_connection.disconnect();
+  idle_connection.disconnect();
 }
 
-text_pos_t wrap_info_t::unwrapped_size() const { return wrap_data.size(); }
+text_pos_t wrap_info_t::unwrapped_size() const { return line_entries.size(); }
 text_pos_t wrap_info_t::wrapped_size() const { return size; }
 
+bool wrap_info_t::is_stale(text_pos_t line) const { return line_entries[line] & STALE_LINE; }
+
+text_pos_t wrap_info_t::raw_line_count(text_pos_t line) const {
+  uint32_t entry = line_entries[line] & ~STALE_LINE;
+  return entry == 0 ? 1 : wrap_points[entry - 1] & ~WIDE_POINTS;
+}
+
+text_pos_t wrap_info_t::wrap_point(text_pos_t line, text_pos_t sub_line) const {
+  uint32_t entry = line_entries[line] & ~STALE_LINE;
+  if (sub_line == 0) {
+    return 0;
+  }
+  const uint32_t *points = &wrap_points[entry];
+  if (wrap_points[entry - 1] & WIDE_POINTS) {
+    points += 2 * (sub_line - 1);
+    return static_cast<text_pos_t>((static_cast<uint64_t>(points[0]) << 32) | points[1]);
+  }
+  return points[sub_line - 1];
+}
+
+void wrap_info_t::release_entry(text_pos_t line) const {
+  uint32_t entry = line_entries[line] & ~STALE_LINE;
+  if (entry == 0) {
+    return;
+  }
+  size_t entry_size = 1;
+  if (!is_stale(line)) {
+    uint32_t count = wrap_points[entry - 1];
+    entry_size += (count & WIDE_POINTS ? 2 : 1) * ((count & ~WIDE_POINTS) - 1);
+  }
+  unused_points += entry_size;
+}
+
+void wrap_info_t::new_entry(text_pos_t line) const {
+  release_entry(line);
+  if (unused_points > 4096 && unused_points > wrap_points.size() / 2) {
+    compact_wrap_points();
+  }
+  ASSERT(wrap_points.size() < STALE_LINE - 1);
+  line_entries[line] = wrap_points.size() + 1;
+}
+
+void wrap_info_t::set_wrap_points(text_pos_t line, const text_pos_t *points, size_t count) const {
+  if (count == 0) {
+    release_entry(line);
+    line_entries[line] = 0;
+    return;
+  }
+
+  bool wide = points[count - 1] > UINT32_MAX;
+  ASSERT(count < WIDE_POINTS - 1);
+  new_entry(line);
+  wrap_points.push_back((count + 1) | (wide ? WIDE_POINTS : 0));
+  for (size_t i = 0; i < count; ++i) {
+    if (wide) {
+      wrap_points.push_back(static_cast<uint64_t>(points[i]) >> 32);
+    }
+    wrap_points.push_back(static_cast<uint32_t>(points[i]));
+  }
+}
+
+void wrap_info_t::set_stale(text_pos_t line, text_pos_t estimate) const {
+  if (estimate == 1) {
+    release_entry(line);
+    line_entries[line] = STALE_LINE;
+    return;
+  }
+  ASSERT(estimate < WIDE_POINTS);
+  new_entry(line);
+  line_entries[line] |= STALE_LINE;
+  wrap_points.push_back(estimate);
+}
+
+void wrap_info_t::compact_wrap_points() const {
+  std::vector<uint32_t> compacted;
+  compacted.reserve(wrap_points.size() - unused_points);
+  for (uint32_t &line_entry : line_entries) {
+    uint32_t entry = line_entry & ~STALE_LINE;
+    if (entry == 0) {
+      continue;
+    }
+    uint32_t count = wrap_points[entry - 1];
+    size_t entry_size = 1;
+    if (!(line_entry & STALE_LINE)) {
+      entry_size += (count & WIDE_POINTS ? 2 : 1) * ((count & ~WIDE_POINTS) - 1);
+    }
+    line_entry = (compacted.size() + 1) | (line_entry & STALE_LINE);
+    compacted.insert(compacted.end(), wrap_points.begin() + (entry - 1),
+                     wrap_points.begin() + (entry - 1 + entry_size));
+  }
+  wrap_points.swap(compacted);
+  unused_points = 0;
+}
+
+text_pos_t wrap_info_t::index_block_count(text_pos_t block) const {
+  text_pos_t result = 0;
+  text_pos_t end = std::min<text_pos_t>((block + 1) * INDEX_BLOCK_LINES, line_entries.size());
+  for (text_pos_t i = block * INDEX_BLOCK_LINES; i < end; i++) {
+    result += raw_line_count(i);
+  }
+  return result;
+}
+
+void wrap_info_t::invalidate_index(text_pos_t line) {
+  line_index.resize((line_entries.size() + INDEX_BLOCK_LINES - 1) / INDEX_BLOCK_LINES);
+  index_valid = std::min(index_valid, line / INDEX_BLOCK_LINES);
+}
+
+void wrap_info_t::update_index(text_pos_t line, text_pos_t delta) const {
+  // Entries from index_valid onward are recomputed when needed, so don't bother updating them.
+  for (text_pos_t block = line / INDEX_BLOCK_LINES; block < index_valid; block |= block + 1) {
+    line_index[block] += delta;
+  }
+}
+
+void wrap_info_t::build_index(text_pos_t end) const {
+  for (; index_valid < end; index_valid++) {
+    // Entry i holds the sum of the counts for blocks (i & (i + 1)) up to and including i. The
+    // entries for the blocks before i within that range are combined from their own entries.
+    text_pos_t value = index_block_count(index_valid);
+    text_pos_t first = index_valid & (index_valid + 1);
+    for (text_pos_t i = index_valid - 1; i >= first; i = (i & (i + 1)) - 1) {
+      value += line_index[i];
+    }
+    line_index[index_valid] = value;
+  }
+}
+
+text_pos_t wrap_info_t::to_wrapped_line(text_coordinate_t coord) const {
+  ensure_wrapped(coord.line);
+  text_pos_t block = coord.line / INDEX_BLOCK_LINES;
+  build_index(block);
+  text_pos_t result = coord.pos;
+  for (text_pos_t i = block - 1; i >= 0; i = (i & (i + 1)) - 1) {
+    result += line_index[i];
+  }
+  for (text_pos_t i = block * INDEX_BLOCK_LINES; i < coord.line; i++) {
+    result += raw_line_count(i);
+  }
+  return result;
+}
+
+text_coordinate_t wrap_info_t::from_wrapped_line(text_pos_t wrapped_line) const {
+  ASSERT(wrapped_line >= 0 && wrapped_line < size);
+  text_pos_t blocks = line_index.size();
+  build_index(blocks);
+
+  text_pos_t step = 1;
+  while (step * 2 <= blocks) {
+    step *= 2;
+  }
+  /* Find the number of blocks for which the total number of wrapped lines does not exceed
+     wrapped_line. The entry at block + step - 1 covers exactly the blocks block up to
+     block + step - 1, because block is always a multiple of 2 * step. */
+  text_pos_t block = 0;
+  for (; step > 0; step >>= 1) {
+    if (block + step <= blocks && line_index[block + step - 1] <= wrapped_line) {
+      block += step;
+      wrapped_line -= line_index[block - 1];
+    }
+  }
+  text_pos_t line = block * INDEX_BLOCK_LINES;
+  text_pos_t last = static_cast<text_pos_t>(line_entries.size()) - 1;
+  while (line < last && wrapped_line >= raw_line_count(line)) {
+    wrapped_line -= raw_line_count(line);
+    line++;
+  }
+  // The count for the line may have been an estimate, which is corrected by wrapping it.
+  return text_coordinate_t(line, std::min(wrapped_line, get_line_count(line) - 1));
+}
+
 void wrap_info_t::delete_lines(text_pos_t first, text_pos_t last) {
-  for (wrap_data_t::iterator iter = wrap_data.begin() + first; iter != wrap_data.begin() + last;
-       iter++) {
-    size -= (*iter)->size();
-    delete *iter;
+  for (text_pos_t i = first; i < last; i++) {
+    size -= raw_line_count(i);
+    if (is_stale(i)) {
+      stale_count--;
+    }
+    release_entry(i);
   }
-  wrap_data.erase(wrap_data.begin() + first, wrap_data.begin() + last);
+  line_entries.erase(line_entries.begin() + first, line_entries.begin() + last);
+  invalidate_index(first);
 }
 
 void wrap_info_t::insert_lines(text_pos_t first, text_pos_t last) {
-  text_pos_t i;
-  for (i = first; i < last; i++) {
-    wrap_data.insert(wrap_data.begin() + i, new wrap_points_t());
-    // Ensure that the list of break positions contains at least the start position.
-    wrap_data[i]->push_back(0);
-    size++;
-    rewrap_line(i, 0, true);
-  }
+  /* The new lines are wrapped when they are first used, or in the background. Until then, they
+     are counted as a single line. */
+  line_entries.insert(line_entries.begin() + first, last - first, STALE_LINE);
+  size += last - first;
+  stale_count += last - first;
+  invalidate_index(first);
+  schedule_rewrap();
 }
 
 void wrap_info_t::rewrap_line(text_pos_t line, text_pos_t pos, bool local) {
   text_line_t::break_pos_t break_pos;
-  size_t i;
+  text_pos_t i;
+
+  if (is_stale(line)) {
+    wrap_stale_line(line);
+    return;
+  }
 
   /* The list of break positions always contains the start position (0). */
 
-  for (i = wrap_data[line]->size() - 1; i > 0 && (*wrap_data[line])[i] > pos; i--) {
+  text_pos_t count = raw_line_count(line);
+  for (i = count - 1; i > 0 && wrap_point(line, i) > pos; i--) {
   }
 
   if (local) {
-    break_pos = text->impl->lines[line]->find_next_break_pos((*wrap_data[line])[i], wrap_width - 1,
-                                                             tabsize);
-    if (i < wrap_data[line]->size() - 1 && break_pos.pos == (*wrap_data[line])[i + 1]) {
+    break_pos = find_next_break_pos(*text->impl->get_line(line), wrap_point(line, i));
+    if (i < count - 1 && break_pos.pos == wrap_point(line, i + 1)) {
       return;
     }
   }
+  wrap_from(line, i);
+}
 
-  /* Keep it simple: subtract the full size here, and add the full size again
-     when we are done rewrapping. */
-  size -= wrap_data[line]->size();
-  wrap_data[line]->erase(wrap_data[line]->begin() + i + 1, wrap_data[line]->end());
+text_line_t::break_pos_t wrap_info_t::find_next_break_pos(const text_line_t &line,
+                                                          text_pos_t start) const {
+  if (wrap_type == wrap_type_t::CHARACTER) {
+    return line.find_next_char_break_pos(start, wrap_width - 1, tabsize);
+  }
+  return line.find_next_break_pos(start, wrap_width - 1, tabsize);
+}
 
+void wrap_info_t::wrap_from(text_pos_t line, text_pos_t sub_line) const {
+  text_line_t::break_pos_t break_pos;
+
+  // Keep the wrap points before sub_line, and compute the rest again.
+  new_points.clear();
+  for (text_pos_t i = 1; i <= sub_line; i++) {
+    new_points.push_back(wrap_point(line, i));
+  }
+
+  const text_line_t *text_line = text->impl->get_line(line);
   while (true) {
-    break_pos = text->impl->lines[line]->find_next_break_pos(wrap_data[line]->back(),
-                                                             wrap_width - 1, tabsize);
+    break_pos = find_next_break_pos(*text_line, new_points.empty() ? 0 : new_points.back());
     if (break_pos.pos > 0) {
-      wrap_data[line]->push_back(break_pos.pos);
+      new_points.push_back(break_pos.pos);
     } else {
       break;
     }
   }
-  size += wrap_data[line]->size();
+
+  text_pos_t old_count = raw_line_count(line);
+  set_wrap_points(line, new_points.data(), new_points.size());
+  size += raw_line_count(line) - old_count;
+  update_index(line, raw_line_count(line) - old_count);
 }
 
-void wrap_info_t::rewrap_all() {
-  for (size_t i = 0; i < wrap_data.size(); i++) {
-    rewrap_line(i, 0, false);
+void wrap_info_t::wrap_stale_line(text_pos_t line) const {
+  stale_count--;
+  wrap_from(line, 0);
+}
+
+void wrap_info_t::ensure_wrapped(text_pos_t line) const {
+  if (is_stale(line)) {
+    wrap_stale_line(line);
+  }
+}
+
+void wrap_info_t::rewrap_all(int old_width) {
+  /* Rewrapping a large text takes a long time, so all lines are marked as stale instead. Lines
+     are wrapped when they are used, which is the case for the lines on screen, and the rest is
+     wrapped in the background by rewrap_stale. Until then, the number of wrapped lines of each
+     stale line is estimated from its previous wrapping. */
+  for (size_t i = 0; i < line_entries.size(); i++) {
+    if (line_entries[i] == 0) {
+      // Lines which fit on a single line are most common, and are simply estimated to still fit.
+      line_entries[i] = STALE_LINE;
+      stale_count++;
+      continue;
+    }
+    if (!is_stale(i)) {
+      stale_count++;
+    }
+    text_pos_t count = raw_line_count(i);
+    text_pos_t estimate = count;
+    if (old_width > 1 && wrap_width > 1 && count > 1) {
+      estimate = 1 + ((count - 1) * (old_width - 1) + (wrap_width - 1) / 2) / (wrap_width - 1);
+      estimate = std::max<text_pos_t>(estimate, 1);
+    }
+    set_stale(i, estimate);
+    size += estimate - count;
   }
+  invalidate_index(0);
+  next_stale = text->impl->cursor.line;
+  schedule_rewrap();
+}
+
+void wrap_info_t::schedule_rewrap() {
+  if (stale_count == 0 || rewrap_scheduled) {
+    return;
+  }
+  rewrap_scheduled = true;
+  idle_connection = connect_update_notification(bind_front(&wrap_info_t::rewrap_stale, this));
+  signal_update();
+}
+
+void wrap_info_t::rewrap_stale() {
+  /* Wrap a limited amount of text per call, such that the main loop is able to respond to user
+     input between calls. */
+  size_t budget = REWRAP_BATCH_SIZE;
+  text_pos_t lines = line_entries.size();
+  while (stale_count > 0 && budget > 0) {
+    if (next_stale >= lines) {
+      next_stale = 0;
+    }
+    size_t cost = 1;
+    if (is_stale(next_stale)) {
+      cost += text->impl->get_line(next_stale)->size();
+      wrap_stale_line(next_stale);
+    }
+    budget -= std::min(budget, cost);
+    next_stale++;
+  }
+
+  if (stale_count == 0) {
+    rewrap_scheduled = false;
+    idle_connection.disconnect();
+  } else {
+    signal_update();
+  }
+  layout_changed();
+}
+
+void wrap_info_t::wrap_all(int threads) {
+  if (stale_count == 0) {
+    return;
+  }
+
+  /* The wrap points of a block of lines, excluding the start position, followed by the number of
+     wrap points found for each stale line in the block. */
+  struct block_result_t {
+    std::vector<text_pos_t> points;
+    std::vector<text_pos_t> counts;
+  };
+
+  text_pos_t lines = line_entries.size();
+  size_t block_count = (lines + WRAP_ALL_BLOCK_LINES - 1) / WRAP_ALL_BLOCK_LINES;
+  if (threads <= 0) {
+    threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  }
+  threads = std::min<size_t>(threads, block_count);
+
+  std::vector<block_result_t> results(block_count);
+  std::atomic<size_t> next_block(0);
+  /* The wrap points only depend on the text, the wrap width and the tab size, so blocks of lines
+     can be wrapped independently. Lines are only read through get_text on a separate copy of the
+     line_storage_t per thread, and converted into a text_line_t owned by the thread, such that
+     the threads don't modify shared data. */
+  auto wrap_blocks = [&](const line_storage_t *storage) {
+    text_line_t line;
+    std::string scratch;
+    size_t block;
+    while ((block = next_block++) < block_count) {
+      block_result_t &result = results[block];
+      text_pos_t end = std::min<text_pos_t>(lines, (block + 1) * WRAP_ALL_BLOCK_LINES);
+      for (text_pos_t i = block * WRAP_ALL_BLOCK_LINES; i < end; i++) {
+        if (!is_stale(i)) {
+          continue;
+        }
+        line.set_text(storage->get_text(i, &scratch));
+        size_t points_start = result.points.size();
+        text_pos_t pos = 0;
+        while (true) {
+          text_line_t::break_pos_t break_pos = find_next_break_pos(line, pos);
+          if (break_pos.pos <= 0) {
+            break;
+          }
+          pos = break_pos.pos;
+          result.points.push_back(pos);
+        }
+        result.counts.push_back(result.points.size() - points_start);
+      }
+    }
+  };
+
+  // The copies of the line_storage_t must be created and destroyed in this thread.
+  std::vector<std::unique_ptr<line_storage_t>> copies;
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; i++) {
+    copies.emplace_back(new line_storage_t(text->impl->lines));
+    workers.emplace_back(wrap_blocks, copies.back().get());
+  }
+  wrap_blocks(&text->impl->lines);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  copies.clear();
+
+  for (size_t block = 0; block < block_count; block++) {
+    const block_result_t &result = results[block];
+    std::vector<text_pos_t>::const_iterator points = result.points.begin();
+    std::vector<text_pos_t>::const_iterator count = result.counts.begin();
+    text_pos_t end = std::min<text_pos_t>(lines, (block + 1) * WRAP_ALL_BLOCK_LINES);
+    for (text_pos_t i = block * WRAP_ALL_BLOCK_LINES; i < end; i++) {
+      if (!is_stale(i)) {
+        continue;
+      }
+      size -= raw_line_count(i);
+      set_wrap_points(i, result.points.data() + (points - result.points.begin()), *count);
+      size += raw_line_count(i);
+      points += *count;
+      ++count;
+    }
+  }
+  stale_count = 0;
+  invalidate_index(0);
+  rewrap_scheduled = false;
+  idle_connection.disconnect();
+  layout_changed();
 }
 
 void wrap_info_t::set_wrap_width(int width) {
@@ -106,9 +501,10 @@ void wrap_info_t::set_wrap_width(int width) {
   if (width == wrap_width) {
     return;
   }
+  int old_width = wrap_width;
   wrap_width = width;
   if (text != nullptr) {
-    rewrap_all();
+    rewrap_all(old_width);
   }
 }
 
@@ -118,8 +514,50 @@ void wrap_info_t::set_tabsize(int _tabsize) {
   }
   tabsize = _tabsize;
   if (text != nullptr) {
-    rewrap_all();
+    rewrap_all(wrap_width);
+  }
+}
+
+void wrap_info_t::set_wrap_type(wrap_type_t _wrap_type) {
+  if (_wrap_type == wrap_type) {
+    return;
+  }
+  wrap_type = _wrap_type;
+  if (text != nullptr) {
+    rewrap_all(wrap_width);
+  }
+}
+
+void wrap_info_t::get_shared(std::shared_ptr<wrap_info_t> *wrap_info, text_buffer_t *text,
+                             int width, int tabsize, wrap_type_t wrap_type) {
+  layout_key_t key(text, width, tabsize, wrap_type);
+  std::map<layout_key_t, std::weak_ptr<wrap_info_t>>::iterator iter = shared_layouts.find(key);
+  if (iter != shared_layouts.end()) {
+    std::shared_ptr<wrap_info_t> existing = iter->second.lock();
+    if (existing) {
+      *wrap_info = existing;
+      return;
+    }
+  }
+
+  wrap_info_t *current = wrap_info->get();
+  if (current == nullptr || !current->shared || wrap_info->use_count() > 1) {
+    wrap_info->reset(new wrap_info_t(width, tabsize));
+    current = wrap_info->get();
+    current->wrap_type = wrap_type;
+    current->set_text_buffer(text);
+  } else {
+    shared_layouts.erase(
+        layout_key_t(current->text, current->wrap_width, current->tabsize, current->wrap_type));
+    if (current->text != text) {
+      current->set_text_buffer(text);
+    }
+    current->set_tabsize(tabsize);
+    current->set_wrap_type(wrap_type);
+    current->set_wrap_width(width);
   }
+  current->shared = true;
+  shared_layouts[key] = *wrap_info;
 }
 
 void wrap_info_t::set_text_buffer(text_buffer_t *_text) {
@@ -127,28 +565,28 @@ void wrap_info_t::set_text_buffer(text_buffer_t *_text) {
 
   text = _text;
   if (_text == nullptr) {
+    rewrap_scheduled = false;
+    idle_connection.disconnect();
     return;
   }
 
   rewrap_connection = text->connect_rewrap_required(bind_front(&wrap_info_t::rewrap, this));
 
-  if (wrap_data.size() > text->impl->lines.size()) {
-    delete_lines(text->impl->lines.size(), wrap_data.size());
+  if (line_entries.size() > text->impl->lines.size()) {
+    delete_lines(text->impl->lines.size(), line_entries.size());
   }
 
-  for (size_t i = 0; i < wrap_data.size(); i++) {
-    rewrap_line(i, 0, false);
-  }
+  rewrap_all(wrap_width);
 
-  if (wrap_data.size() < text->impl->lines.size()) {
-    insert_lines(wrap_data.size(), text->impl->lines.size());
+  if (line_entries.size() < text->impl->lines.size()) {
+    insert_lines(line_entries.size(), text->impl->lines.size());
   }
 }
 
 void wrap_info_t::rewrap(rewrap_type_t type, text_pos_t a, text_pos_t b) {
   switch (type) {
     case rewrap_type_t::REWRAP_ALL:
-      rewrap_all();
+      rewrap_all(wrap_width);
       break;
     case rewrap_type_t::REWRAP_LINE:
       rewrap_line(a, b, false);
@@ -167,17 +605,30 @@ void wrap_info_t::rewrap(rewrap_type_t type, text_pos_t a, text_pos_t b) {
   }
 }
 
+connection_t wrap_info_t::connect_layout_changed(std::function<void()> func) {
+  return layout_changed.connect(func);
+}
+
 bool wrap_info_t::add_lines(text_coordinate_t &coord, text_pos_t count) const {
   ASSERT(count > 0);
-  while (static_cast<size_t>(coord.line) < wrap_data.size() &&
-         wrap_data[coord.line]->size() <= static_cast<size_t>(coord.pos + count)) {
-    count -= wrap_data[coord.line]->size() - coord.pos;
+  if (count > MAX_STEP_LINES) {
+    text_pos_t wrapped_line = to_wrapped_line(coord) + count;
+    if (wrapped_line >= size) {
+      coord = get_end();
+      return true;
+    }
+    coord = from_wrapped_line(wrapped_line);
+    return false;
+  }
+  while (static_cast<size_t>(coord.line) < line_entries.size() &&
+         get_line_count(coord.line) <= coord.pos + count) {
+    count -= get_line_count(coord.line) - coord.pos;
     coord.line++;
     coord.pos = 0;
   }
-  if (static_cast<size_t>(coord.line) == wrap_data.size()) {
-    coord.line = wrap_data.size() - 1;
-    coord.pos = wrap_data[coord.line]->size() - 1;
+  if (static_cast<size_t>(coord.line) == line_entries.size()) {
+    coord.line = line_entries.size() - 1;
+    coord.pos = get_line_count(coord.line) - 1;
     return true;
   } else {
     coord.pos += count;
@@ -187,15 +638,24 @@ bool wrap_info_t::add_lines(text_coordinate_t &coord, text_pos_t count) const {
 
 bool wrap_info_t::sub_lines(text_coordinate_t &coord, text_pos_t count) const {
   ASSERT(count > 0);
+  if (count > MAX_STEP_LINES) {
+    text_pos_t wrapped_line = to_wrapped_line(coord) - count;
+    if (wrapped_line < 0) {
+      coord = text_coordinate_t(0, 0);
+      return true;
+    }
+    coord = from_wrapped_line(wrapped_line);
+    return false;
+  }
   if (coord.pos > count) {
     coord.pos -= count;
     return false;
   }
   count -= coord.pos;
   coord.pos = 0;
-  while (coord.line > 0 && static_cast<size_t>(count) >= wrap_data[coord.line - 1]->size()) {
+  while (coord.line > 0 && count >= get_line_count(coord.line - 1)) {
     coord.line--;
-    count -= wrap_data[coord.line]->size();
+    count -= get_line_count(coord.line);
   }
   if (count == 0) {
     return false;
@@ -204,23 +664,25 @@ bool wrap_info_t::sub_lines(text_coordinate_t &coord, text_pos_t count) const {
     return true;
   }
   coord.line--;
-  coord.pos = wrap_data[coord.line]->size() - count;
+  coord.pos = get_line_count(coord.line) - count;
   return false;
 }
 
 text_pos_t wrap_info_t::get_line_count(text_pos_t line) const {
-  return static_cast<text_pos_t>(wrap_data[line]->size());
+  ensure_wrapped(line);
+  return raw_line_count(line);
 }
 
 text_coordinate_t wrap_info_t::get_end() const {
-  text_coordinate_t result(static_cast<text_pos_t>(wrap_data.size()) - 1,
-                           static_cast<text_pos_t>(wrap_data[wrap_data.size() - 1]->size()) - 1);
+  text_pos_t last = static_cast<text_pos_t>(line_entries.size()) - 1;
+  text_coordinate_t result(last, get_line_count(last) - 1);
   return result;
 }
 
 text_pos_t wrap_info_t::find_line(text_coordinate_t coord) const {
-  size_t i;
-  for (i = 1; i < wrap_data[coord.line]->size() && coord.pos >= (*wrap_data[coord.line])[i]; i++) {
+  text_pos_t i;
+  text_pos_t count = get_line_count(coord.line);
+  for (i = 1; i < count && coord.pos >= wrap_point(coord.line, i); i++) {
   }
   return i - 1;
 }
@@ -231,26 +693,28 @@ text_pos_t wrap_info_t::calculate_screen_pos() const {
 
 text_pos_t wrap_info_t::calculate_screen_pos(const text_coordinate_t &where) const {
   text_pos_t sub_line = find_line(text->impl->cursor);
-  return text->impl->lines[where.line]->calculate_screen_width((*wrap_data[where.line])[sub_line],
-                                                               where.pos, tabsize);
+  ensure_wrapped(where.line);
+  return text->impl->get_line(where.line)->calculate_screen_width(wrap_point(where.line, sub_line),
+                                                                 where.pos, tabsize);
 }
 
 text_pos_t wrap_info_t::calculate_line_pos(text_pos_t line, text_pos_t pos,
                                            text_pos_t sub_line) const {
-  return text->impl->lines[line]->calculate_line_pos(
-      (*wrap_data[line])[sub_line],
-      static_cast<size_t>(sub_line) + 1 < wrap_data[line]->size()
-          ? (*wrap_data[line])[sub_line + 1] - 1
+  ensure_wrapped(line);
+  return text->impl->get_line(line)->calculate_line_pos(
+      wrap_point(line, sub_line),
+      sub_line + 1 < raw_line_count(line) ? wrap_point(line, sub_line + 1) - 1
           : std::numeric_limits<text_pos_t>::max(),
       pos, tabsize);
 }
 
 void wrap_info_t::paint_line(t3window::window_t *win, text_coordinate_t line,
                              text_line_t::paint_info_t &info) const {
-  info.start = (*wrap_data[line.line])[line.pos];
+  ensure_wrapped(line.line);
+  info.start = wrap_point(line.line, line.pos);
   info.flags &= ~text_line_t::BREAK;
-  if (static_cast<size_t>(line.pos) + 1 < wrap_data[line.line]->size()) {
-    info.max = (*wrap_data[line.line])[(line.pos + 1)];
+  if (line.pos + 1 < raw_line_count(line.line)) {
+    info.max = wrap_point(line.line, line.pos + 1);
     info.flags |= text_line_t::BREAK;
   } else {
     info.max = std::numeric_limits<text_pos_t>::max();
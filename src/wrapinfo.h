@@ -18,6 +18,9 @@
 #error This header file is for internal use _only_!!
 #endif
 
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <t3widget/signals.h>
 #include <t3widget/textbuffer.h>
 #include <t3widget/textline.h>
@@ -28,9 +31,6 @@
 
 namespace t3widget {
 
-typedef std::vector<text_pos_t> wrap_points_t;
-typedef std::vector<wrap_points_t *> wrap_data_t;
-
 /** Class holding information about wrapping a text_buffer_t.
 
     This class is required by edit_window_t and text_buffer_t to present the
@@ -38,20 +38,84 @@ typedef std::vector<wrap_points_t *> wrap_data_t;
     text_coordinate_t class in a special way: the @c pos field is used to store
     the index in the array of wrap points for the line indicated by the @c line
     field.
+
+    Lines are wrapped lazily: after the wrap width or tab size changes, or when
+    lines are inserted, the affected lines are marked as stale. A stale line is
+    wrapped as soon as any of the functions dealing with individual lines is
+    called for it, and the remaining stale lines are wrapped in batches from the
+    @c update_notification signal. Until then, wrapped_size and the wrapped line
+    numbers are estimates. The @c layout_changed signal is emitted after each
+    batch.
 */
 class T3_WIDGET_LOCAL wrap_info_t {
  private:
-  wrap_data_t wrap_data;
+  /* The wrap points of each line are stored compactly. Per line, line_entries holds one 32-bit
+     word. If the line fits on a single screen line, the word is 0 and the only wrap point is the
+     start position. Otherwise it is one more than the offset in wrap_points of the entry for the
+     line. Such an entry holds the number of wrapped lines, followed by the wrap points after the
+     start position. If any of these does not fit in 32 bits, WIDE_POINTS is set in the count and
+     each wrap point takes two words. Replaced entries are left in wrap_points until more than
+     half of it is unused, at which point it is compacted. */
+  mutable std::vector<uint32_t> line_entries;
+  mutable std::vector<uint32_t> wrap_points;
+  mutable size_t unused_points;
+  // Scratch space for computing the wrap points of a line.
+  mutable std::vector<text_pos_t> new_points;
   text_buffer_t *text;
   int tabsize;
   int wrap_width;
-  text_pos_t size;
+  wrap_type_t wrap_type;
+  // Whether this wrap_info_t is registered in the cache used by get_shared.
+  bool shared;
+  mutable text_pos_t size;
   connection_t rewrap_connection;
+  /* Fenwick tree over the number of wrapped lines in each block of INDEX_BLOCK_LINES lines, used
+     to convert between wrapped line numbers and text coordinates. Only the entries before
+     index_valid are up to date. As entry i only covers blocks up to and including i, inserting or
+     deleting lines only invalidates the entries from the first changed block, which are
+     recomputed on demand. */
+  mutable std::vector<text_pos_t> line_index;
+  mutable text_pos_t index_valid;
+
+  /* Lines for which the wrap points have not been computed for the current settings are marked
+     by setting STALE_LINE in their word in line_entries. The entry of such a line only holds the
+     estimated number of wrapped lines, if it is more than one. */
+  mutable text_pos_t stale_count;
+  // The line from which rewrap_stale continues looking for stale lines.
+  text_pos_t next_stale;
+  bool rewrap_scheduled;
+  connection_t idle_connection;
+  signal_t<> layout_changed;
 
+  bool is_stale(text_pos_t line) const;
+  // The number of wrapped lines of line, which is an estimate for stale lines.
+  text_pos_t raw_line_count(text_pos_t line) const;
+  text_pos_t wrap_point(text_pos_t line, text_pos_t sub_line) const;
+  // Set the wrap points of line to the start position followed by the count positions in points.
+  void set_wrap_points(text_pos_t line, const text_pos_t *points, size_t count) const;
+  // Mark line as stale, with an estimate of its number of wrapped lines.
+  void set_stale(text_pos_t line, text_pos_t estimate) const;
+  // Release the entry of line, and point line_entries at a new entry at the end of wrap_points.
+  void new_entry(text_pos_t line) const;
+  void release_entry(text_pos_t line) const;
+  void compact_wrap_points() const;
+
+  // The total number of wrapped lines of the lines in block of the Fenwick tree.
+  text_pos_t index_block_count(text_pos_t block) const;
+  void invalidate_index(text_pos_t line);
+  void update_index(text_pos_t line, text_pos_t delta) const;
+  void build_index(text_pos_t end) const;
   void delete_lines(text_pos_t first, text_pos_t last);
   void insert_lines(text_pos_t first, text_pos_t last);
   void rewrap_line(text_pos_t line, text_pos_t pos, bool force);
-  void rewrap_all();
+  // Find the next break position in line according to the wrap type.
+  text_line_t::break_pos_t find_next_break_pos(const text_line_t &line, text_pos_t start) const;
+  void wrap_from(text_pos_t line, text_pos_t sub_line) const;
+  void wrap_stale_line(text_pos_t line) const;
+  void ensure_wrapped(text_pos_t line) const;
+  void rewrap_all(int old_width);
+  void schedule_rewrap();
+  void rewrap_stale();
   void rewrap(rewrap_type_t type, text_pos_t a, text_pos_t b);
 
  public:
@@ -60,10 +124,37 @@ class T3_WIDGET_LOCAL wrap_info_t {
   text_pos_t unwrapped_size() const;
   text_pos_t wrapped_size() const;
   text_pos_t get_line_count(text_pos_t line) const;
+  /** Get the number of the wrapped line @p coord, counted from the start of the text.
+      @p coord.pos is the index of the wrapped line within @p coord.line. */
+  text_pos_t to_wrapped_line(text_coordinate_t coord) const;
+  /** Get the coordinate of the wrapped line numbered @p wrapped_line, which must be at least 0
+      and less than wrapped_size. */
+  text_coordinate_t from_wrapped_line(text_pos_t wrapped_line) const;
 
   void set_wrap_width(int width);
   void set_tabsize(int _tabsize);
+  void set_wrap_type(wrap_type_t _wrap_type);
   void set_text_buffer(text_buffer_t *_text);
+  /** Make @p wrap_info point to a wrap_info_t for @p text with the given settings, which is shared
+      with all other users requesting the same settings.
+
+      This allows several views of the same text_buffer_t to wrap the text only once. The
+      returned wrap_info_t must not be modified through its setters. If @p wrap_info already holds
+      the only reference to a wrap_info_t, and no wrap_info_t with the new settings exists, it is
+      reconfigured instead of replaced, such that its current wrapping can be used to estimate
+      the new layout.
+  */
+  static void get_shared(std::shared_ptr<wrap_info_t> *wrap_info, text_buffer_t *text, int width,
+                         int tabsize, wrap_type_t wrap_type);
+  /** Wrap all stale lines immediately, instead of waiting for them to be wrapped in the background.
+      @param threads The number of threads to use, or 0 to use one thread per processor.
+
+      This is for operations which need the exact layout of the whole text.
+  */
+  void wrap_all(int threads = 0);
+  /** Connect a callback to the @c layout_changed signal, which is emitted when stale lines have
+      been wrapped in the background. */
+  connection_t connect_layout_changed(std::function<void()> func);
 
   bool add_lines(text_coordinate_t &coord, text_pos_t count) const;
   bool sub_lines(text_coordinate_t &coord, text_pos_t count) const;
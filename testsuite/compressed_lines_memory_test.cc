@@ -0,0 +1,47 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measure the heap memory used by a text_buffer_t filled with log-like lines, before and after
+// text_buffer_t::compress_inactive_lines.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "heap_usage.h"
+#include "textbuffer.h"
+
+int main(int argc, char *argv[]) {
+  size_t line_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500000;
+  char line[256];
+
+  size_t before = heap_allocated;
+  t3widget::text_buffer_t buffer(nullptr, t3widget::text_storage_t::ROPE);
+  std::srand(1);
+  for (size_t i = 0; i < line_count; ++i) {
+    snprintf(line, sizeof(line),
+             "2018-05-%02zu 12:%02zu:%02zu.%03zu INFO [worker-%zu] RequestHandler: request %zu "
+             "processed in %d ms, status=%s\n",
+             1 + i / 20000 % 28, i / 1000 % 60, i / 17 % 60, i % 1000, i % 8, 100000 + i,
+             std::rand() % 500, std::rand() % 10 == 0 ? "FAILED" : "OK");
+    buffer.append_text(line);
+  }
+  size_t uncompressed = heap_allocated - before;
+  buffer.compress_inactive_lines(1000);
+  size_t compressed = heap_allocated - before;
+
+  std::cout << "uncompressed: " << static_cast<double>(uncompressed) / line_count
+            << " bytes per line\ncompressed: " << static_cast<double>(compressed) / line_count
+            << " bytes per line\n";
+}
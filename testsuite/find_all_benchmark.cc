@@ -0,0 +1,59 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measure the time text_buffer_t::find_all takes to count the matches in a large file, for
+// increasing numbers of threads. See thread_benchmark.h for the arguments.
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#define _T3_WIDGET_INTERNAL
+#include "findcontext.h"
+#include "main.h"
+#include "textbuffer.h"
+#include "thread_benchmark.h"
+
+using namespace t3widget;
+
+static void measure(text_buffer_t *text, const char *needle, int flags, int max_threads) {
+  std::string error_message;
+  std::unique_ptr<finder_t> finder = finder_t::create(needle, flags, &error_message);
+  if (finder == nullptr) {
+    std::cerr << "Could not create finder: " << error_message << "\n";
+    exit(EXIT_FAILURE);
+  }
+
+  std::string label = std::string("\"") + needle + "\"" +
+                      ((flags & find_flags_t::ICASE) ? " (icase)" : "") + ", ";
+  measure_threads(label, max_threads, [](int) {},
+                  [&](int threads) {
+                    std::unique_ptr<text_buffer_search_t> search =
+                        text->find_all(*finder, true, threads);
+                    search->wait();
+                    return std::to_string(search->get_count()) + " matches";
+                  });
+}
+
+int main(int argc, char *argv[]) {
+  thread_benchmark_args_t args(argc, argv);
+
+  text_buffer_t text;
+  load_generated_file(&text, args.line_count, 0);
+
+  measure(&text, "jkl", 0, args.max_threads);
+  measure(&text, "JKL", find_flags_t::ICASE, args.max_threads);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measure the throughput of finder_t::match for plain text searches on a large line which does not
+// contain the needle. The first argument is the size of the line in megabytes (default 64).
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#define _T3_WIDGET_INTERNAL
+#include "findcontext.h"
+
+using namespace t3widget;
+
+static void measure(const std::string &haystack, const char *needle, int flags) {
+  std::string error_message;
+  std::unique_ptr<finder_t> finder = finder_t::create(needle, flags, &error_message);
+  if (finder == nullptr) {
+    std::cerr << "Could not create finder: " << error_message << "\n";
+    exit(EXIT_FAILURE);
+  }
+
+  find_result_t result;
+  result.start.line = result.end.line = 0;
+  result.start.pos = 0;
+  result.end.pos = -1;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool found = finder->match(haystack, &result, false);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << '"' << needle << '"' << ((flags & find_flags_t::ICASE) ? " (icase)" : "") << ": "
+            << seconds << " s, " << haystack.size() / seconds / 1e9 << " GB/s"
+            << (found ? ", found" : "") << "\n";
+}
+
+int main(int argc, char *argv[]) {
+  size_t size = (argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64) << 20;
+
+  // English-like text: lower case words with the occasional capital, without the needles below.
+  std::string haystack;
+  haystack.reserve(size + 16);
+  srand(1);
+  while (haystack.size() < size) {
+    if (rand() % 10 == 0) {
+      haystack += 'A' + rand() % 26;
+    }
+    haystack.append("abcdefghijklmnopqrstuvwxy" + rand() % 17, 1 + rand() % 8);
+    haystack += ' ';
+  }
+
+  measure(haystack, "needle", 0);
+  measure(haystack, "Needle", find_flags_t::ICASE);
+  measure(haystack, "z\xc3\xbcrich", 0);
+  measure(haystack, "z\xc3\xbcrich", find_flags_t::ICASE);
+  return EXIT_SUCCESS;
+}
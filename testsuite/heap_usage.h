@@ -0,0 +1,46 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_TESTSUITE_HEAP_USAGE_H
+#define T3_WIDGET_TESTSUITE_HEAP_USAGE_H
+
+// Replacements for the global operator new and delete, which keep track of the number of bytes of
+// heap memory in use in heap_allocated. Uses glibc's malloc_usable_size to include the malloc
+// overhead. As this defines the replacements, it must be included in only one file of a program.
+
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+static size_t heap_allocated;
+
+void *operator new(size_t size) {
+  void *result = std::malloc(size);
+  if (result == nullptr) {
+    throw std::bad_alloc();
+  }
+  // Each malloc chunk has a header of one size_t.
+  heap_allocated += malloc_usable_size(result) + sizeof(size_t);
+  return result;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr != nullptr) {
+    heap_allocated -= malloc_usable_size(ptr) + sizeof(size_t);
+  }
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+#endif
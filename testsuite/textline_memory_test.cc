@@ -0,0 +1,66 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measure the number of bytes of heap memory used per line, for the default text_line_factory_t,
+// the pooled_text_line_factory_t and the interning_text_line_factory_t.
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "heap_usage.h"
+#include "textline.h"
+
+static void measure(const char *name, t3widget::text_line_factory_t *factory, size_t line_count) {
+  std::vector<std::unique_ptr<t3widget::text_line_t>> lines;
+  std::string text;
+
+  lines.reserve(line_count);
+  std::srand(1);
+  size_t before = heap_allocated;
+  size_t text_bytes = 0;
+  for (size_t i = 0; i < line_count; ++i) {
+    // Mostly short lines, with the occasional empty or longer line, as in source code.
+    text.assign(std::rand() % 8 == 0 ? 0 : std::rand() % (std::rand() % 4 == 0 ? 80 : 30), 'x');
+    text_bytes += text.size();
+    lines.push_back(factory->new_text_line_t(text));
+  }
+  // Empty lines, as created while editing.
+  for (size_t i = 0; i < line_count / 10; ++i) {
+    lines.push_back(factory->new_text_line_t());
+  }
+  size_t used = heap_allocated - before - lines.capacity() * sizeof(lines[0]);
+
+  std::cout << name << ": " << static_cast<double>(used) / lines.size() << " bytes per line, "
+            << static_cast<double>(text_bytes) / lines.size() << " bytes of text per line\n";
+  t3widget::interning_text_line_factory_t *interning_factory =
+      dynamic_cast<t3widget::interning_text_line_factory_t *>(factory);
+  if (interning_factory != nullptr) {
+    std::cout << "  " << interning_factory->get_shared_lines() << " shared lines, "
+              << interning_factory->get_unique_texts() << " unique texts, dedup ratio "
+              << interning_factory->get_dedup_ratio() << "\n";
+  }
+}
+
+int main(int argc, char *argv[]) {
+  size_t line_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  measure("text_line_factory_t", &t3widget::default_text_line_factory, line_count);
+  t3widget::pooled_text_line_factory_t pooled_factory;
+  measure("pooled_text_line_factory_t", &pooled_factory, line_count);
+  t3widget::interning_text_line_factory_t interning_factory;
+  measure("interning_text_line_factory_t", &interning_factory, line_count);
+}
@@ -0,0 +1,95 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef T3_WIDGET_TESTSUITE_THREAD_BENCHMARK_H
+#define T3_WIDGET_TESTSUITE_THREAD_BENCHMARK_H
+
+// Common parts of the benchmarks which measure an operation on a large file loaded with
+// text_buffer_t::load_file, for increasing numbers of threads. The first argument of these
+// benchmarks is the number of lines (default 10,000,000), the second the maximum number of threads
+// (default the number of processors).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "textbuffer.h"
+
+struct thread_benchmark_args_t {
+  size_t line_count;
+  int max_threads;
+
+  thread_benchmark_args_t(int argc, char *argv[])
+      : line_count(argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000),
+        max_threads(std::max(
+            argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency()),
+            1)) {}
+};
+
+/* Load line_count lines of random words into text, through a temporary file. Each line starts with
+   its number. Every long_line_interval-th line has 40 to 80 words, the others 4 to 12. Pass 0 to
+   only generate short lines. Exits the program on failure. */
+static void load_generated_file(t3widget::text_buffer_t *text, size_t line_count,
+                                size_t long_line_interval) {
+  FILE *file = tmpfile();
+  if (file == nullptr) {
+    std::cerr << "Could not create temporary file\n";
+    exit(EXIT_FAILURE);
+  }
+  srand(1);
+  for (size_t i = 0; i < line_count; ++i) {
+    int words = long_line_interval != 0 && i % long_line_interval == 0 ? 40 + rand() % 40
+                                                                        : 4 + rand() % 8;
+    fprintf(file, "%08zu", i);
+    for (int j = 0; j < words; ++j) {
+      fprintf(file, " %.*s", 1 + rand() % 9, "abcdefghijklmnopqrstuvwxyz" + rand() % 17);
+    }
+    fputc('\n', file);
+  }
+  fflush(file);
+
+  if (!text->load_file(fileno(file)).get_success()) {
+    std::cerr << "Could not load temporary file\n";
+    exit(EXIT_FAILURE);
+  }
+  text->wait_for_load();
+  // The lines which have not been converted yet refer to the mapping, which remains valid.
+  fclose(file);
+}
+
+/* Time run(threads) for 1, 2, 4, ... up to max_threads threads, and print the time taken and the
+   speedup compared to a single thread, preceded by label and followed by the description of the
+   result returned by run. prepare(threads) is called before each run, outside the timed part. */
+template <class P, class R>
+static void measure_threads(const std::string &label, int max_threads, const P &prepare,
+                            const R &run) {
+  double single_thread_time = 0;
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    prepare(threads);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string result = run(threads);
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (threads == 1) {
+      single_thread_time = seconds;
+    }
+    std::cout << label << threads << " threads: " << seconds << " s, speedup "
+              << single_thread_time / seconds << ", " << result << "\n";
+  }
+}
+
+#endif
@@ -0,0 +1,269 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Test the edit journal: records written by undo_journal_t are read back by replay, retracted and
+// reset records are gone, and replaying the journal of a text_buffer_t after edits, undo, redo and
+// set_undo_mark restores its contents. Journals that do not match the buffer must be rejected.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+#define _T3_WIDGET_INTERNAL
+#include "main.h"
+#include "textbuffer.h"
+#include "undojournal.h"
+
+using namespace t3widget;
+
+static int failures;
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cout << "Failed: " << what << "\n";
+    ++failures;
+  }
+}
+
+static int temp_file() {
+  char name[] = "/tmp/undo_journal_testXXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    perror("mkstemp");
+    exit(EXIT_FAILURE);
+  }
+  unlink(name);
+  return fd;
+}
+
+// Formats a record as it is returned by records.
+static std::string record(undo_type_t type, text_pos_t line, text_pos_t pos, string_view text) {
+  return std::to_string(type) + "," + std::to_string(line) + "," + std::to_string(pos) + "," +
+         std::string(text.data(), text.size()) + ";";
+}
+
+// Returns the records in the journal in fd, formatted by record.
+static std::string records(int fd) {
+  std::string result;
+  int error = undo_journal_t::replay(
+      fd, [&result](undo_type_t type, text_coordinate_t start, string_view text) {
+        result += record(type, start.line, start.pos, text);
+        return true;
+      });
+  if (error != 0) {
+    result += "error";
+  }
+  return result;
+}
+
+static void test_journal() {
+  int fd = temp_file();
+  int error;
+  std::unique_ptr<undo_journal_t> journal = undo_journal_t::open(fd, &error);
+  check(journal != nullptr, "open empty file");
+
+  journal->append(1, true, UNDO_ADD_REDO, text_coordinate_t(0, 0), "abc");
+  journal->append(2, true, UNDO_DELETE, text_coordinate_t(1, 2), "x\ny");
+  check(journal->sync() == 0, "sync");
+  check(records(fd) == record(UNDO_ADD_REDO, 0, 0, "abc") + record(UNDO_DELETE, 1, 2, "x\ny"),
+        "replay appended records");
+
+  // Retracting a record which was already written truncates the file.
+  check(journal->retract(2), "retract written record");
+  check(records(fd) == record(UNDO_ADD_REDO, 0, 0, "abc"), "replay after retract");
+  // Retracting a pending record only drops it from memory.
+  journal->append(3, true, UNDO_BACKSPACE_REDO, text_coordinate_t(0, 3), "c");
+  check(journal->retract(3), "retract pending record");
+  // Records of undone operations can not be retracted, and neither can any before them.
+  journal->append(4, false, UNDO_ADD, text_coordinate_t(0, 0), "ab");
+  check(!journal->retract(4), "retract backward record");
+  check(!journal->retract(1), "retract record which is not the last");
+  check(journal->sync() == 0, "sync after retract");
+  check(records(fd) == record(UNDO_ADD_REDO, 0, 0, "abc") + record(UNDO_ADD, 0, 0, "ab"),
+        "replay after retracting pending record");
+
+  journal->reset();
+  check(journal->sync() == 0, "sync after reset");
+  check(records(fd).empty(), "replay after reset");
+
+  // A partially written record at the end is ignored, and removed by open.
+  journal->append(5, true, UNDO_ADD_REDO, text_coordinate_t(2, 1), "def");
+  journal->sync();
+  off_t size = lseek(fd, 0, SEEK_END);
+  journal.reset();
+  check(ftruncate(fd, size - 1) == 0, "truncate journal");
+  check(records(fd).empty(), "replay partial record");
+  journal = undo_journal_t::open(fd, &error);
+  check(journal != nullptr && lseek(fd, 0, SEEK_END) == 8, "open removes partial record");
+  journal.reset();
+  close(fd);
+
+  fd = temp_file();
+  check(write(fd, "not a journal", 13) == 13, "write non-journal");
+  check(undo_journal_t::open(fd, &error) == nullptr && error == EINVAL, "open non-journal");
+  check(records(fd) == "error", "replay non-journal");
+  close(fd);
+}
+
+// Exposes set_undo_mark, which is how an application marks the buffer as saved.
+class test_buffer_t : public text_buffer_t {
+ public:
+  test_buffer_t(const char *text) { append_text(text); }
+  using text_buffer_t::set_undo_mark;
+};
+
+static std::string contents(text_buffer_t *buffer) {
+  text_pos_t last = buffer->size() - 1;
+  return *buffer->convert_block(text_coordinate_t(0, 0),
+                                text_coordinate_t(last, buffer->get_line_size(last)));
+}
+
+static void type_text(text_buffer_t *buffer, const char *text) {
+  for (; *text != 0; ++text) {
+    if (*text == '\n') {
+      buffer->break_line();
+    } else {
+      buffer->insert_char(static_cast<unsigned char>(*text));
+    }
+  }
+}
+
+// Replays the journal in fd on a new buffer holding initial, and compares it with expected.
+static void check_replay(int fd, const char *initial, text_buffer_t *expected, const char *what) {
+  test_buffer_t restored(initial);
+  check(restored.replay_journal(fd).get_success(), what);
+  check(contents(&restored) == contents(expected), what);
+}
+
+static void test_buffer() {
+  static const char initial[] = "first line\n\tsecond line\nthird line";
+  int fd = temp_file();
+  test_buffer_t buffer(initial);
+  check(buffer.start_journal(fd).get_success(), "start journal");
+
+  buffer.set_cursor(text_coordinate_t(0, 5));
+  type_text(&buffer, " typed\ntext");
+  buffer.set_cursor(text_coordinate_t(2, 8));
+  buffer.backspace_char();
+  buffer.backspace_char();
+  buffer.delete_char();
+  buffer.set_cursor(text_coordinate_t(3, 0));
+  buffer.overwrite_char('T');
+  buffer.overwrite_char('H');
+  buffer.delete_block(text_coordinate_t(0, 2), text_coordinate_t(1, 3));
+  buffer.set_cursor(text_coordinate_t(1, 0));
+  buffer.set_selection_mode(selection_mode_t::SHIFT);
+  buffer.set_cursor(text_coordinate_t(2, 3));
+  buffer.set_selection_end();
+  buffer.indent_selection(8, false);
+  buffer.set_selection_mode(selection_mode_t::NONE);
+  check(buffer.sync_journal().get_success(), "sync journal");
+  check_replay(fd, initial, &buffer, "replay edits");
+
+  // Undone operations are retracted or recorded as their reverse, and redone ones are recorded.
+  buffer.apply_undo();
+  buffer.apply_undo();
+  buffer.apply_undo();
+  buffer.apply_redo();
+  buffer.sync_journal();
+  check_replay(fd, initial, &buffer, "replay undo and redo");
+
+  // After the buffer is saved, the journal only holds the changes since.
+  std::string saved = contents(&buffer);
+  buffer.set_undo_mark();
+  buffer.set_cursor(text_coordinate_t(0, 0));
+  type_text(&buffer, "after save ");
+  buffer.apply_undo();
+  buffer.apply_redo();
+  buffer.set_cursor(text_coordinate_t(1, 1));
+  buffer.unindent_line(8);
+  buffer.sync_journal();
+  check_replay(fd, saved.c_str(), &buffer, "replay after set_undo_mark");
+
+  // Undoing everything since the save leaves a journal that restores the saved contents.
+  while (buffer.is_modified() && buffer.apply_undo() == 0) {
+  }
+  buffer.sync_journal();
+  check(contents(&buffer) == saved, "undo to saved state");
+  check_replay(fd, saved.c_str(), &buffer, "replay after undoing to saved state");
+  close(fd);
+}
+
+// Writes a journal with a single record, and replays it on a buffer holding text.
+static bool replay_record(const char *text, undo_type_t type, text_coordinate_t start,
+                          string_view record_text) {
+  int fd = temp_file();
+  int error;
+  std::unique_ptr<undo_journal_t> journal = undo_journal_t::open(fd, &error);
+  journal->append(1, true, type, start, record_text);
+  journal.reset();
+  test_buffer_t buffer(text);
+  bool result = buffer.replay_journal(fd).get_success();
+  close(fd);
+  check(result || contents(&buffer) == text, "rejected record does not change buffer");
+  return result;
+}
+
+static void test_foreign_journal() {
+  static const char text[] = "abc\ndef";
+  check(replay_record(text, UNDO_ADD, text_coordinate_t(0, 1), "bc\nd"), "valid UNDO_ADD");
+  check(!replay_record(text, UNDO_ADD, text_coordinate_t(0, 1), "bx"), "UNDO_ADD mismatch");
+  check(!replay_record(text, UNDO_ADD, text_coordinate_t(1, 1), "ef\ngh"),
+        "UNDO_ADD past last line");
+  check(!replay_record(text, UNDO_ADD, text_coordinate_t(1, 1), "efgh"),
+        "UNDO_ADD past end of line");
+  check(!replay_record(text, UNDO_ADD_REDO, text_coordinate_t(2, 0), "x"),
+        "UNDO_ADD_REDO past last line");
+  check(!replay_record(text, UNDO_DELETE, text_coordinate_t(0, 4), "x"),
+        "UNDO_DELETE past end of line");
+  check(replay_record(text, UNDO_BACKSPACE_REDO, text_coordinate_t(1, 3), "ef"),
+        "valid UNDO_BACKSPACE_REDO");
+  check(!replay_record(text, UNDO_BACKSPACE_REDO, text_coordinate_t(1, 3), "xf"),
+        "UNDO_BACKSPACE_REDO mismatch");
+  check(!replay_record(text, UNDO_BACKSPACE, text_coordinate_t(0, 1), "xy"),
+        "UNDO_BACKSPACE before start of line");
+  // The text of overwrite records is the length of the first string, followed by both strings.
+  check(replay_record(text, UNDO_OVERWRITE_REDO, text_coordinate_t(0, 1), string_view("\2bcXY", 5)),
+        "valid UNDO_OVERWRITE_REDO");
+  check(!replay_record(text, UNDO_OVERWRITE_REDO, text_coordinate_t(0, 2),
+                       string_view("\2bcXY", 5)),
+        "UNDO_OVERWRITE_REDO past end of line");
+  check(!replay_record(text, UNDO_OVERWRITE, text_coordinate_t(0, 1), string_view("\2bcXY", 5)),
+        "UNDO_OVERWRITE mismatch");
+  check(!replay_record(text, UNDO_OVERWRITE, text_coordinate_t(0, 1), string_view("\5bc", 3)),
+        "UNDO_OVERWRITE with invalid length");
+  // The text of indent records is the indentation of each line, followed by an X.
+  check(replay_record(text, UNDO_UNINDENT, text_coordinate_t(0, 0), "\tX\tX"),
+        "valid UNDO_UNINDENT");
+  check(!replay_record(text, UNDO_UNINDENT, text_coordinate_t(1, 0), "\tX\tX"),
+        "UNDO_UNINDENT past last line");
+  check(!replay_record(text, UNDO_INDENT, text_coordinate_t(0, 0), "\tX\tX"),
+        "UNDO_INDENT mismatch");
+  check(!replay_record(text, UNDO_BLOCK_START, text_coordinate_t(0, 0), ""), "UNDO_BLOCK_START");
+}
+
+int main(int, char **) {
+  test_journal();
+  test_buffer();
+  test_foreign_journal();
+  if (failures != 0) {
+    std::cout << failures << " checks failed\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
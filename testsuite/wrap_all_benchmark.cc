@@ -0,0 +1,50 @@
+/* Copyright (C) 2018 G.P. Halkes
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3, as
+   published by the Free Software Foundation.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measure the time wrap_info_t::wrap_all takes to wrap a large file, for increasing numbers of
+// threads. See thread_benchmark.h for the arguments.
+
+#include <cstdlib>
+#include <string>
+
+#define _T3_WIDGET_INTERNAL
+#include "main.h"
+#include "textbuffer.h"
+#include "thread_benchmark.h"
+#include "wrapinfo.h"
+
+using namespace t3widget;
+
+int main(int argc, char *argv[]) {
+  thread_benchmark_args_t args(argc, argv);
+
+  text_buffer_t text;
+  // Mostly short lines, with every tenth line long enough to need wrapping a few times.
+  load_generated_file(&text, args.line_count, 10);
+
+  wrap_info_t wrap_info(80);
+  wrap_info.set_text_buffer(&text);
+
+  int width = 80;
+  measure_threads("", args.max_threads,
+                  [&](int) {
+                    // Changing the width marks all lines as stale again.
+                    wrap_info.set_wrap_width(width = width == 80 ? 81 : 80);
+                  },
+                  [&](int threads) {
+                    wrap_info.wrap_all(threads);
+                    return std::to_string(wrap_info.wrapped_size()) + " wrapped lines";
+                  });
+  return EXIT_SUCCESS;
+}